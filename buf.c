@@ -1,10 +1,140 @@
+#include <stdint.h>
+#include <stdio.h>
 #include "buf.h"
+#include "memstats.h"
+
+/* malloc() alignment the default allocator gets for free */
+#define BUF_MIN_ALIGN		16
+
+static void *buf_malloc_realloc(void *ctx, void *ptr, size_t old_size,
+				size_t new_size, size_t align)
+{
+	void *p;
+
+	if (align <= BUF_MIN_ALIGN)
+		return realloc(ptr, new_size);
+
+	if (posix_memalign(&p, align, new_size))
+		return NULL;
+	if (ptr) {
+		memcpy(p, ptr, old_size < new_size ? old_size : new_size);
+		free(ptr);
+	}
+	return p;
+}
+
+static void buf_malloc_free(void *ctx, void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+static const struct buf_allocator buf_malloc = {
+	buf_malloc_realloc,
+	buf_malloc_free,
+	NULL
+};
+
+static __thread const struct buf_allocator *cur_alloc;
+
+static void buf_default_oom(size_t size)
+{
+	fprintf(stderr, "buf: out of memory allocating %zu bytes\n", size);
+	abort();
+}
+
+static void (*oom_handler)(size_t size) = buf_default_oom;
+
+const struct buf_allocator *buf_set_allocator(const struct buf_allocator *alloc)
+{
+	const struct buf_allocator *prev = cur_alloc;
+
+	cur_alloc = alloc;
+	return prev;
+}
+
+void buf_set_oom_handler(void (*handler)(size_t size))
+{
+	oom_handler = handler ? handler : buf_default_oom;
+}
+
+/* Header space in front of the payload, keeps the payload aligned */
+static size_t buf_pad(size_t align)
+{
+	return align > sizeof(struct buf_hdr_) ? align : sizeof(struct buf_hdr_);
+}
+
+static int buf_alloc(void **a, size_t nr, size_t sz,
+		     const struct buf_allocator *alloc, size_t align)
+{
+	struct buf_hdr_ *hdr = *a ? buf_hdr_(*a) : NULL;
+	size_t pad, old_size, new_size;
+	int tag = mem_tag_();
+	char *raw;
+
+	if (hdr) {
+		alloc = hdr->alloc;
+		align = hdr->align;
+		tag = hdr->tag;
+	}
+	pad = buf_pad(align);
+	if (sz && nr > (SIZE_MAX - pad) / sz)
+		return -1;
+
+	old_size = hdr ? pad + hdr->m * sz : 0;
+	new_size = pad + nr * sz;
+	raw = alloc->realloc(alloc->ctx, hdr ? (char *) *a - pad : NULL,
+			     old_size, new_size, align);
+	if (!raw)
+		return -1;
+	mem_charge_(tag, old_size, new_size);
+
+	hdr = (struct buf_hdr_ *) (raw + pad) - 1;
+	if (!*a) {
+		hdr->alloc = alloc;
+		hdr->align = align;
+		hdr->tag = tag;
+		hdr->n = 0;
+	}
+	hdr->m = nr;
+	*a = raw + pad;
+	return 0;
+}
+
+int buf_do_try_realloc_(void **a, size_t nr, size_t sz)
+{
+	return buf_alloc(a, nr, sz, cur_alloc ? cur_alloc : &buf_malloc,
+			 BUF_MIN_ALIGN);
+}
+
+/* The callers go on to write past the old capacity, so there is no return */
+static void buf_oom(size_t size)
+{
+	oom_handler(size);
+	abort();
+}
 
 void buf_do_realloc_(void **a, size_t nr, size_t sz)
 {
-	size_t *p = realloc(*a ? buf_raw_(*a) : NULL, 2 * sizeof(size_t) + nr * sz);
-	p[0] = nr;
-	if (!*a)
-		p[1] = 0;
-	*a = p + 2;
+	if (buf_do_try_realloc_(a, nr, sz))
+		buf_oom(buf_pad(*a ? buf_hdr_(*a)->align : BUF_MIN_ALIGN) + nr * sz);
+}
+
+void buf_do_init_(void **a, const struct buf_allocator *alloc, size_t align)
+{
+	if (!alloc)
+		alloc = cur_alloc ? cur_alloc : &buf_malloc;
+	if (align < BUF_MIN_ALIGN)
+		align = BUF_MIN_ALIGN;
+	*a = NULL;
+	if (buf_alloc(a, 0, 0, alloc, align))
+		buf_oom(buf_pad(align));
+}
+
+void buf_do_free_(void *a, size_t sz)
+{
+	struct buf_hdr_ *hdr = buf_hdr_(a);
+	size_t pad = buf_pad(hdr->align);
+
+	mem_charge_(hdr->tag, pad + hdr->m * sz, 0);
+	hdr->alloc->free(hdr->alloc->ctx, (char *) a - pad, pad + hdr->m * sz);
 }
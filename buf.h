@@ -2,28 +2,84 @@
 #define BUF_H
 
 #include <stdlib.h>
+#include <string.h>
 
 /* Based on Sean Barrett's stretchy buffer at http://www.nothings.org/stb/stretchy_buffer.txt
- * init: NULL, free: buf_free(), push_back: buf_push(), size: buf_len()
+ * init: NULL, free: buf_free(), push_back: buf_push(), size: buf_len(), capacity: buf_cap()
+ *
+ * buf_push_n() grows the buffer by n elements and returns the first new one,
+ * buf_append() copies n elements from an array to the end.
+ *
+ * A NULL buffer allocates through the calling thread's current allocator
+ * (see buf_set_allocator()) on first growth.  buf_init() instead creates an
+ * empty buffer bound to a given allocator and alignment; buf_init_simd()
+ * aligns the payload to BUF_SIMD_ALIGN bytes.  Either way a buffer keeps
+ * its allocator for life, so it may be freed from any thread.
+ *
+ * When an allocation fails the out of memory handler is called, which by
+ * default reports the failed size; the program aborts if it returns.  The
+ * buf_try_*() variants return -1 instead and leave the buffer untouched,
+ * for callers that can report the failure.
  */
+#define BUF_SIMD_ALIGN		64
+
 #define buf_len(a)		((a) ? buf_n_(a) : 0)
+#define buf_cap(a)		((a) ? buf_m_(a) : 0)
 #define buf_push(a, v)		(buf_maybegrow1_(a), (a)[buf_n_(a)++] = (v))
+#define buf_push_n(a, n)	(buf_maybegrown_(a, n), buf_n_(a) += (n), (a) + buf_n_(a) - (n))
+#define buf_append(a, v, n)	memcpy(buf_push_n(a, n), (v), (n) * sizeof(*(a)))
 #define buf_last(a)		((a)[buf_n_(a) - 1])
 #define buf_resize(a, n)	(buf_maybegrow_(a, n), (a) ? buf_n_(a) = (n) : 0)
 #define buf_reserve(a, n)	(buf_maybegrow_(a, n))
-#define buf_free(a)		((a) ? free(buf_raw_(a)) : (void) 0)
+#define buf_free(a)		((a) ? buf_do_free_((a), sizeof(*(a))) : (void) 0)
 #define buf_foreach(it, a)	for ((it) = (a); (it) < (a) + buf_len(a); (it)++)
 
+#define buf_init(a, alloc, align)	buf_do_init_((void **) &(a), alloc, align)
+#define buf_init_simd(a)		buf_init(a, NULL, BUF_SIMD_ALIGN)
+
+#define buf_try_reserve(a, n)	(((n) > 0) && (!(a) || (n) >= buf_m_(a)) ? \
+				 buf_try_realloc_(a, n) : 0)
+#define buf_try_push(a, v)	(buf_try_grow1_(a) ? -1 : ((a)[buf_n_(a)++] = (v), 0))
+
+struct buf_allocator {
+	/* Like realloc(), ptr is NULL for new blocks; the result must be
+	 * aligned to align and keep the first old_size bytes */
+	void *(*realloc)(void *ctx, void *ptr, size_t old_size,
+			 size_t new_size, size_t align);
+	void (*free)(void *ctx, void *ptr, size_t size);
+	void *ctx;
+};
+
+/* Sets the calling thread's allocator for new buffers, NULL for malloc */
+const struct buf_allocator *buf_set_allocator(const struct buf_allocator *alloc);
+void buf_set_oom_handler(void (*handler)(size_t size));
+
 /* Private */
-#define buf_raw_(a)		((size_t *) (a) - 2)
-#define buf_m_(a)		(buf_raw_(a)[0])
-#define buf_n_(a)		(buf_raw_(a)[1])
+struct buf_hdr_ {
+	const struct buf_allocator *alloc;
+	unsigned int align;
+	unsigned int tag;	/* memstats.h subsystem */
+	size_t m, n;
+};
+
+#define buf_hdr_(a)		((struct buf_hdr_ *) (a) - 1)
+#define buf_m_(a)		(buf_hdr_(a)->m)
+#define buf_n_(a)		(buf_hdr_(a)->n)
 
 #define buf_maybegrow_(a, n)	(((n) > 0) && (!(a) || (n) >= buf_m_(a)) ? buf_realloc_(a, n) : (void) 0)
 #define buf_maybegrow1_(a)	(!(a) || buf_m_(a) == 0 ? buf_realloc_(a, 8) : \
 				 buf_n_(a) == buf_m_(a) ? buf_realloc_(a, 3 * buf_m_(a) / 2) : (void) 0)
+#define buf_maybegrown_(a, n)	(!(a) || buf_n_(a) + (n) > buf_m_(a) ? \
+				 buf_realloc_(a, buf_max_(buf_len(a) + (n), 3 * buf_cap(a) / 2)) : (void) 0)
+#define buf_try_grow1_(a)	(!(a) || buf_m_(a) == 0 ? buf_try_realloc_(a, 8) : \
+				 buf_n_(a) == buf_m_(a) ? buf_try_realloc_(a, 3 * buf_m_(a) / 2) : 0)
+#define buf_max_(a, b)		((a) < (b) ? (b) : (a))
 #define buf_realloc_(a, n)	buf_do_realloc_((void **) &(a), n, sizeof(*(a)))
+#define buf_try_realloc_(a, n)	buf_do_try_realloc_((void **) &(a), n, sizeof(*(a)))
 
 void buf_do_realloc_(void **a, size_t nr, size_t sz);
+int buf_do_try_realloc_(void **a, size_t nr, size_t sz);
+void buf_do_init_(void **a, const struct buf_allocator *alloc, size_t align);
+void buf_do_free_(void *a, size_t sz);
 
 #endif
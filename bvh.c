@@ -0,0 +1,587 @@
+#include <float.h>
+#include <string.h>
+#include "buf.h"
+#include "bvh.h"
+#include "mathx.h"
+#include "memstats.h"
+#include "mesh.h"
+#include "pool.h"
+#include "util.h"
+
+#define BVH_BINS		16
+#define BVH_LEAF		4	/* Triangles a leaf may take instead of splitting */
+#define BVH_MAX_DEPTH		48	/* Deeper nodes are leaves, whatever their size */
+#define BVH_STACK		(BVH_MAX_DEPTH + 2)
+#define BVH_TASK_MIN		4096	/* Min triangles per pool task */
+
+/* Interior nodes are followed by their left child */
+struct bvh_node {
+	float min[3], max[3];
+	int index;		/* Right child, or first triangle of a leaf */
+	int count;		/* Triangles of a leaf, 0 for interior nodes */
+};
+
+struct bvh {
+	const struct mesh *mesh;
+	struct bvh_node *nodes;
+	int *tris;		/* v0 v1 v2 face, in leaf order */
+};
+
+static void box_empty(float *min, float *max)
+{
+	vec_set(min, INFINITY, INFINITY, INFINITY);
+	vec_neg(max, min);
+}
+
+static void box_grow(float *min, float *max, const float *bmin, const float *bmax)
+{
+	vec_min(min, min, bmin);
+	vec_max(max, max, bmax);
+}
+
+static float box_area(const float *min, const float *max)
+{
+	vector d;
+
+	vec_sub(d, max, min);
+	if (d[0] < 0.0f)
+		return 0.0f;
+	return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+}
+
+/* Box of triangle tri, as min xyz, max xyz */
+static void tri_box(const float *vbuf, const int *tri, float *box)
+{
+	int i;
+
+	box_empty(box, box + 3);
+	for (i = 0; i < 3; i++)
+		box_grow(box, box + 3, vbuf + 3 * tri[i], vbuf + 3 * tri[i]);
+}
+
+/*
+ * Build state.  Nodes first go to tmp, where the subtree over triangles
+ * order[b..e) owns the 2 (e - b) - 1 slots from the one its root takes,
+ * so subtrees can be built on different threads into a tree that does
+ * not depend on their timing.  bvh_compact() then packs it depth first.
+ */
+struct bvh_tmp {
+	float min[3], max[3];
+	int left, right;
+	int first, count;
+};
+
+struct bvh_task;
+
+struct bvh_build {
+	int *tris;
+	float *boxes;		/* Per triangle */
+	float *cents;		/* Box centres */
+	int *order;
+	struct bvh_tmp *tmp;
+	struct bvh_task *tasks;
+	int task_size;		/* Subtrees up to this size go to the pool */
+	struct mem_stats *mem;	/* The caller's account and tag */
+	int tag;
+};
+
+struct bvh_task {
+	struct bvh_build *b;
+	int slot, begin, end, depth;
+};
+
+struct bvh_bin {
+	float min[3], max[3];
+	int count;
+};
+
+static void bvh_build_range(struct bvh_build *b, int slot, int begin, int end,
+			    int depth, int spawn);
+
+/* Splits by the binned surface area heuristic, or returns -1 for a leaf */
+static int bvh_split(struct bvh_build *b, struct bvh_tmp *n, int begin, int end)
+{
+	struct bvh_bin bins[3][BVH_BINS];
+	float cmin[3], cmax[3], scale[3], best = INFINITY;
+	int i, j, k, a, axis = -1, split = 0, count = end - begin;
+
+	box_empty(cmin, cmax);
+	for (i = begin; i < end; i++) {
+		const float *c = b->cents + 3 * b->order[i];
+
+		box_grow(cmin, cmax, c, c);
+	}
+
+	memset(bins, 0, sizeof(bins));
+	for (a = 0; a < 3; a++) {
+		scale[a] = cmax[a] > cmin[a] ? BVH_BINS / (cmax[a] - cmin[a]) : 0.0f;
+		for (k = 0; k < BVH_BINS; k++)
+			box_empty(bins[a][k].min, bins[a][k].max);
+	}
+	for (i = begin; i < end; i++) {
+		int t = b->order[i];
+		const float *c = b->cents + 3 * t, *box = b->boxes + 6 * t;
+
+		for (a = 0; a < 3; a++) {
+			struct bvh_bin *bin;
+
+			k = MIN(BVH_BINS - 1, (int) ((c[a] - cmin[a]) * scale[a]));
+			bin = &bins[a][k];
+			box_grow(bin->min, bin->max, box, box + 3);
+			bin->count++;
+		}
+	}
+
+	/* Cost of splitting after bin k, from the right then the left */
+	for (a = 0; a < 3; a++) {
+		float right[BVH_BINS], min[3], max[3];
+		int nr_right[BVH_BINS], nr = 0;
+
+		if (scale[a] == 0.0f)
+			continue;
+		box_empty(min, max);
+		for (k = BVH_BINS - 1; k > 0; k--) {
+			box_grow(min, max, bins[a][k].min, bins[a][k].max);
+			nr += bins[a][k].count;
+			right[k - 1] = box_area(min, max);
+			nr_right[k - 1] = nr;
+		}
+		box_empty(min, max);
+		nr = 0;
+		for (k = 0; k < BVH_BINS - 1; k++) {
+			float cost;
+
+			box_grow(min, max, bins[a][k].min, bins[a][k].max);
+			nr += bins[a][k].count;
+			if (!nr || !nr_right[k])
+				continue;
+			cost = box_area(min, max) * nr + right[k] * nr_right[k];
+			if (cost < best) {
+				best = cost;
+				axis = a;
+				split = k;
+			}
+		}
+	}
+
+	/* A traversal step costs as much as a triangle test */
+	if (axis < 0 || (count <= BVH_LEAF &&
+			 1.0f + best / box_area(n->min, n->max) >= count))
+		return -1;
+
+	for (i = begin, j = end - 1; i <= j; ) {
+		const float *c = b->cents + 3 * b->order[i];
+
+		k = MIN(BVH_BINS - 1, (int) ((c[axis] - cmin[axis]) * scale[axis]));
+		if (k <= split) {
+			i++;
+		} else {
+			SWAP(int, b->order[i], b->order[j]);
+			j--;
+		}
+	}
+	return i;
+}
+
+static void bvh_run_task(void *arg)
+{
+	struct bvh_task *t = arg;
+	struct mem_stats *mem = mem_stats_attach(t->b->mem);
+	int tag = mem_set_tag_(t->b->tag);
+
+	bvh_build_range(t->b, t->slot, t->begin, t->end, t->depth, 0);
+	mem_set_tag_(tag);
+	mem_stats_attach(mem);
+}
+
+static void bvh_build_range(struct bvh_build *b, int slot, int begin, int end,
+			    int depth, int spawn)
+{
+	struct bvh_tmp *n = &b->tmp[slot];
+	int i, mid;
+
+	if (spawn && end - begin <= b->task_size) {
+		struct bvh_task task = { b, slot, begin, end, depth };
+
+		buf_push(b->tasks, task);
+		return;
+	}
+
+	box_empty(n->min, n->max);
+	for (i = begin; i < end; i++) {
+		const float *box = b->boxes + 6 * b->order[i];
+
+		box_grow(n->min, n->max, box, box + 3);
+	}
+
+	mid = depth < BVH_MAX_DEPTH && end - begin > 1 ?
+	      bvh_split(b, n, begin, end) : -1;
+	if (mid < 0) {
+		n->first = begin;
+		n->count = end - begin;
+		return;
+	}
+	n->count = 0;
+	n->left = slot + 1;
+	n->right = slot + 2 * (mid - begin);
+	bvh_build_range(b, n->left, begin, mid, depth + 1, spawn);
+	bvh_build_range(b, n->right, mid, end, depth + 1, spawn);
+}
+
+/* Depth first, left child next to its parent, triangles in leaf order */
+static void bvh_compact(struct bvh *bvh, struct bvh_build *b, int nr_tris)
+{
+	struct { int slot, parent; } stack[BVH_STACK], top;
+	int sp = 0, i;
+
+	buf_resize(bvh->tris, 4 * nr_tris);
+	for (i = 0; i < nr_tris; i++)
+		memcpy(bvh->tris + 4 * i, b->tris + 4 * b->order[i],
+		       4 * sizeof(*bvh->tris));
+
+	stack[sp].slot = 0;
+	stack[sp++].parent = -1;
+	while (sp) {
+		struct bvh_tmp *t;
+		struct bvh_node *n;
+
+		top = stack[--sp];
+		t = &b->tmp[top.slot];
+		if (top.parent >= 0)
+			bvh->nodes[top.parent].index = buf_len(bvh->nodes);
+		n = buf_push_n(bvh->nodes, 1);
+		vec_copy(n->min, t->min);
+		vec_copy(n->max, t->max);
+		n->count = t->count;
+		n->index = t->first;
+		if (t->count)
+			continue;
+		stack[sp].slot = t->right;
+		stack[sp++].parent = n - bvh->nodes;
+		stack[sp].slot = t->left;
+		stack[sp++].parent = -1;
+	}
+}
+
+struct bvh *bvh_build(const struct mesh *mesh, struct pool *pool)
+{
+	struct bvh_build b;
+	struct bvh *bvh;
+	const float *vbuf;
+	int i, j, nr_tris = 0, *tri;
+	mem_enter(MEM_BVH);
+
+	mesh_vertex_buffer(mesh, &vbuf);
+	bvh = mem_alloc(sizeof(*bvh));
+	bvh->mesh = mesh;
+	bvh->nodes = NULL;
+	bvh->tris = NULL;
+
+	memset(&b, 0, sizeof(b));
+	b.mem = mem_account_();
+	b.tag = mem_tag_();
+	for (i = 0; i < mesh_face_count(mesh); i++) {
+		int n = mesh_face_vertex_count(mesh, i), v0, ni;
+
+		mesh_face_vertex_index(mesh, i, 0, &v0, &ni);
+		for (j = 1; j + 1 < n; j++) {
+			tri = buf_push_n(b.tris, 4);
+			tri[0] = v0;
+			mesh_face_vertex_index(mesh, i, j, &tri[1], &ni);
+			mesh_face_vertex_index(mesh, i, j + 1, &tri[2], &ni);
+			tri[3] = i;
+		}
+	}
+	nr_tris = buf_len(b.tris) / 4;
+
+	buf_resize(b.boxes, 6 * nr_tris);
+	buf_resize(b.cents, 3 * nr_tris);
+	buf_resize(b.order, nr_tris);
+	for (i = 0; i < nr_tris; i++) {
+		float *box = b.boxes + 6 * i;
+
+		tri_box(vbuf, b.tris + 4 * i, box);
+		vec_add(b.cents + 3 * i, box, box + 3);
+		vec_mul(b.cents + 3 * i, 0.5f, b.cents + 3 * i);
+		b.order[i] = i;
+	}
+
+	buf_resize(b.tmp, 2 * nr_tris - 1);
+	b.task_size = pool ? MAX(BVH_TASK_MIN, nr_tris / (4 * pool_size(pool))) : 0;
+	if (nr_tris) {
+		struct bvh_task *t;
+
+		bvh_build_range(&b, 0, 0, nr_tris, 0, pool && pool_size(pool) > 1);
+		buf_foreach(t, b.tasks)
+			pool_add(pool, bvh_run_task, t);
+		if (b.tasks)
+			pool_wait(pool);
+		bvh_compact(bvh, &b, nr_tris);
+	}
+
+	buf_free(b.tris);
+	buf_free(b.boxes);
+	buf_free(b.cents);
+	buf_free(b.order);
+	buf_free(b.tmp);
+	buf_free(b.tasks);
+	mem_leave();
+	return bvh;
+}
+
+void bvh_free(struct bvh *bvh)
+{
+	if (!bvh)
+		return;
+	buf_free(bvh->nodes);
+	buf_free(bvh->tris);
+	mem_free(bvh);
+}
+
+size_t bvh_size(const struct bvh *bvh)
+{
+	return sizeof(*bvh) + buf_cap(bvh->nodes) * sizeof(*bvh->nodes) +
+	       buf_cap(bvh->tris) * sizeof(*bvh->tris);
+}
+
+/* Children come after their parents, so one backwards pass does */
+void bvh_refit(struct bvh *bvh)
+{
+	const float *vbuf;
+	int i, j;
+
+	mesh_vertex_buffer(bvh->mesh, &vbuf);
+	for (i = buf_len(bvh->nodes) - 1; i >= 0; i--) {
+		struct bvh_node *n = &bvh->nodes[i];
+
+		if (n->count) {
+			box_empty(n->min, n->max);
+			for (j = n->index; j < n->index + n->count; j++) {
+				float box[6];
+
+				tri_box(vbuf, bvh->tris + 4 * j, box);
+				box_grow(n->min, n->max, box, box + 3);
+			}
+		} else {
+			struct bvh_node *l = n + 1, *r = &bvh->nodes[n->index];
+
+			vec_min(n->min, l->min, r->min);
+			vec_max(n->max, l->max, r->max);
+		}
+	}
+}
+
+/* Entry distance into the box, INFINITY when the ray misses it */
+static float ray_box(const struct bvh_node *n, const float *org,
+		     const float *inv, float t_max)
+{
+	float t0 = 0.0f, t1 = t_max;
+	int a;
+
+	for (a = 0; a < 3; a++) {
+		float near = (n->min[a] - org[a]) * inv[a];
+		float far = (n->max[a] - org[a]) * inv[a];
+
+		/* fminf() and fmaxf() drop the NaN of 0 * inf */
+		t0 = fmaxf(t0, fminf(near, far));
+		t1 = fminf(t1, fmaxf(near, far));
+	}
+	return t0 <= t1 ? t0 : INFINITY;
+}
+
+/* Moller-Trumbore, both sides */
+static float ray_tri(const float *vbuf, const int *tri, const float *org,
+		     const float *dir)
+{
+	const float *v0 = vbuf + 3 * tri[0];
+	vector e1, e2, pv, tv, qv;
+	float det, u, v;
+
+	vec_sub(e1, vbuf + 3 * tri[1], v0);
+	vec_sub(e2, vbuf + 3 * tri[2], v0);
+	vec_cross(pv, dir, e2);
+	det = vec_dot(e1, pv);
+	if (det == 0.0f)
+		return INFINITY;
+	det = 1.0f / det;
+
+	vec_sub(tv, org, v0);
+	u = vec_dot(tv, pv) * det;
+	if (u < 0.0f || u > 1.0f)
+		return INFINITY;
+	vec_cross(qv, tv, e1);
+	v = vec_dot(dir, qv) * det;
+	if (v < 0.0f || u + v > 1.0f)
+		return INFINITY;
+	return vec_dot(e2, qv) * det;
+}
+
+int bvh_ray(const struct bvh *bvh, const float *org, const float *dir,
+	    float t_max, struct bvh_hit *hit)
+{
+	int stack[BVH_STACK], sp = 0, i;
+	const float *vbuf;
+	vector inv;
+
+	mesh_vertex_buffer(bvh->mesh, &vbuf);
+	vec_set(inv, 1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]);
+	hit->face = -1;
+	hit->t = t_max;
+
+	if (bvh->nodes)
+		stack[sp++] = 0;
+	while (sp) {
+		const struct bvh_node *n = &bvh->nodes[stack[--sp]];
+
+		if (ray_box(n, org, inv, hit->t) == INFINITY)
+			continue;
+		if (n->count) {
+			for (i = n->index; i < n->index + n->count; i++) {
+				const int *tri = bvh->tris + 4 * i;
+				float t = ray_tri(vbuf, tri, org, dir);
+
+				if (t >= 0.0f && t <= hit->t) {
+					hit->t = t;
+					hit->face = tri[3];
+				}
+			}
+		} else {
+			int l = n - bvh->nodes + 1, r = n->index;
+
+			/* Nearer child on top */
+			if (ray_box(&bvh->nodes[l], org, inv, hit->t) >
+			    ray_box(&bvh->nodes[r], org, inv, hit->t))
+				SWAP(int, l, r);
+			stack[sp++] = r;
+			stack[sp++] = l;
+		}
+	}
+	if (hit->face >= 0) {
+		vec_copy(hit->p, org);
+		vec_mad(hit->p, hit->t, dir);
+	}
+	return hit->face;
+}
+
+static float box_dist2(const struct bvh_node *n, const float *p)
+{
+	float d2 = 0.0f;
+	int a;
+
+	for (a = 0; a < 3; a++) {
+		float d = fmaxf(fmaxf(n->min[a] - p[a], p[a] - n->max[a]), 0.0f);
+
+		d2 += d * d;
+	}
+	return d2;
+}
+
+/* Closest point on triangle abc to p, after Ericson's Real-Time Collision Detection */
+static void closest_on_tri(float *r, const float *p, const float *a,
+			   const float *b, const float *c)
+{
+	vector ab, ac, ap, bp, cp;
+	float d1, d2, d3, d4, d5, d6, va, vb, vc, v, w;
+
+	vec_sub(ab, b, a);
+	vec_sub(ac, c, a);
+	vec_sub(ap, p, a);
+	d1 = vec_dot(ab, ap);
+	d2 = vec_dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		vec_copy(r, a);
+		return;
+	}
+
+	vec_sub(bp, p, b);
+	d3 = vec_dot(ab, bp);
+	d4 = vec_dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3) {
+		vec_copy(r, b);
+		return;
+	}
+
+	vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		vec_copy(r, a);
+		vec_mad(r, d1 / (d1 - d3), ab);
+		return;
+	}
+
+	vec_sub(cp, p, c);
+	d5 = vec_dot(ab, cp);
+	d6 = vec_dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6) {
+		vec_copy(r, c);
+		return;
+	}
+
+	vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		vec_copy(r, a);
+		vec_mad(r, d2 / (d2 - d6), ac);
+		return;
+	}
+
+	va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+		vector bc;
+
+		vec_sub(bc, c, b);
+		vec_copy(r, b);
+		vec_mad(r, (d4 - d3) / ((d4 - d3) + (d5 - d6)), bc);
+		return;
+	}
+
+	v = vb / (va + vb + vc);
+	w = vc / (va + vb + vc);
+	vec_copy(r, a);
+	vec_mad(r, v, ab);
+	vec_mad(r, w, ac);
+}
+
+int bvh_nearest(const struct bvh *bvh, const float *p, float max_dist,
+		struct bvh_hit *hit)
+{
+	int stack[BVH_STACK], sp = 0, i;
+	const float *vbuf;
+	float best = max_dist * max_dist;
+
+	mesh_vertex_buffer(bvh->mesh, &vbuf);
+	hit->face = -1;
+
+	if (bvh->nodes)
+		stack[sp++] = 0;
+	while (sp) {
+		const struct bvh_node *n = &bvh->nodes[stack[--sp]];
+
+		if (box_dist2(n, p) > best)
+			continue;
+		if (n->count) {
+			for (i = n->index; i < n->index + n->count; i++) {
+				const int *tri = bvh->tris + 4 * i;
+				vector q, d;
+				float d2;
+
+				closest_on_tri(q, p, vbuf + 3 * tri[0],
+					       vbuf + 3 * tri[1], vbuf + 3 * tri[2]);
+				vec_sub(d, q, p);
+				d2 = vec_dot(d, d);
+				if (d2 <= best) {
+					best = d2;
+					hit->face = tri[3];
+					vec_copy(hit->p, q);
+				}
+			}
+		} else {
+			int l = n - bvh->nodes + 1, r = n->index;
+
+			if (box_dist2(&bvh->nodes[l], p) > box_dist2(&bvh->nodes[r], p))
+				SWAP(int, l, r);
+			stack[sp++] = r;
+			stack[sp++] = l;
+		}
+	}
+	hit->t = sqrtf(best);
+	return hit->face;
+}
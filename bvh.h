@@ -0,0 +1,43 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stddef.h>
+
+/*
+ * Bounding volume hierarchy over the faces of a mesh, fan triangulated,
+ * for ray picking and closest point queries.  It is built top down with
+ * binned surface area heuristic splits; with a pool the subtrees below
+ * the first few splits are built in parallel, into the same tree a build
+ * without one gives.  bvh_build() waits on the pool, so it must not run
+ * as one of the pool's own tasks.
+ *
+ * The tree reads the mesh's positions at query time and keeps a pointer
+ * to it, so the mesh must outlive it and keep its faces.  After vertices
+ * move, bvh_refit() recomputes the boxes in one pass without rebuilding;
+ * queries stay exact, only their speed suffers once the motion is large.
+ */
+struct mesh;
+struct pool;
+
+struct bvh_hit {
+	int face;		/* -1 when nothing was found */
+	float t;		/* Ray parameter, or distance for bvh_nearest() */
+	float p[3];		/* Hit or closest point */
+};
+
+struct bvh *bvh_build(const struct mesh *mesh, struct pool *pool);
+void bvh_free(struct bvh *bvh);
+void bvh_refit(struct bvh *bvh);
+size_t bvh_size(const struct bvh *bvh);
+
+/*
+ * bvh_ray() finds the first face along org + t * dir, 0 <= t <= t_max, on
+ * either side.  bvh_nearest() finds the closest point on the mesh within
+ * max_dist of p.  Both return the face, -1 when there is none.
+ */
+int bvh_ray(const struct bvh *bvh, const float *org, const float *dir,
+	    float t_max, struct bvh_hit *hit);
+int bvh_nearest(const struct bvh *bvh, const float *p, float max_dist,
+		struct bvh_hit *hit);
+
+#endif
@@ -0,0 +1,215 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "buf.h"
+#include "cache.h"
+#include "memstats.h"
+#include "mesh.h"
+#include "subd.h"
+#include "sys.h"
+
+#define SD_CACHE_MAGIC		0x434d4453	/* "SDMC" */
+#define SD_CACHE_VERSION	2
+#define SD_CACHE_HDR		64	/* Keeps the image's arrays aligned */
+#define SD_CACHE_EXT		".sdmesh"
+
+struct sd_cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint64_t input_size;	/* mesh_pack_size() of the input, past the key */
+};
+
+/*
+ * Bytes in each directory this process stores to: scanned once, then kept
+ * up to date by its own stores.  Other processes' entries only show at
+ * the next scan, which comes when the total passes the cap and trims the
+ * directory down to SD_CACHE_LOW_WATER of it, so stores scan rarely.
+ */
+#define SD_CACHE_LOW_WATER(cap)	((cap) / 8 * 7)
+
+struct sd_cache_dir {
+	char *path;
+	size_t total;
+};
+
+static pthread_mutex_t sd_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sd_cache_dir *sd_cache_dirs;
+
+struct sd_cache_entry {
+	char name[32];
+	time_t mtime;
+	off_t size;
+};
+
+uint64_t sd_cache_key(uint64_t mesh_hash, int level,
+		      const struct sd_options *opt, int renumbered)
+{
+	uint64_t k[4] = { mesh_hash, level, SD_CACHE_VERSION, 0 };
+	uint64_t h = 0xcbf29ce484222325ull;
+	int i;
+
+	if (opt->local_order)
+		k[3] = renumbered ? 2 : 1;
+	for (i = 0; i < 4; i++)
+		h = (h ^ k[i]) * 0x100000001b3ull;
+	return h ^ (h >> 32);
+}
+
+static int sd_cache_file(char *file, size_t len, const char *dir, uint64_t key)
+{
+	return snprintf(file, len, "%s/%016llx" SD_CACHE_EXT, dir,
+			(unsigned long long) key) < len ? 0 : -1;
+}
+
+struct mesh *sd_cache_load(const struct sd_options *opt, uint64_t key,
+			   const struct mesh *input)
+{
+	const struct sd_cache_hdr *hdr;
+	struct mesh_view view;
+	struct mesh *mesh = NULL;
+	char file[4096];
+	size_t size;
+	void *addr;
+
+	if (sd_cache_file(file, sizeof(file), opt->cache_dir, key) ||
+	    !(addr = sys_map_file(file, &size)))
+		return NULL;
+	hdr = addr;
+	if (size >= SD_CACHE_HDR && hdr->magic == SD_CACHE_MAGIC &&
+	    hdr->version == SD_CACHE_VERSION && hdr->key == key &&
+	    hdr->input_size == mesh_pack_size(input) &&
+	    !mesh_view((char *) addr + SD_CACHE_HDR, size - SD_CACHE_HDR, &view))
+		mesh = mesh_unpack(&view);
+	sys_unmap_file(addr, size);
+	if (mesh)
+		sys_touch_file(file);
+	return mesh;
+}
+
+static int sd_cache_cmp(const void *a, const void *b)
+{
+	const struct sd_cache_entry *x = a, *y = b;
+	return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+/* Only names sd_cache_file() gives, not other files or temporary ones */
+static int sd_cache_name(const char *name)
+{
+	size_t n = strlen(name);
+
+	return n == 16 + strlen(SD_CACHE_EXT) &&
+	       strspn(name, "0123456789abcdef") == 16 &&
+	       !strcmp(name + 16, SD_CACHE_EXT);
+}
+
+/*
+ * Evicts the least recently used entries, never keep, until the directory
+ * is under target, and returns the bytes left in it.
+ */
+static size_t sd_cache_trim(const char *dir, size_t target, const char *keep)
+{
+	struct sd_cache_entry *entries = NULL, e;
+	char file[4096];
+	struct dirent *de;
+	struct stat st;
+	size_t total = 0;
+	DIR *d;
+	int i;
+
+	if (!(d = opendir(dir)))
+		return 0;
+	while ((de = readdir(d))) {
+		if (!sd_cache_name(de->d_name) ||
+		    snprintf(file, sizeof(file), "%s/%s", dir, de->d_name) >=
+		    sizeof(file) || stat(file, &st))
+			continue;
+		total += st.st_size;
+		if (keep && !strcmp(de->d_name, keep))
+			continue;
+		strcpy(e.name, de->d_name);
+		e.mtime = st.st_mtime;
+		e.size = st.st_size;
+		buf_push(entries, e);
+	}
+	closedir(d);
+
+	if (total > target)
+		qsort(entries, buf_len(entries), sizeof(*entries), sd_cache_cmp);
+	for (i = 0; i < buf_len(entries) && total > target; i++) {
+		snprintf(file, sizeof(file), "%s/%s", dir, entries[i].name);
+		if (!unlink(file))
+			total -= entries[i].size;
+	}
+	buf_free(entries);
+	return total;
+}
+
+/*
+ * Accounts keep, stored in dir with size bytes in place of an entry of
+ * old bytes (0 when new), trimming past the cap.
+ */
+static void sd_cache_account(const char *dir, size_t cap, size_t size,
+			     size_t old, const char *keep)
+{
+	struct sd_cache_dir *d, nd;
+
+	pthread_mutex_lock(&sd_cache_lock);
+	buf_foreach(d, sd_cache_dirs)
+		if (!strcmp(d->path, dir))
+			break;
+	if (d == sd_cache_dirs + buf_len(sd_cache_dirs)) {
+		/* The scan already counts the entry just written */
+		nd.path = strdup(dir);
+		nd.total = sd_cache_trim(dir, (size_t) -1, NULL);
+		size = old = 0;
+		buf_push(sd_cache_dirs, nd);
+		d = &buf_last(sd_cache_dirs);
+	}
+	d->total = d->total + size > old ? d->total + size - old : 0;
+	if (d->total > cap)
+		d->total = sd_cache_trim(dir, SD_CACHE_LOW_WATER(cap), keep);
+	pthread_mutex_unlock(&sd_cache_lock);
+}
+
+int sd_cache_store(const struct sd_options *opt, uint64_t key,
+		   const struct mesh *input, const struct mesh *mesh)
+{
+	struct sd_cache_hdr *hdr;
+	char file[4096];
+	size_t size, old;
+	struct stat st;
+	char *data;
+	int err;
+	mem_enter(MEM_SD);
+
+	if (sd_cache_file(file, sizeof(file), opt->cache_dir, key)) {
+		mem_leave();
+		return -1;
+	}
+	size = SD_CACHE_HDR + mesh_pack_size(mesh);
+	if (!(data = mem_alloc(size))) {
+		mem_leave();
+		return -1;
+	}
+	memset(data, 0, SD_CACHE_HDR);
+	hdr = (struct sd_cache_hdr *) data;
+	hdr->magic = SD_CACHE_MAGIC;
+	hdr->version = SD_CACHE_VERSION;
+	hdr->key = key;
+	hdr->input_size = mesh_pack_size(input);
+	/* An entry already there is replaced, not added to */
+	old = stat(file, &st) ? 0 : st.st_size;
+	err = mesh_pack(mesh, data + SD_CACHE_HDR) ||
+	      sys_write_file(file, data, size) ? -1 : 0;
+	mem_free(data);
+	if (!err && opt->cache_size)
+		sd_cache_account(opt->cache_dir, opt->cache_size, size, old,
+				 strrchr(file, '/') + 1);
+	mem_leave();
+	return err;
+}
@@ -0,0 +1,35 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+/*
+ * On-disk cache of refined meshes behind sd_options.cache_dir (see
+ * subd.h).  An entry is dir/<key>.sdmesh, a short header repeating the
+ * key and the packed size of the input, so a key collision between
+ * inputs of different sizes still misses, followed by a mesh image (see
+ * mesh_pack()).  Entries are written
+ * with sys_write_file(), so a reader never sees half of one, and every
+ * hit bumps the file's modification time, which is what the size cap
+ * evicts by.  Stores keep a running total of the directory's size and
+ * only rescan it when that passes the cap.  Content addressing means an entry never goes stale; a
+ * change to the refinement that moves any result must bump
+ * SD_CACHE_VERSION instead.
+ *
+ * sd_cache_key() mixes mesh_hash() of the input with the level and the
+ * options.  renumbered tells a local_order level that is not the last
+ * one, whose vertices are renumbered for the next iteration, from the
+ * same level coming out last.  sd_cache_load() returns NULL on a miss
+ * or a bad entry and sd_cache_store() -1 when it cannot save one.
+ */
+struct mesh;
+struct sd_options;
+
+uint64_t sd_cache_key(uint64_t mesh_hash, int level,
+		      const struct sd_options *opt, int renumbered);
+struct mesh *sd_cache_load(const struct sd_options *opt, uint64_t key,
+			   const struct mesh *input);
+int sd_cache_store(const struct sd_options *opt, uint64_t key,
+		   const struct mesh *input, const struct mesh *mesh);
+
+#endif
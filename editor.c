@@ -1,21 +1,79 @@
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include "gl.h"
 #include "buf.h"
+#include "bvh.h"
+#include "mathx.h"
 #include "mesh.h"
 #include "meshrend.h"
 #include "subd.h"
 #include "obj.h"
+#include "pool.h"
 #include "gl_util.h"
+#include "util.h"
+#include "sys.h"
 #include "editor.h"
 
+#define MAX_LEVELS		16
+#define CACHE_BUDGET		(256 << 20)
+#define PICK_VERTEX		0.35f	/* Of the way from a corner to its face's centre */
+
+struct ed_level {
+	struct mesh_vbo *vbo;	/* NULL when not resident */
+	size_t bytes;
+	unsigned last_used;
+	int pending;		/* A job for the current gen has been queued */
+	int failed;		/* Ran out of memory building the current gen */
+	int vs, fs;		/* Kept after eviction, 0 until first built */
+	double build_time;	/* Seconds spent subdividing */
+	struct mesh *mesh;	/* Picking copy and its tree, with the vbo */
+	struct bvh *bvh;
+};
+
 struct ed_obj {
 	struct mesh *mesh;
 	int cur_level;
 	int nr_levels;
-	GLuint lists;
+	struct ed_level levels[MAX_LEVELS];
 	char file[256];
-	struct { int vs, fs; } *stats;
+	int gen;		/* Bumped whenever the levels are recomputed */
+	float *patch_bounds;	/* Culling box of each base face's patch */
+	struct bvh *bvh;	/* Over the base mesh */
+	int *pick_first;	/* subdivide_patch_faces() of pick_level */
+	int pick_level;
+};
+
+/* Subdivision job, runs on a pool thread */
+struct ed_job {
+	struct editor *ed;
+	const struct mesh *mesh;
+	int obj;
+	int gen;
+	int level;
+};
+
+/* A finished level waiting for upload on the GL thread */
+struct ed_result {
+	int obj;
+	int gen;
+	int level;
+	struct sd_layout layout;
+	struct sd_counts counts;
+	void *verts;
+	void *tris;
+	void *lines;
+	struct mesh *mesh;
+	struct bvh *bvh;
+	double build_time;
+};
+
+/* Position and normal, 16-bit indices where the level has few vertices */
+static const struct sd_layout ed_layout = {
+	6 * sizeof(float),
+	0,
+	3 * sizeof(float),
+	4,
 };
 
 struct editor {
@@ -23,9 +81,25 @@ struct editor {
 	int cur_obj;
 	int wireframe;
 	int editing;
+
+	struct pool *pool;
+	pthread_mutex_t lock;
+	pthread_cond_t loaded;	/* Signalled by ed_add_objs() parse jobs */
+	struct ed_result *results;
+
+	/* Refined levels of all objects share one LRU cache */
+	size_t cache_bytes;
+	size_t cache_budget;
+	unsigned tick;
+
+	int nr_drawn;		/* Patches that passed culling last frame */
+
+	/* Base vertex or face under the cursor and the selected one, or -1 */
+	int hover_vert, hover_face;
+	int sel_vert, sel_face;
 };
 
-#define MAX_LEVELS		16
+#define cur_obj(ed)		((ed)->objs[(ed)->cur_obj])
 
 struct editor *ed_create()
 {
@@ -35,39 +109,410 @@ struct editor *ed_create()
 	ed->cur_obj = 0;
 	ed->wireframe = 0;
 	ed->editing = 0;
+	ed->pool = pool_create(0);
+	pthread_mutex_init(&ed->lock, NULL);
+	pthread_cond_init(&ed->loaded, NULL);
+	ed->results = NULL;
+	ed->cache_bytes = 0;
+	ed->cache_budget = CACHE_BUDGET;
+	ed->tick = 0;
+	ed->nr_drawn = 0;
+	ed->hover_vert = ed->hover_face = -1;
+	ed->sel_vert = ed->sel_face = -1;
 	return ed;
 }
 
-void ed_add_obj(struct editor *ed, const char *file, int nr_levels)
+void ed_set_cache_budget(struct editor *ed, size_t bytes)
+{
+	ed->cache_budget = bytes;
+}
+
+/*
+ * Splits a level into one culling patch per base face.  Refined levels
+ * are all quads, two triangles and four edges per face.
+ */
+static void ed_set_patches(struct ed_obj *ed_obj, int level,
+			   struct mesh_vbo *vbo)
+{
+	int i, nr_patches = mesh_face_count(ed_obj->mesh);
+	int *first_tri = NULL, *first_edge = NULL;
+
+	buf_resize(first_tri, nr_patches + 1);
+	buf_resize(first_edge, nr_patches + 1);
+	if (level) {
+		subdivide_patch_faces(ed_obj->mesh, level, first_tri);
+		for (i = 0; i <= nr_patches; i++) {
+			first_edge[i] = 4 * first_tri[i];
+			first_tri[i] *= 2;
+		}
+	} else {
+		first_tri[0] = first_edge[0] = 0;
+		for (i = 0; i < nr_patches; i++) {
+			int n = mesh_face_vertex_count(ed_obj->mesh, i);
+
+			first_tri[i + 1] = first_tri[i] + n - 2;
+			first_edge[i + 1] = first_edge[i] + n;
+		}
+	}
+	mesh_vbo_set_patches(vbo, first_tri, first_edge, ed_obj->patch_bounds,
+			     nr_patches);
+	buf_free(first_tri);
+	buf_free(first_edge);
+}
+
+static struct mesh_vbo *ed_upload_base(struct ed_obj *ed_obj)
+{
+	struct mesh_vbo *vbo = mesh_vbo_create(ed_obj->mesh);
+
+	ed_set_patches(ed_obj, 0, vbo);
+	return vbo;
+}
+
+static struct mesh_vbo *ed_upload(struct ed_obj *ed_obj,
+				  const struct ed_result *res)
+{
+	struct mesh_vbo *vbo;
+
+	vbo = mesh_vbo_create_interleaved(&res->layout, res->verts,
+					  res->counts.verts, res->tris,
+					  res->counts.tris, res->lines,
+					  res->counts.lines);
+	ed_set_patches(ed_obj, res->level, vbo);
+	return vbo;
+}
+
+/*
+ * Subdivides and exports straight into the GL vertex layout, and keeps a
+ * mesh of the level with its picking tree.  Returns -1, with nothing left
+ * allocated in res, when memory runs out.
+ */
+static int ed_build(struct ed_result *res, const struct mesh *mesh)
+{
+	struct sd_mesh *sd;
+	int i, err = 0;
+
+	if (!(sd = sd_init(mesh)))
+		return -1;
+	for (i = 0; i < res->level && !err; i++)
+		err = sd_do_iteration(sd, i == 0, i + 1 == res->level);
+	if (!err) {
+		sd_export_counts(sd, &res->counts);
+		res->layout = ed_layout;
+		if (res->counts.verts <= 0x10000)
+			res->layout.index_size = 2;
+		res->verts = malloc((size_t) res->counts.verts * res->layout.stride);
+		res->tris = malloc((size_t) 3 * res->counts.tris *
+				   res->layout.index_size);
+		res->lines = malloc((size_t) 2 * res->counts.lines *
+				    res->layout.index_size);
+		if (!res->verts || !res->tris || !res->lines ||
+		    sd_export(sd, &res->layout, res->verts, res->tris, res->lines) ||
+		    !(res->mesh = sd_convert(sd)))
+			err = -1;
+	}
+	sd_free(sd);
+	if (err) {
+		free(res->verts);
+		free(res->tris);
+		free(res->lines);
+		res->verts = res->tris = res->lines = NULL;
+		return -1;
+	}
+	res->bvh = bvh_build(res->mesh, NULL);
+	return 0;
+}
+
+/* A failed job still reports back, with a NULL mesh, to drop the level */
+static void ed_run_job(void *arg)
+{
+	struct ed_job *job = arg;
+	struct editor *ed = job->ed;
+	struct ed_result res;
+
+	memset(&res, 0, sizeof(res));
+	res.obj = job->obj;
+	res.gen = job->gen;
+	res.level = job->level;
+	res.build_time = sys_time();
+	ed_build(&res, job->mesh);
+	res.build_time = sys_time() - res.build_time;
+
+	pthread_mutex_lock(&ed->lock);
+	buf_push(ed->results, res);
+	pthread_mutex_unlock(&ed->lock);
+	free(job);
+}
+
+/* Queues a job for level unless it is resident or already on its way */
+static void ed_request(struct editor *ed, int obj, int level)
+{
+	struct ed_obj *ed_obj = &ed->objs[obj];
+	struct ed_level *l = &ed_obj->levels[level];
+	struct ed_job *job;
+
+	if (level == 0 || l->vbo || l->pending || l->failed)
+		return;
+
+	job = malloc(sizeof(*job));
+	job->ed = ed;
+	job->mesh = ed_obj->mesh;
+	job->obj = obj;
+	job->gen = ed_obj->gen;
+	job->level = level;
+	l->pending = 1;
+	pool_add(ed->pool, ed_run_job, job);
+}
+
+/* Current object first, then prefetch what its neighbours would show */
+static void ed_request_around(struct editor *ed)
+{
+	int i, n = buf_len(ed->objs);
+
+	if (!n)
+		return;
+	ed_request(ed, ed->cur_obj, cur_obj(ed).cur_level);
+	i = (ed->cur_obj + 1) % n;
+	ed_request(ed, i, ed->objs[i].cur_level);
+	i = (ed->cur_obj - 1 + n) % n;
+	ed_request(ed, i, ed->objs[i].cur_level);
+}
+
+static void ed_evict_level(struct editor *ed, struct ed_level *l)
+{
+	mesh_vbo_free(l->vbo);
+	l->vbo = NULL;
+	bvh_free(l->bvh);
+	l->bvh = NULL;
+	if (l->mesh)
+		mesh_free(l->mesh);
+	l->mesh = NULL;
+	ed->cache_bytes -= l->bytes;
+	l->bytes = 0;
+}
+
+/* Everything a resident level holds, as the cache budget counts it */
+static size_t ed_level_size(const struct ed_level *l)
+{
+	return mesh_vbo_size(l->vbo) + (l->mesh ? mesh_size(l->mesh) : 0) +
+	       (l->bvh ? bvh_size(l->bvh) : 0);
+}
+
+/* The base level keeps the cage and its tree in the object instead */
+static size_t ed_base_size(const struct ed_obj *ed_obj)
+{
+	return mesh_vbo_size(ed_obj->levels[0].vbo) + mesh_size(ed_obj->mesh) +
+	       (ed_obj->bvh ? bvh_size(ed_obj->bvh) : 0);
+}
+
+/* Deepest level up to cur_level that has been uploaded already */
+static int ed_shown_level(struct ed_obj *ed_obj)
+{
+	int level = ed_obj->cur_level;
+
+	while (level > 0 && !ed_obj->levels[level].vbo)
+		level--;
+	return level;
+}
+
+/*
+ * Evicts least recently viewed levels, deepest first among equally old
+ * ones, until the cache fits its budget.  Base cages and the level on
+ * screen are never evicted.
+ */
+static void ed_trim_cache(struct editor *ed)
+{
+	while (ed->cache_bytes > ed->cache_budget) {
+		struct ed_obj *ed_obj;
+		struct ed_level *victim = NULL;
+		int victim_level = 0;
+		int shown = ed_shown_level(&cur_obj(ed));
+
+		buf_foreach(ed_obj, ed->objs) {
+			int i;
+
+			for (i = 1; i < ed_obj->nr_levels; i++) {
+				struct ed_level *l = &ed_obj->levels[i];
+
+				if (!l->vbo)
+					continue;
+				if (ed_obj == &cur_obj(ed) && i == shown)
+					continue;
+				if (!victim || l->last_used < victim->last_used ||
+				    (l->last_used == victim->last_used &&
+				     i > victim_level)) {
+					victim = l;
+					victim_level = i;
+				}
+			}
+		}
+		if (!victim)
+			break;
+		ed_evict_level(ed, victim);
+	}
+}
+
+static void ed_recompute(struct editor *ed, struct ed_obj *ed_obj)
+{
+	int i, shown = ed_shown_level(ed_obj);
+
+	ed_obj->gen++;
+	for (i = 1; i < ed_obj->nr_levels; i++) {
+		ed_obj->levels[i].pending = 0;
+		ed_obj->levels[i].failed = 0;
+		/* The level on screen stays there until its replacement arrives */
+		if (i != shown && ed_obj->levels[i].vbo)
+			ed_evict_level(ed, &ed_obj->levels[i]);
+	}
+	ed_request_around(ed);
+}
+
+/* GL thread half of adding an object, takes over mesh, patch_bounds and bvh */
+static void ed_attach_obj(struct editor *ed, const char *file, int nr_levels,
+			  struct mesh *mesh, float *patch_bounds, struct bvh *bvh)
 {
-	int i;
 	struct ed_obj ed_obj;
-	struct mesh *levels[MAX_LEVELS];
 
-	ed_obj.mesh = obj_read(file);
+	ed_obj.mesh = mesh;
 	ed_obj.cur_level = 0;
-	ed_obj.nr_levels = nr_levels;
-	ed_obj.lists = glGenLists(nr_levels);
+	ed_obj.nr_levels = MIN(nr_levels, MAX_LEVELS);
+	memset(ed_obj.levels, 0, sizeof(ed_obj.levels));
 	strncpy(ed_obj.file, file, sizeof(ed_obj.file));
 	ed_obj.file[sizeof(ed_obj.file) - 1] = '\0';
-	ed_obj.stats = NULL;
-	buf_resize(ed_obj.stats, nr_levels);
+	ed_obj.gen = 0;
+	ed_obj.patch_bounds = patch_bounds;
+	ed_obj.bvh = bvh;
+	ed_obj.pick_first = NULL;
+	ed_obj.pick_level = 0;
 
-	ed_obj.stats[0].vs = mesh_vertex_buffer(ed_obj.mesh, NULL);
-	ed_obj.stats[0].fs = mesh_face_count(ed_obj.mesh);
-	mesh_compile_list(ed_obj.mesh, ed_obj.lists);
-	subdivide_levels(ed_obj.mesh, levels, nr_levels - 1);
-	for (i = 0; i < nr_levels - 1; i++) {
-		ed_obj.stats[i+1].vs = mesh_vertex_buffer(levels[i], NULL);
-		ed_obj.stats[i+1].fs = mesh_face_count(levels[i]);
-		mesh_compile_list(levels[i], ed_obj.lists + i + 1);
-		mesh_free(levels[i]);
-	}
+	ed_obj.levels[0].vs = mesh_vertex_buffer(ed_obj.mesh, NULL);
+	ed_obj.levels[0].fs = mesh_face_count(ed_obj.mesh);
+	ed_obj.levels[0].vbo = ed_upload_base(&ed_obj);
+	ed_obj.levels[0].bytes = ed_base_size(&ed_obj);
+	ed->cache_bytes += ed_obj.levels[0].bytes;
 
 	buf_push(ed->objs, ed_obj);
 }
 
-#define cur_obj(ed)		((ed)->objs[(ed)->cur_obj])
+static float *ed_patch_bounds(const struct mesh *mesh)
+{
+	float *bounds = NULL;
+
+	buf_resize(bounds, 6 * mesh_face_count(mesh));
+	subdivide_patch_bounds(mesh, bounds);
+	return bounds;
+}
+
+int ed_add_obj(struct editor *ed, const char *file, int nr_levels)
+{
+	struct mesh *mesh;
+
+	if (!(mesh = obj_read(file)))
+		return -1;
+	ed_attach_obj(ed, file, nr_levels, mesh, ed_patch_bounds(mesh),
+		      bvh_build(mesh, NULL));
+	return 0;
+}
+
+/* One file of an ed_add_objs() batch */
+struct ed_load {
+	struct editor *ed;
+	const char *file;
+	struct mesh *mesh;
+	float *patch_bounds;
+	struct bvh *bvh;
+	int done;
+};
+
+static void ed_run_load(void *arg)
+{
+	struct ed_load *load = arg;
+	struct editor *ed = load->ed;
+
+	load->mesh = obj_read(load->file);
+	if (load->mesh) {
+		load->patch_bounds = ed_patch_bounds(load->mesh);
+		load->bvh = bvh_build(load->mesh, NULL);
+	}
+
+	pthread_mutex_lock(&ed->lock);
+	load->done = 1;
+	pthread_cond_broadcast(&ed->loaded);
+	pthread_mutex_unlock(&ed->lock);
+}
+
+int ed_add_objs(struct editor *ed, const char **files, const int *nr_levels,
+		int nr_files)
+{
+	struct ed_load *loads;
+	int i, nr_added = 0;
+
+	loads = calloc(nr_files, sizeof(*loads));
+	for (i = 0; i < nr_files; i++) {
+		loads[i].ed = ed;
+		loads[i].file = files[i];
+		pool_add(ed->pool, ed_run_load, &loads[i]);
+	}
+
+	/* Upload in order as soon as each file and the ones before it are in */
+	for (i = 0; i < nr_files; i++) {
+		struct ed_load *load = &loads[i];
+
+		pthread_mutex_lock(&ed->lock);
+		while (!load->done)
+			pthread_cond_wait(&ed->loaded, &ed->lock);
+		pthread_mutex_unlock(&ed->lock);
+
+		if (!load->mesh)
+			continue;
+		ed_attach_obj(ed, load->file, nr_levels[i], load->mesh,
+			      load->patch_bounds, load->bvh);
+		nr_added++;
+	}
+	free(loads);
+	return nr_added;
+}
+
+void ed_update(struct editor *ed)
+{
+	struct ed_result *results, *res;
+
+	pthread_mutex_lock(&ed->lock);
+	results = ed->results;
+	ed->results = NULL;
+	pthread_mutex_unlock(&ed->lock);
+
+	buf_foreach(res, results) {
+		struct ed_obj *ed_obj = &ed->objs[res->obj];
+		struct ed_level *l = &ed_obj->levels[res->level];
+
+		if (res->gen == ed_obj->gen && !res->mesh) {
+			l->pending = 0;
+			l->failed = 1;
+		} else if (res->gen == ed_obj->gen) {
+			if (l->vbo)
+				ed_evict_level(ed, l);
+			l->pending = 0;
+			l->vs = res->counts.verts;
+			l->fs = res->counts.faces;
+			l->build_time = res->build_time;
+			l->mesh = res->mesh;
+			l->bvh = res->bvh;
+			l->vbo = ed_upload(ed_obj, res);
+			l->bytes = ed_level_size(l);
+			l->last_used = ++ed->tick;
+			ed->cache_bytes += l->bytes;
+		} else {
+			bvh_free(res->bvh);
+			mesh_free(res->mesh);
+		}
+		free(res->verts);
+		free(res->tris);
+		free(res->lines);
+	}
+	if (results)
+		ed_trim_cache(ed);
+	buf_free(results);
+}
 
 struct mesh *ed_cur_obj(struct editor *ed)
 {
@@ -77,11 +522,13 @@ struct mesh *ed_cur_obj(struct editor *ed)
 void ed_next_obj(struct editor *ed)
 {
 	ed->cur_obj = (ed->cur_obj + 1) % buf_len(ed->objs);
+	ed_request_around(ed);
 }
 
 void ed_prev_obj(struct editor *ed)
 {
 	ed->cur_obj = (ed->cur_obj - 1 + buf_len(ed->objs)) % buf_len(ed->objs);
+	ed_request_around(ed);
 }
 
 void ed_next_level(struct editor *ed)
@@ -90,6 +537,7 @@ void ed_next_level(struct editor *ed)
 
 	if (ed_obj->cur_level < ed_obj->nr_levels - 1)
 		ed_obj->cur_level++;
+	ed_request(ed, ed->cur_obj, ed_obj->cur_level);
 }
 
 void ed_prev_level(struct editor *ed)
@@ -98,6 +546,7 @@ void ed_prev_level(struct editor *ed)
 
 	if (ed_obj->cur_level > 0)
 		ed_obj->cur_level--;
+	ed_request(ed, ed->cur_obj, ed_obj->cur_level);
 }
 
 void ed_toggle_wireframe(struct editor *ed)
@@ -110,24 +559,20 @@ void ed_toggle_editing(struct editor *ed)
 	struct ed_obj *ed_obj = &cur_obj(ed);
 
 	ed->editing = !ed->editing;
+	ed->hover_vert = ed->hover_face = -1;
+	ed->sel_vert = ed->sel_face = -1;
 	if (ed->editing) {
-		struct mesh *mesh;
-
-		ed_obj->cur_level = 2;
-		mesh = subdivide(ed_obj->mesh, ed_obj->cur_level);
-		mesh_compile_list(mesh, ed_obj->lists + ed_obj->cur_level);
-		mesh_free(mesh);
+		ed_obj->cur_level = MIN(2, ed_obj->nr_levels - 1);
 	} else {
-		int i;
-		struct mesh *levels[MAX_LEVELS];
-
-		mesh_compile_list(ed_obj->mesh, ed_obj->lists);
-		subdivide_levels(ed_obj->mesh, levels, ed_obj->nr_levels - 1);
-		for (i = 0; i < ed_obj->nr_levels - 1; i++) {
-			mesh_compile_list(levels[i], ed_obj->lists + i + 1);
-			mesh_free(levels[i]);
-		}
+		struct ed_level *base = &ed_obj->levels[0];
+
+		mesh_vbo_free(base->vbo);
+		base->vbo = ed_upload_base(ed_obj);
+		ed->cache_bytes += ed_base_size(ed_obj) - base->bytes;
+		base->bytes = ed_base_size(ed_obj);
+		bvh_refit(ed_obj->bvh);
 	}
+	ed_recompute(ed, ed_obj);
 }
 
 int ed_is_editing(struct editor *ed)
@@ -135,26 +580,151 @@ int ed_is_editing(struct editor *ed)
 	return ed->editing;
 }
 
+/* Base face whose patch holds refined face fi */
+static int ed_base_face(struct ed_obj *ed_obj, int level, int fi)
+{
+	int lo = 0, hi = mesh_face_count(ed_obj->mesh);
+
+	/* Edits only move vertices, so the patches hold until the level changes */
+	if (level != ed_obj->pick_level) {
+		buf_resize(ed_obj->pick_first, hi + 1);
+		subdivide_patch_faces(ed_obj->mesh, level, ed_obj->pick_first);
+		ed_obj->pick_level = level;
+	}
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+
+		if (ed_obj->pick_first[mid] <= fi)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Corner of base face fi nearest to p on mesh, the level on screen, if p
+ * is close enough to it.  Base vertices keep their indices in every
+ * level and the face point of fi is the level's vertex V + fi.
+ */
+static int ed_near_corner(struct ed_obj *ed_obj, const struct mesh *mesh,
+			  int level, int fi, const float *p)
+{
+	int j, vi, ni, best = -1, n = mesh_face_vertex_count(ed_obj->mesh, fi);
+	float d, best_d = INFINITY;
+	const float *vbuf;
+	vector c;
+
+	mesh_vertex_buffer(mesh, &vbuf);
+	vec_zero(c);
+	for (j = 0; j < n; j++) {
+		mesh_face_vertex_index(ed_obj->mesh, fi, j, &vi, &ni);
+		vec_add(c, c, vbuf + 3 * vi);
+		if ((d = vec_dist(p, vbuf + 3 * vi)) < best_d) {
+			best_d = d;
+			best = vi;
+		}
+	}
+	vec_mul(c, 1.0f / n, c);
+	if (level)
+		vec_copy(c, vbuf + 3 * (mesh_vertex_buffer(ed_obj->mesh, NULL) + fi));
+	return best_d < PICK_VERTEX * vec_dist(c, vbuf + 3 * best) ? best : -1;
+}
+
+void ed_pick(struct editor *ed, const float *org, const float *dir, int select)
+{
+	struct ed_obj *ed_obj = &cur_obj(ed);
+	int level = ed_shown_level(ed_obj);
+	const struct mesh *mesh = ed_obj->mesh;
+	struct bvh *bvh = ed_obj->bvh;
+	struct bvh_hit hit;
+
+	if (!ed->editing)
+		return;
+	if (level) {
+		mesh = ed_obj->levels[level].mesh;
+		bvh = ed_obj->levels[level].bvh;
+	}
+
+	ed->hover_vert = ed->hover_face = -1;
+	if (bvh && bvh_ray(bvh, org, dir, INFINITY, &hit) >= 0) {
+		int fi = level ? ed_base_face(ed_obj, level, hit.face) : hit.face;
+
+		ed->hover_vert = ed_near_corner(ed_obj, mesh, level, fi, hit.p);
+		if (ed->hover_vert < 0)
+			ed->hover_face = fi;
+	}
+	if (select) {
+		ed->sel_vert = ed->hover_vert;
+		ed->sel_face = ed->hover_face;
+	}
+}
+
+/* On the cage, over whatever is in front */
+static void ed_render_pick(struct ed_obj *ed_obj, int vi, int fi)
+{
+	int j;
+
+	if (vi >= 0) {
+		const float *vbuf;
+
+		mesh_vertex_buffer(ed_obj->mesh, &vbuf);
+		glBegin(GL_POINTS);
+		glVertex3fv(vbuf + 3 * vi);
+		glEnd();
+	}
+	if (fi >= 0) {
+		glBegin(GL_LINE_LOOP);
+		for (j = 0; j < mesh_face_vertex_count(ed_obj->mesh, fi); j++)
+			glVertex3fv(mesh_get_vertex(ed_obj->mesh, fi, j));
+		glEnd();
+	}
+}
+
+/* Clip planes of the current GL projection and modelview */
+static void ed_view_planes(float *planes)
+{
+	matrix proj, view, m;
+
+	glGetFloatv(GL_PROJECTION_MATRIX, proj);
+	glGetFloatv(GL_MODELVIEW_MATRIX, view);
+	mat_mul(m, proj, view);
+	mat_frustum_planes(planes, m);
+}
+
 void ed_render(struct editor *ed)
 {
 	struct ed_obj *ed_obj = &cur_obj(ed);
+	struct ed_level *l = &ed_obj->levels[ed_shown_level(ed_obj)];
+	struct mesh_vbo *vbo = l->vbo;
+	float planes[24];
 
-	glPushAttrib(GL_LIGHTING_BIT | GL_POLYGON_BIT);
+	l->last_used = ++ed->tick;
+	ed_view_planes(planes);
+
+	glPushAttrib(GL_LIGHTING_BIT | GL_ENABLE_BIT | GL_CURRENT_BIT |
+		     GL_POINT_BIT | GL_LINE_BIT);
 	glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE,
 		     (GLfloat[4]) { 1.0f, 1.0f, 1.0f, 1.0f });
 	if (ed->editing) {
-		glCallList(ed_obj->lists + ed_obj->cur_level);
+		ed->nr_drawn = mesh_vbo_render_culled(vbo, planes);
+		glDisable(GL_LIGHTING);
+		glColor3f(0.0f, 1.0f, 0.0f);
+		mesh_vbo_render_edges_culled(ed_obj->levels[0].vbo, planes);
+
+		glDisable(GL_DEPTH_TEST);
+		glPointSize(8.0f);
+		glLineWidth(3.0f);
+		glColor3f(1.0f, 0.0f, 0.0f);
+		ed_render_pick(ed_obj, ed->sel_vert, ed->sel_face);
+		glColor3f(1.0f, 1.0f, 0.0f);
+		ed_render_pick(ed_obj, ed->hover_vert, ed->hover_face);
+	} else if (ed->wireframe) {
 		glDisable(GL_LIGHTING);
 		glColor3f(0.0f, 1.0f, 0.0f);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		glCallList(ed_obj->lists);
+		ed->nr_drawn = mesh_vbo_render_edges_culled(vbo, planes);
 	} else {
-		if (ed->wireframe) {
-			glDisable(GL_LIGHTING);
-			glColor3f(0.0f, 1.0f, 0.0f);
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		}
-		glCallList(ed_obj->lists + ed_obj->cur_level);
+		ed->nr_drawn = mesh_vbo_render_culled(vbo, planes);
 	}
 	glPopAttrib();
 }
@@ -162,12 +732,36 @@ void ed_render(struct editor *ed)
 void ed_render_overlay(struct editor *ed)
 {
 	struct ed_obj *ed_obj = &cur_obj(ed);
+	struct ed_level *l = &ed_obj->levels[ed_obj->cur_level];
 
 	glRasterPos2f(0.005f, 0.975f);
-	gl_printf(GLUT_BITMAP_HELVETICA_18, "%s@%d",
-		  ed_obj->file, ed_obj->cur_level);
+	gl_printf(GLUT_BITMAP_HELVETICA_18, "%s@%d%s",
+		  ed_obj->file, ed_obj->cur_level,
+		  l->vbo ? "" : l->failed ? " (out of memory)" :
+		  " (subdividing...)");
 	glRasterPos2f(0.005f, 0.950f);
-	gl_printf(GLUT_BITMAP_HELVETICA_18, "%d verts %d faces",
-		  ed_obj->stats[ed_obj->cur_level].vs,
-		  ed_obj->stats[ed_obj->cur_level].fs);
+	if (l->fs)
+		gl_printf(GLUT_BITMAP_HELVETICA_18, "%d verts %d faces, %d/%d patches drawn",
+			  l->vs, l->fs, ed->nr_drawn,
+			  mesh_face_count(ed_obj->mesh));
+	glRasterPos2f(0.005f, 0.925f);
+	/* The rest of the level's bytes are its picking mesh and tree */
+	if (l->vbo)
+		gl_printf(GLUT_BITMAP_HELVETICA_18,
+			  "built in %.1f ms, %.1f MiB on gpu, %.1f MiB picking",
+			  l->build_time * 1e3,
+			  mesh_vbo_size(l->vbo) / (1024.0 * 1024.0),
+			  (l->bytes - mesh_vbo_size(l->vbo)) / (1024.0 * 1024.0));
+	glRasterPos2f(0.005f, 0.900f);
+	gl_printf(GLUT_BITMAP_HELVETICA_18, "cache %.1f / %.1f MiB",
+		  ed->cache_bytes / (1024.0 * 1024.0),
+		  ed->cache_budget / (1024.0 * 1024.0));
+	if (ed->editing) {
+		glRasterPos2f(0.005f, 0.875f);
+		gl_printf(GLUT_BITMAP_HELVETICA_18, "hover %s %d, selected %s %d",
+			  ed->hover_vert >= 0 ? "vertex" : "face",
+			  ed->hover_vert >= 0 ? ed->hover_vert : ed->hover_face,
+			  ed->sel_vert >= 0 ? "vertex" : "face",
+			  ed->sel_vert >= 0 ? ed->sel_vert : ed->sel_face);
+	}
 }
@@ -1,8 +1,24 @@
 #ifndef EDITOR_H
 #define EDITOR_H
 
+#include <stddef.h>
+
 struct editor *ed_create(void);
-void ed_add_obj(struct editor *ed, const char *file, int levels);
+int  ed_add_obj(struct editor *ed, const char *file, int levels);
+
+/*
+ * Reads the files in parallel on the editor's worker threads and adds them
+ * in the given order as each one becomes ready.  Unreadable files are
+ * skipped, returns the number of objects added.
+ */
+int  ed_add_objs(struct editor *ed, const char **files, const int *levels,
+		 int nr_files);
+
+/* Refined levels are built on first view and share a bounded LRU cache */
+void ed_set_cache_budget(struct editor *ed, size_t bytes);
+
+/* Uploads levels finished by the background workers, call once per frame */
+void ed_update(struct editor *ed);
 
 struct mesh *ed_cur_obj(struct editor *ed);
 void ed_next_obj(struct editor *ed);
@@ -13,6 +29,13 @@ void ed_prev_level(struct editor *ed);
 void ed_toggle_wireframe(struct editor *ed);
 void ed_toggle_editing(struct editor *ed);
 int  ed_is_editing(struct editor *ed);
+
+/*
+ * In editing mode, finds the base vertex or face under the ray from org
+ * along dir on the level on screen and highlights it, or selects it too
+ * when select is set.  A vertex wins when the ray lands near it.
+ */
+void ed_pick(struct editor *ed, const float *org, const float *dir, int select);
 void ed_render(struct editor *ed);
 void ed_render_overlay(struct editor *ed);
 
@@ -0,0 +1,483 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buf.h"
+#include "mathx.h"
+#include "mesh.h"
+#include "util.h"
+#include "gen.h"
+
+static const char *shape_names[] = {
+	"torus",
+	"sphere",
+	"ngon",
+	"pole",
+};
+
+/* Polygon soup the shapes are built in before becoming a mesh */
+struct gen {
+	float *verts;
+	int *first;		/* Start of each face in idx */
+	int *idx;
+	unsigned rand;
+};
+
+static unsigned gen_rand(struct gen *g)
+{
+	/* xorshift32 */
+	g->rand ^= g->rand << 13;
+	g->rand ^= g->rand >> 17;
+	g->rand ^= g->rand << 5;
+	return g->rand;
+}
+
+static float gen_randf(struct gen *g)
+{
+	return (gen_rand(g) >> 8) * (1.0f / 16777216.0f);
+}
+
+static int gen_vertex(struct gen *g, float x, float y, float z)
+{
+	float *p = buf_push_n(g->verts, 3);
+
+	vec_set(p, x, y, z);
+	return buf_len(g->verts) / 3 - 1;
+}
+
+static void gen_quad(struct gen *g, int a, int b, int c, int d)
+{
+	int *q;
+
+	buf_push(g->first, buf_len(g->idx));
+	q = buf_push_n(g->idx, 4);
+	q[0] = a;
+	q[1] = b;
+	q[2] = c;
+	q[3] = d;
+}
+
+/* Open addressing map from 64 bit keys to ints */
+struct gen_map {
+	uint64_t *keys;
+	int *vals;
+	uint64_t mask;
+};
+
+#define MAP_EMPTY	UINT64_MAX
+
+static void map_init(struct gen_map *m, int n)
+{
+	uint64_t size = 16, i;
+
+	while (size < 2 * (uint64_t) n)
+		size *= 2;
+	m->mask = size - 1;
+	m->keys = NULL;
+	m->vals = NULL;
+	buf_resize(m->keys, size);
+	buf_resize(m->vals, size);
+	for (i = 0; i < size; i++)
+		m->keys[i] = MAP_EMPTY;
+}
+
+static void map_free(struct gen_map *m)
+{
+	buf_free(m->keys);
+	buf_free(m->vals);
+}
+
+/* Slot of key, inserted with value -1 if missing and insert is set */
+static int *map_get(struct gen_map *m, uint64_t key, int insert)
+{
+	uint64_t i = (key * 0x9e3779b97f4a7c15ull) >> 20;
+
+	for (i &= m->mask; m->keys[i] != MAP_EMPTY; i = (i + 1) & m->mask)
+		if (m->keys[i] == key)
+			return &m->vals[i];
+	if (!insert)
+		return NULL;
+	m->keys[i] = key;
+	m->vals[i] = -1;
+	return &m->vals[i];
+}
+
+static uint64_t edge_key(int a, int b)
+{
+	return a < b ? (uint64_t) a << 32 | b : (uint64_t) b << 32 | a;
+}
+
+static void gen_torus(struct gen *g, int nu, int nv)
+{
+	int i, j;
+
+	for (i = 0; i < nu; i++) {
+		for (j = 0; j < nv; j++) {
+			float u = TAU * i / nu, v = TAU * j / nv;
+			float r = 1.0f + 0.35f * cosf(v);
+
+			gen_vertex(g, r * cosf(u), r * sinf(u), 0.35f * sinf(v));
+		}
+	}
+	for (i = 0; i < nu; i++) {
+		int i1 = (i + 1) % nu;
+
+		for (j = 0; j < nv; j++) {
+			int j1 = (j + 1) % nv;
+
+			gen_quad(g, i * nv + j, i1 * nv + j, i1 * nv + j1, i * nv + j1);
+		}
+	}
+}
+
+/*
+ * Runs of up to max_run quads on every even ring become one polygon.
+ * Each vertex loses at most one edge that way, so none drops below
+ * valence three.
+ */
+static void gen_ngon(struct gen *g, int nu, int nv, int max_run)
+{
+	int i, j, k, n;
+
+	for (i = 0; i < nu; i++) {
+		for (j = 0; j < nv; j++) {
+			float u = TAU * i / nu, v = TAU * j / nv;
+			float r = 1.0f + 0.35f * cosf(v);
+
+			gen_vertex(g, r * cosf(u), r * sinf(u), 0.35f * sinf(v));
+		}
+	}
+	for (i = 0; i < nu; i++) {
+		int i1 = (i + 1) % nu;
+
+		for (j = 0; j < nv; j += n) {
+			n = i % 2 ? 1 : 1 + gen_rand(g) % max_run;
+			/* A run all the way round would repeat vertex j */
+			n = MIN(n, MIN(nv - j, nv - 1));
+			buf_push(g->first, buf_len(g->idx));
+			for (k = 0; k <= n; k++)
+				buf_push(g->idx, i1 * nv + (j + k) % nv);
+			for (k = n; k >= 0; k--)
+				buf_push(g->idx, i * nv + (j + k) % nv);
+		}
+	}
+}
+
+/* Cube sphere: six n x n grids welded along the cube's edges */
+static void gen_cube_sphere(struct gen *g, int n)
+{
+	struct gen_map lattice;
+	int axis, sign, i, j, k;
+
+	map_init(&lattice, 6 * (n + 1) * (n + 1));
+	for (axis = 0; axis < 3; axis++) {
+		int u = (axis + 1) % 3, v = (axis + 2) % 3;
+
+		for (sign = 0; sign < 2; sign++) {
+			int *grid = NULL;
+
+			buf_resize(grid, (n + 1) * (n + 1));
+			for (i = 0; i <= n; i++) {
+				for (j = 0; j <= n; j++) {
+					int c[3], *slot;
+					uint64_t key;
+
+					c[axis] = sign ? n : 0;
+					c[u] = i;
+					c[v] = j;
+					key = ((uint64_t) c[0] * (n + 1) + c[1]) * (n + 1) + c[2];
+					slot = map_get(&lattice, key, 1);
+					if (*slot == -1) {
+						vector p;
+
+						/* Tangent spacing evens out the face sizes */
+						for (k = 0; k < 3; k++)
+							p[k] = tanf(PI / 4 * (2.0f * c[k] / n - 1.0f));
+						vec_normalize(p, p);
+						*slot = gen_vertex(g, p[0], p[1], p[2]);
+					}
+					grid[i * (n + 1) + j] = *slot;
+				}
+			}
+
+			/* u x v is +axis, flip the winding on the negative side */
+			for (i = 0; i < n; i++) {
+				for (j = 0; j < n; j++) {
+					int a = grid[i * (n + 1) + j];
+					int b = grid[(i + 1) * (n + 1) + j];
+					int c = grid[(i + 1) * (n + 1) + j + 1];
+					int d = grid[i * (n + 1) + j + 1];
+
+					if (sign)
+						gen_quad(g, a, b, c, d);
+					else
+						gen_quad(g, d, c, b, a);
+				}
+			}
+			buf_free(grid);
+		}
+	}
+	map_free(&lattice);
+}
+
+struct gen_edge {
+	int f[2];
+};
+
+static void edge_replace_face(struct gen_edge *e, int from, int to)
+{
+	e->f[e->f[0] == from ? 0 : 1] = to;
+}
+
+/*
+ * Rotates random interior edges of an all quad mesh.  The two quads
+ * around an edge form a hexagon, which is re-split along the next
+ * diagonal: the old edge's ends lose a neighbour and the new edge's gain
+ * one, so every rotation makes up to four extraordinary vertices.
+ * Valences stay within 3 to 6.
+ */
+static void gen_rotate_edges(struct gen *g, int nr_rotations)
+{
+	int i, nr_faces = buf_len(g->first), nr_verts = buf_len(g->verts) / 3;
+	int *q = g->idx, *valence = NULL, attempts;
+	struct gen_edge *edges = NULL;
+	struct gen_map map;
+
+	map_init(&map, 2 * nr_faces + 4 * nr_rotations);
+	buf_resize(valence, nr_verts);
+	memset(valence, 0, nr_verts * sizeof(*valence));
+	for (i = 0; i < nr_faces; i++) {
+		int j;
+
+		for (j = 0; j < 4; j++) {
+			int *e = map_get(&map, edge_key(q[4 * i + j], q[4 * i + (j + 1) % 4]), 1);
+
+			if (*e == -1) {
+				struct gen_edge ne = { { i, -1 } };
+
+				*e = buf_len(edges);
+				buf_push(edges, ne);
+				valence[q[4 * i + j]]++;
+				valence[q[4 * i + (j + 1) % 4]]++;
+			} else {
+				edges[*e].f[1] = i;
+			}
+		}
+	}
+
+	for (attempts = 4 * nr_rotations; nr_rotations > 0 && attempts > 0; attempts--) {
+		int f = gen_rand(g) % nr_faces, s = gen_rand(g) % 4, t, h;
+		int *e, *ne, v0, v1, v2, v3, v4, v5, *qf, *qh;
+
+		qf = q + 4 * f;
+		v0 = qf[(s + 3) % 4];
+		v1 = qf[s];
+		v2 = qf[(s + 1) % 4];
+		v3 = qf[(s + 2) % 4];
+		e = map_get(&map, edge_key(v1, v2), 0);
+		h = edges[*e].f[edges[*e].f[0] == f ? 1 : 0];
+		qh = q + 4 * h;
+		for (t = 0; t < 4; t++)
+			if (qh[t] == v2 && qh[(t + 1) % 4] == v1)
+				break;
+		v4 = qh[(t + 2) % 4];
+		v5 = qh[(t + 3) % 4];
+
+		if (valence[v1] <= 3 || valence[v2] <= 3 ||
+		    valence[v3] >= 6 || valence[v4] >= 6 || v3 == v4)
+			continue;
+		ne = map_get(&map, edge_key(v3, v4), 1);
+		if (*ne != -1 && edges[*ne].f[0] != -1)
+			continue;
+
+		/* f becomes v3 v0 v1 v4 and h becomes v4 v5 v2 v3 */
+		edge_replace_face(&edges[*map_get(&map, edge_key(v1, v4), 0)], h, f);
+		edge_replace_face(&edges[*map_get(&map, edge_key(v2, v3), 0)], f, h);
+		if (*ne == -1) {
+			struct gen_edge new_edge = { { f, h } };
+
+			*ne = buf_len(edges);
+			buf_push(edges, new_edge);
+		}
+		edges[*ne].f[0] = f;
+		edges[*ne].f[1] = h;
+		edges[*e].f[0] = edges[*e].f[1] = -1;
+
+		qf[0] = v3; qf[1] = v0; qf[2] = v1; qf[3] = v4;
+		qh[0] = v4; qh[1] = v5; qh[2] = v2; qh[3] = v3;
+		valence[v1]--;
+		valence[v2]--;
+		valence[v3]++;
+		valence[v4]++;
+		nr_rotations--;
+	}
+
+	buf_free(valence);
+	buf_free(edges);
+	map_free(&map);
+}
+
+/* UV sphere with nr_rings rings of valence vertices between two poles */
+static void gen_pole_sphere(struct gen *g, int valence, int nr_rings)
+{
+	int i, j, north, south;
+
+	north = gen_vertex(g, 0.0f, 0.0f, 1.0f);
+	for (i = 1; i <= nr_rings; i++) {
+		for (j = 0; j < valence; j++) {
+			vector p;
+
+			vec_spherical(p, TAU * j / valence, PI * i / (nr_rings + 1));
+			gen_vertex(g, p[0], p[1], p[2]);
+		}
+	}
+	south = gen_vertex(g, 0.0f, 0.0f, -1.0f);
+
+	for (j = 0; j < valence; j++) {
+		int j1 = (j + 1) % valence;
+
+		buf_push(g->first, buf_len(g->idx));
+		buf_push(g->idx, north);
+		buf_push(g->idx, 1 + j);
+		buf_push(g->idx, 1 + j1);
+
+		for (i = 0; i + 1 < nr_rings; i++) {
+			int r0 = 1 + i * valence, r1 = r0 + valence;
+
+			gen_quad(g, r0 + j, r1 + j, r1 + j1, r0 + j1);
+		}
+
+		buf_push(g->first, buf_len(g->idx));
+		buf_push(g->idx, south);
+		buf_push(g->idx, 1 + (nr_rings - 1) * valence + j1);
+		buf_push(g->idx, 1 + (nr_rings - 1) * valence + j);
+	}
+}
+
+/* Displaces every vertex by up to noise average edge lengths per axis */
+static void gen_add_noise(struct gen *g, float noise)
+{
+	int i, nr_faces = buf_len(g->first);
+	double len = 0.0;
+	float amp;
+
+	if (noise <= 0.0f || !nr_faces)
+		return;
+	for (i = 0; i < nr_faces; i++) {
+		const int *f = g->idx + g->first[i];
+
+		len += vec_dist(g->verts + 3 * f[0], g->verts + 3 * f[1]);
+	}
+	amp = noise * len / nr_faces;
+	for (i = 0; i < buf_len(g->verts); i++)
+		g->verts[i] += amp * (2.0f * gen_randf(g) - 1.0f);
+}
+
+void gen_defaults(struct gen_params *p, int shape)
+{
+	p->shape = shape;
+	p->faces = 10000;
+	p->seed = 1;
+	p->irregular = 0.02f;
+	p->max_sides = 8;
+	p->valence = 32;
+	p->noise = 0.0f;
+}
+
+struct mesh *gen_mesh(const struct gen_params *p)
+{
+	struct gen g = { NULL, NULL, NULL, p->seed ? p->seed : 1 };
+	struct mesh *mesh;
+	int i, j, n, faces = MAX(p->faces, 1);
+
+	switch (p->shape) {
+	case GEN_TORUS:
+	case GEN_NGON:
+		n = MAX(3, (int) (sqrtf(faces / 2.0f) + 0.5f));
+		if (p->shape == GEN_TORUS)
+			gen_torus(&g, MAX(3, faces / n), n);
+		else
+			gen_ngon(&g, MAX(4, (faces / n + 1) & ~1), n,
+				 MAX(1, (p->max_sides - 2) / 2));
+		break;
+	case GEN_SPHERE:
+		gen_cube_sphere(&g, MAX(1, (int) (sqrtf(faces / 6.0f) + 0.5f)));
+		gen_rotate_edges(&g, p->irregular * buf_len(g.first));
+		break;
+	case GEN_POLE:
+		n = MAX(3, p->valence);
+		gen_pole_sphere(&g, n, MAX(1, faces / n - 1));
+		break;
+	default:
+		return NULL;
+	}
+	gen_add_noise(&g, p->noise);
+
+	mesh = mesh_create_shared();
+	for (i = 0; i < buf_len(g.verts); i += 3)
+		mesh_add_vertex(mesh, g.verts + i);
+	for (i = 0; i < buf_len(g.first); i++) {
+		int end = i + 1 < buf_len(g.first) ? g.first[i + 1] : buf_len(g.idx);
+
+		mesh_begin_face(mesh);
+		for (j = g.first[i]; j < end; j++)
+			mesh_add_index(mesh, g.idx[j], -1);
+		mesh_end_face(mesh);
+	}
+	mesh_compute_normals(mesh);
+
+	buf_free(g.verts);
+	buf_free(g.first);
+	buf_free(g.idx);
+	return mesh;
+}
+
+const char *gen_shape_name(int shape)
+{
+	return shape >= 0 && shape < ARRAY_SIZE(shape_names) ? shape_names[shape] : "?";
+}
+
+int gen_parse(struct gen_params *p, const char *spec)
+{
+	const char *s = spec;
+	int shape;
+
+	for (shape = 0; shape < ARRAY_SIZE(shape_names); shape++) {
+		int len = strlen(shape_names[shape]);
+
+		if (!strncmp(spec, shape_names[shape], len) &&
+		    (spec[len] == '\0' || spec[len] == ':'))
+			break;
+	}
+	if (shape == ARRAY_SIZE(shape_names))
+		return -1;
+	gen_defaults(p, shape);
+
+	s = strchr(spec, ':');
+	while (s && *s) {
+		char key[16];
+		double val;
+		int len;
+
+		if (sscanf(s + 1, "%15[a-z]=%lf%n", key, &val, &len) != 2)
+			return -1;
+		if (!strcmp(key, "faces"))
+			p->faces = val;
+		else if (!strcmp(key, "seed"))
+			p->seed = val;
+		else if (!strcmp(key, "irregular"))
+			p->irregular = val;
+		else if (!strcmp(key, "sides"))
+			p->max_sides = val;
+		else if (!strcmp(key, "valence"))
+			p->valence = val;
+		else if (!strcmp(key, "noise"))
+			p->noise = val;
+		else
+			return -1;
+		s += 1 + len;
+		if (*s && *s != ',')
+			return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef GEN_H
+#define GEN_H
+
+/*
+ * Closed test meshes of any size.  The same parameters and seed always
+ * give the same mesh.
+ *
+ * GEN_TORUS	regular quad grid torus, valence four everywhere
+ * GEN_SPHERE	quad cube sphere; irregular sets how many random edge
+ *		rotations per face add valence three and five vertices
+ * GEN_NGON	torus whose every other ring merges runs of quads into
+ *		polygons of up to max_sides sides
+ * GEN_POLE	uv sphere with triangle fans around two poles of the
+ *		given valence
+ */
+enum {
+	GEN_TORUS,
+	GEN_SPHERE,
+	GEN_NGON,
+	GEN_POLE,
+};
+
+struct gen_params {
+	int shape;
+	int faces;		/* Approximate face count */
+	unsigned seed;
+	float irregular;	/* GEN_SPHERE */
+	int max_sides;		/* GEN_NGON */
+	int valence;		/* GEN_POLE */
+	float noise;		/* Random displacement, in average edge lengths */
+};
+
+void gen_defaults(struct gen_params *p, int shape);
+struct mesh *gen_mesh(const struct gen_params *p);
+
+/*
+ * Parses "shape[:key=value,...]", e.g. "sphere:faces=1000000,irregular=0.01"
+ * with keys faces, seed, irregular, sides, valence and noise.  Returns -1
+ * for an unknown shape or key.
+ */
+int gen_parse(struct gen_params *p, const char *spec);
+const char *gen_shape_name(int shape);
+
+#endif
@@ -5,6 +5,9 @@
 #define NOMINMAX
 #include <windows.h>
 #endif
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES
+#endif
 #ifdef __APPLE__
 #include <GLUT/glut.h>
 #else
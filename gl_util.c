@@ -1,8 +1,8 @@
-#include <time.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include "gl.h"
 #include "gl_util.h"
+#include "sys.h"
 
 void gl_begin_2d(void)
 {
@@ -71,14 +71,14 @@ void gl_draw_quad(int flipy)
 
 void gl_draw_fps(float x, float y)
 {
-	static clock_t ticks;
+	static double ticks;
 	static int nr_frames, fps;
-	clock_t now;
+	double now;
 
 	/* Calculate frame rate */
 	nr_frames++;
-	now = clock();
-	if (now - ticks >= CLOCKS_PER_SEC) {
+	now = sys_time();
+	if (now - ticks >= 1.0) {
 		fps = nr_frames;
 		ticks = now;
 		nr_frames = 0;
@@ -6,6 +6,8 @@
 #include "mesh.h"
 #include "meshrend.h"
 #include "editor.h"
+#include "prof.h"
+#include "util.h"
 
 static struct editor *ed;
 
@@ -17,6 +19,14 @@ static float fovy  = 60.0f;
 static float znear = 0.1f, zfar = 1000.0f;
 static GLint width = 1280, height = 736;
 
+static const char *files[] = {
+	"objs/cube.obj",
+	"objs/tetra.obj",
+	"objs/bigguy.obj",
+	"objs/monsterfrog.obj",
+};
+static const int levels[] = { 5, 5, 3, 3 };
+
 static enum { NONE, ROTATING, PANNING, ZOOMING } cur_op = NONE;
 static int last_x, last_y;
 
@@ -59,11 +69,40 @@ static void get_camera(vector eye, vector at, vector up)
 	vec_copy(up, y);
 }
 
+/* Ray from the eye through window pixel x, y */
+static void get_mouse_ray(int x, int y, vector org, vector dir)
+{
+	vector at, up, cx, cy, cz;
+	float lx, ly;
+
+	ly = tanf(radians(fovy / 2.0f));
+	lx = ly * width / height;
+
+	get_camera(org, at, up);
+	get_camera_frame(cx, cy, cz);
+	vec_copy(dir, cz);
+	vec_mul(dir, -1.0f, dir);
+	vec_mad(dir, (2.0f * x / width - 1.0f) * lx, cx);
+	vec_mad(dir, (1.0f - 2.0f * y / height) * ly, cy);
+}
+
+static void pick(int x, int y, int select)
+{
+	vector org, dir;
+
+	get_mouse_ray(x, y, org, dir);
+	ed_pick(ed, org, dir, select);
+}
+
 static void display(void)
 {
 	matrix m;
 	vector eye, at, up;
 
+	prof_frame();
+	prof_begin(PROF_DISPLAY);
+	ed_update(ed);
+
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	/* Render scene */
@@ -82,14 +121,22 @@ static void display(void)
 		  (GLfloat[4]) { eye[0], eye[1], eye[2], 1.0f });
 	glEnable(GL_LIGHT0);
 
+	prof_begin(PROF_RENDER);
+	prof_gpu_begin();
 	ed_render(ed);
 	gl_draw_xyz();
+	prof_gpu_end();
+	prof_end(PROF_RENDER);
 
 	/* Render overlays */
+	prof_begin(PROF_OVERLAY);
 	gl_begin_2d();
 	gl_draw_fps(0.925f, 0.975f);
 	ed_render_overlay(ed);
+	prof_draw(0.005f, 0.850f);
 	gl_end_2d();
+	prof_end(PROF_OVERLAY);
+	prof_end(PROF_DISPLAY);
 
 	/* Swap buffers */
 	glutSwapBuffers();
@@ -118,6 +165,15 @@ static void keyboard(unsigned char key, int x, int y)
 	case 'e': case 'E':
 		ed_toggle_editing(ed);
 		break;
+	case 'p': case 'P':
+		prof_toggle();
+		break;
+	case 'c': case 'C':
+		if (prof_dump_csv("profile.csv"))
+			fprintf(stderr, "cannot write profile.csv\n");
+		else
+			printf("Frame samples written to profile.csv\n");
+		break;
 	}
 
 	if (!ed_is_editing(ed)) {
@@ -178,7 +234,10 @@ static void mouse(int button, int state, int x, int y)
 
 	mods = glutGetModifiers();
 	if (state == GLUT_DOWN) {
-		if (button == GLUT_LEFT_BUTTON)
+		if (button == GLUT_LEFT_BUTTON && (mods & GLUT_ACTIVE_SHIFT) &&
+		    ed_is_editing(ed))
+			pick(x, y, 1);
+		else if (button == GLUT_LEFT_BUTTON)
 			cur_op = (mods & GLUT_ACTIVE_CTRL) ? PANNING : ROTATING;
 		else if (button == GLUT_RIGHT_BUTTON)
 			cur_op = ZOOMING;
@@ -216,6 +275,8 @@ static void motion(int x, int y)
 		vec_mad(center,  dy * ly, y);
 	} else if (cur_op == ZOOMING) {
 		focal_len *= (1.0f - dy) - dx;
+	} else if (ed_is_editing(ed)) {
+		pick(x, y, 0);
 	}
 
 	last_x = x;
@@ -240,14 +301,15 @@ int main(int argc, char **argv)
 	glutSpecialFunc(special);
 	glutMouseFunc(mouse);
 	glutMotionFunc(motion);
+	glutPassiveMotionFunc(motion);
 	glutIdleFunc(idle);
 
 	printf("Loading... "); fflush(stdout);
 	ed = ed_create();
-	ed_add_obj(ed, "objs/cube.obj", 5);
-	ed_add_obj(ed, "objs/tetra.obj", 5);
-	ed_add_obj(ed, "objs/bigguy.obj", 3);
-	ed_add_obj(ed, "objs/monsterfrog.obj", 3);
+	if (ed_add_objs(ed, files, levels, ARRAY_SIZE(files)) == 0) {
+		printf("no objects.\n");
+		return 1;
+	}
 	printf("done.\n");
 
 	focus_camera(ed_cur_obj(ed));
@@ -185,3 +185,488 @@ void mat_persp(matrix r, float fovy, float aspect, float near, float far)
 	right = aspect * top ;
 	mat_frustum(r, -right, right, -top, top, near, far);
 }
+
+void mat_frustum_planes(float *planes, const matrix a)
+{
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 4; j++) {
+			planes[8 * i + j]     = A(3,j) + A(i,j);
+			planes[8 * i + 4 + j] = A(3,j) - A(i,j);
+		}
+	}
+}
+
+int frustum_cull_box(const float *planes, const vector min, const vector max)
+{
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		const float *p = planes + 4 * i;
+		vector v;
+
+		/* Corner furthest along the plane normal */
+		v[0] = p[0] >= 0.0f ? max[0] : min[0];
+		v[1] = p[1] >= 0.0f ? max[1] : min[1];
+		v[2] = p[2] >= 0.0f ? max[2] : min[2];
+		if (vec_dot(p, v) + p[3] < 0.0f)
+			return 1;
+	}
+	return 0;
+}
+
+/* Batched kernels */
+struct vec_kernels {
+	void (*transform)(float *r, const matrix m, const float *v, int n, int w);
+	void (*normalize)(float *r, const float *v, int n);
+	void (*cross)(float *r, const float *a, const float *b, int n);
+	void (*bounds)(vector min, vector max, const float *v, int n);
+	void (*axpy)(float *y, float a, const float *x, int n);
+};
+
+/* w is 1 for points and 0 for vectors */
+static void transform_scalar(float *r, const matrix a, const float *v, int n, int w)
+{
+	int i;
+
+	for (i = 0; i < n; i++, r += 3, v += 3) {
+		if (w)
+			mat_mul_point(r, a, v);
+		else
+			mat_mul_vector(r, a, v);
+	}
+}
+
+static void normalize_scalar(float *r, const float *v, int n)
+{
+	int i;
+
+	for (i = 0; i < 3 * n; i += 3)
+		vec_normalize(r + i, v + i);
+}
+
+static void cross_scalar(float *r, const float *a, const float *b, int n)
+{
+	int i;
+
+	for (i = 0; i < 3 * n; i += 3) {
+		vector c;
+
+		vec_cross(c, a + i, b + i);
+		vec_copy(r + i, c);
+	}
+}
+
+static void bounds_scalar(vector min, vector max, const float *v, int n)
+{
+	int i;
+
+	for (i = 0; i < 3 * n; i += 3) {
+		vec_min(min, min, v + i);
+		vec_max(max, max, v + i);
+	}
+}
+
+static void axpy_scalar(float *y, float a, const float *x, int n)
+{
+	int i;
+
+	for (i = 0; i < 3 * n; i++)
+		y[i] += a * x[i];
+}
+
+static const struct vec_kernels kernels_scalar = {
+	transform_scalar,
+	normalize_scalar,
+	cross_scalar,
+	bounds_scalar,
+	axpy_scalar,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define SSE		__attribute__((target("sse2")))
+#define AVX		__attribute__((target("avx")))
+
+/*
+ * Four packed xyz triples in three registers to and from x, y and z
+ * registers.  The AVX kernels run the same shuffles on two blocks of four
+ * at once, one per 128-bit lane.
+ */
+#define AOS_TO_SOA(shuf, m0, m1, m2, x, y, z) do {			\
+	typeof(m0) t_ = shuf(m1, m2, _MM_SHUFFLE(2, 1, 3, 2));		\
+	typeof(m0) u_ = shuf(m0, m1, _MM_SHUFFLE(1, 0, 2, 1));		\
+	x = shuf(m0, t_, _MM_SHUFFLE(2, 0, 3, 0));			\
+	y = shuf(u_, t_, _MM_SHUFFLE(3, 1, 2, 0));			\
+	z = shuf(u_, m2, _MM_SHUFFLE(3, 0, 3, 1));			\
+} while (0)
+
+#define SOA_TO_AOS(shuf, unpacklo, unpackhi, x, y, z, m0, m1, m2) do {	\
+	typeof(x) lo_ = unpacklo(x, y);					\
+	typeof(x) hi_ = unpackhi(x, y);					\
+	m0 = shuf(lo_, shuf(z, x, _MM_SHUFFLE(1, 1, 0, 0)),		\
+		  _MM_SHUFFLE(2, 0, 1, 0));				\
+	m1 = shuf(shuf(y, z, _MM_SHUFFLE(1, 1, 1, 1)), hi_,		\
+		  _MM_SHUFFLE(1, 0, 2, 0));				\
+	m2 = shuf(shuf(z, x, _MM_SHUFFLE(3, 3, 2, 2)),			\
+		  shuf(y, z, _MM_SHUFFLE(3, 3, 3, 3)),			\
+		  _MM_SHUFFLE(2, 0, 2, 0));				\
+} while (0)
+
+SSE static void transform_sse(float *r, const matrix a, const float *v, int n, int w)
+{
+	__m128 c0 = _mm_loadu_ps(a), c1 = _mm_loadu_ps(a + 4);
+	__m128 c2 = _mm_loadu_ps(a + 8), c3 = _mm_loadu_ps(a + 12);
+	int i;
+
+	for (i = 0; i < n; i++, r += 3, v += 3) {
+		__m128 p;
+
+		p = _mm_mul_ps(c0, _mm_set1_ps(v[0]));
+		p = _mm_add_ps(p, _mm_mul_ps(c1, _mm_set1_ps(v[1])));
+		p = _mm_add_ps(p, _mm_mul_ps(c2, _mm_set1_ps(v[2])));
+		if (w)
+			p = _mm_add_ps(p, c3);
+		/* Three floats only, r may alias the next input */
+		_mm_storel_pi((__m64 *) r, p);
+		_mm_store_ss(r + 2, _mm_movehl_ps(p, p));
+	}
+}
+
+SSE static void normalize_sse(float *r, const float *v, int n)
+{
+	__m128 one = _mm_set1_ps(1.0f);
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4, r += 12, v += 12) {
+		__m128 m0 = _mm_loadu_ps(v), m1 = _mm_loadu_ps(v + 4);
+		__m128 m2 = _mm_loadu_ps(v + 8), x, y, z, d;
+
+		AOS_TO_SOA(_mm_shuffle_ps, m0, m1, m2, x, y, z);
+		d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+			       _mm_mul_ps(z, z));
+		d = _mm_div_ps(one, _mm_sqrt_ps(d));
+		x = _mm_mul_ps(x, d);
+		y = _mm_mul_ps(y, d);
+		z = _mm_mul_ps(z, d);
+		SOA_TO_AOS(_mm_shuffle_ps, _mm_unpacklo_ps, _mm_unpackhi_ps,
+			   x, y, z, m0, m1, m2);
+		_mm_storeu_ps(r, m0);
+		_mm_storeu_ps(r + 4, m1);
+		_mm_storeu_ps(r + 8, m2);
+	}
+	normalize_scalar(r, v, n - i);
+}
+
+SSE static void cross_sse(float *r, const float *a, const float *b, int n)
+{
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4, r += 12, a += 12, b += 12) {
+		__m128 m0, m1, m2, ax, ay, az, bx, by, bz, x, y, z;
+
+		m0 = _mm_loadu_ps(a);
+		m1 = _mm_loadu_ps(a + 4);
+		m2 = _mm_loadu_ps(a + 8);
+		AOS_TO_SOA(_mm_shuffle_ps, m0, m1, m2, ax, ay, az);
+		m0 = _mm_loadu_ps(b);
+		m1 = _mm_loadu_ps(b + 4);
+		m2 = _mm_loadu_ps(b + 8);
+		AOS_TO_SOA(_mm_shuffle_ps, m0, m1, m2, bx, by, bz);
+		x = _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by));
+		y = _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz));
+		z = _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+		SOA_TO_AOS(_mm_shuffle_ps, _mm_unpacklo_ps, _mm_unpackhi_ps,
+			   x, y, z, m0, m1, m2);
+		_mm_storeu_ps(r, m0);
+		_mm_storeu_ps(r + 4, m1);
+		_mm_storeu_ps(r + 8, m2);
+	}
+	cross_scalar(r, a, b, n - i);
+}
+
+/*
+ * Min/max over the flat float stream, four triples per step.  Lane j of
+ * register k then only ever sees component (4 * k + j) % 3, which is
+ * folded back into xyz at the end.
+ */
+SSE static void bounds_sse(vector min, vector max, const float *v, int n)
+{
+	float lo[12], hi[12];
+	__m128 lo0, lo1, lo2, hi0, hi1, hi2;
+	int i, j;
+
+	lo0 = lo1 = lo2 = _mm_set1_ps(INFINITY);
+	hi0 = hi1 = hi2 = _mm_set1_ps(-INFINITY);
+	for (i = 0; i + 4 <= n; i += 4, v += 12) {
+		__m128 m0 = _mm_loadu_ps(v), m1 = _mm_loadu_ps(v + 4);
+		__m128 m2 = _mm_loadu_ps(v + 8);
+
+		lo0 = _mm_min_ps(lo0, m0);
+		lo1 = _mm_min_ps(lo1, m1);
+		lo2 = _mm_min_ps(lo2, m2);
+		hi0 = _mm_max_ps(hi0, m0);
+		hi1 = _mm_max_ps(hi1, m1);
+		hi2 = _mm_max_ps(hi2, m2);
+	}
+	_mm_storeu_ps(lo, lo0);
+	_mm_storeu_ps(lo + 4, lo1);
+	_mm_storeu_ps(lo + 8, lo2);
+	_mm_storeu_ps(hi, hi0);
+	_mm_storeu_ps(hi + 4, hi1);
+	_mm_storeu_ps(hi + 8, hi2);
+	for (j = 0; j < 12; j += 3) {
+		vec_min(min, min, lo + j);
+		vec_max(max, max, hi + j);
+	}
+	bounds_scalar(min, max, v, n - i);
+}
+
+SSE static void axpy_sse(float *y, float a, const float *x, int n)
+{
+	__m128 f = _mm_set1_ps(a);
+	int i;
+
+	n *= 3;
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i),
+				     _mm_mul_ps(f, _mm_loadu_ps(x + i))));
+	for (; i < n; i++)
+		y[i] += a * x[i];
+}
+
+static const struct vec_kernels kernels_sse = {
+	transform_sse,
+	normalize_sse,
+	cross_sse,
+	bounds_sse,
+	axpy_sse,
+};
+
+/* Triples 0-3 in the low lanes and 4-7 in the high lanes */
+#define avx_load3(p, m0, m1, m2) do {					\
+	m0 = _mm256_loadu2_m128((p) + 12, (p));				\
+	m1 = _mm256_loadu2_m128((p) + 16, (p) + 4);			\
+	m2 = _mm256_loadu2_m128((p) + 20, (p) + 8);			\
+} while (0)
+
+#define avx_store3(p, m0, m1, m2) do {					\
+	_mm256_storeu2_m128((p) + 12, (p), m0);				\
+	_mm256_storeu2_m128((p) + 16, (p) + 4, m1);			\
+	_mm256_storeu2_m128((p) + 20, (p) + 8, m2);			\
+} while (0)
+
+AVX static void transform_avx(float *r, const matrix a, const float *v, int n, int w)
+{
+	__m256 c0 = _mm256_broadcast_ps((const __m128 *) a);
+	__m256 c1 = _mm256_broadcast_ps((const __m128 *) (a + 4));
+	__m256 c2 = _mm256_broadcast_ps((const __m128 *) (a + 8));
+	__m256 c3 = _mm256_broadcast_ps((const __m128 *) (a + 12));
+	int i;
+
+	for (i = 0; i + 2 <= n; i += 2, r += 6, v += 6) {
+		__m256 p;
+		__m128 lo, hi;
+
+		p = _mm256_mul_ps(c0, _mm256_set_m128(_mm_set1_ps(v[3]), _mm_set1_ps(v[0])));
+		p = _mm256_add_ps(p, _mm256_mul_ps(c1, _mm256_set_m128(_mm_set1_ps(v[4]),
+								       _mm_set1_ps(v[1]))));
+		p = _mm256_add_ps(p, _mm256_mul_ps(c2, _mm256_set_m128(_mm_set1_ps(v[5]),
+								       _mm_set1_ps(v[2]))));
+		if (w)
+			p = _mm256_add_ps(p, c3);
+		lo = _mm256_castps256_ps128(p);
+		hi = _mm256_extractf128_ps(p, 1);
+		_mm_storel_pi((__m64 *) r, lo);
+		_mm_store_ss(r + 2, _mm_movehl_ps(lo, lo));
+		_mm_storel_pi((__m64 *) (r + 3), hi);
+		_mm_store_ss(r + 5, _mm_movehl_ps(hi, hi));
+	}
+	transform_scalar(r, a, v, n - i, w);
+}
+
+AVX static void normalize_avx(float *r, const float *v, int n)
+{
+	__m256 one = _mm256_set1_ps(1.0f);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8, r += 24, v += 24) {
+		__m256 m0, m1, m2, x, y, z, d;
+
+		avx_load3(v, m0, m1, m2);
+		AOS_TO_SOA(_mm256_shuffle_ps, m0, m1, m2, x, y, z);
+		d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)),
+				  _mm256_mul_ps(z, z));
+		d = _mm256_div_ps(one, _mm256_sqrt_ps(d));
+		x = _mm256_mul_ps(x, d);
+		y = _mm256_mul_ps(y, d);
+		z = _mm256_mul_ps(z, d);
+		SOA_TO_AOS(_mm256_shuffle_ps, _mm256_unpacklo_ps, _mm256_unpackhi_ps,
+			   x, y, z, m0, m1, m2);
+		avx_store3(r, m0, m1, m2);
+	}
+	normalize_sse(r, v, n - i);
+}
+
+AVX static void cross_avx(float *r, const float *a, const float *b, int n)
+{
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8, r += 24, a += 24, b += 24) {
+		__m256 m0, m1, m2, ax, ay, az, bx, by, bz, x, y, z;
+
+		avx_load3(a, m0, m1, m2);
+		AOS_TO_SOA(_mm256_shuffle_ps, m0, m1, m2, ax, ay, az);
+		avx_load3(b, m0, m1, m2);
+		AOS_TO_SOA(_mm256_shuffle_ps, m0, m1, m2, bx, by, bz);
+		x = _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(az, by));
+		y = _mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(ax, bz));
+		z = _mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(ay, bx));
+		SOA_TO_AOS(_mm256_shuffle_ps, _mm256_unpacklo_ps, _mm256_unpackhi_ps,
+			   x, y, z, m0, m1, m2);
+		avx_store3(r, m0, m1, m2);
+	}
+	cross_sse(r, a, b, n - i);
+}
+
+/* As bounds_sse(), the lanes of each register repeat with period 24 */
+AVX static void bounds_avx(vector min, vector max, const float *v, int n)
+{
+	float lo[24], hi[24];
+	__m256 lo0, lo1, lo2, hi0, hi1, hi2;
+	int i, j;
+
+	lo0 = lo1 = lo2 = _mm256_set1_ps(INFINITY);
+	hi0 = hi1 = hi2 = _mm256_set1_ps(-INFINITY);
+	for (i = 0; i + 8 <= n; i += 8, v += 24) {
+		__m256 m0 = _mm256_loadu_ps(v), m1 = _mm256_loadu_ps(v + 8);
+		__m256 m2 = _mm256_loadu_ps(v + 16);
+
+		lo0 = _mm256_min_ps(lo0, m0);
+		lo1 = _mm256_min_ps(lo1, m1);
+		lo2 = _mm256_min_ps(lo2, m2);
+		hi0 = _mm256_max_ps(hi0, m0);
+		hi1 = _mm256_max_ps(hi1, m1);
+		hi2 = _mm256_max_ps(hi2, m2);
+	}
+	_mm256_storeu_ps(lo, lo0);
+	_mm256_storeu_ps(lo + 8, lo1);
+	_mm256_storeu_ps(lo + 16, lo2);
+	_mm256_storeu_ps(hi, hi0);
+	_mm256_storeu_ps(hi + 8, hi1);
+	_mm256_storeu_ps(hi + 16, hi2);
+	for (j = 0; j < 24; j += 3) {
+		vec_min(min, min, lo + j);
+		vec_max(max, max, hi + j);
+	}
+	bounds_sse(min, max, v, n - i);
+}
+
+AVX static void axpy_avx(float *y, float a, const float *x, int n)
+{
+	__m256 f = _mm256_set1_ps(a);
+	int i;
+
+	for (i = 0; i + 8 <= 3 * n; i += 8)
+		_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i),
+					_mm256_mul_ps(f, _mm256_loadu_ps(x + i))));
+	for (; i < 3 * n; i++)
+		y[i] += a * x[i];
+}
+
+static const struct vec_kernels kernels_avx = {
+	transform_avx,
+	normalize_avx,
+	cross_avx,
+	bounds_avx,
+	axpy_avx,
+};
+
+static int simd_supported(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx"))
+		return MATHX_AVX;
+	if (__builtin_cpu_supports("sse2"))
+		return MATHX_SSE;
+	return MATHX_SCALAR;
+}
+
+static const struct vec_kernels *simd_kernels[] = {
+	&kernels_scalar,
+	&kernels_sse,
+	&kernels_avx,
+};
+#else
+static int simd_supported(void)
+{
+	return MATHX_SCALAR;
+}
+
+static const struct vec_kernels *simd_kernels[] = {
+	&kernels_scalar,
+};
+#endif
+
+static int simd_level = -1;
+static const struct vec_kernels *kern = &kernels_scalar;
+
+__attribute__((constructor)) static void mathx_init(void)
+{
+	mathx_set_simd(MATHX_AVX);
+}
+
+int mathx_simd(void)
+{
+	return simd_level;
+}
+
+int mathx_set_simd(int level)
+{
+	int max = simd_supported();
+
+	simd_level = level < MATHX_SCALAR ? MATHX_SCALAR : level > max ? max : level;
+	kern = simd_kernels[simd_level];
+	return simd_level;
+}
+
+const char *mathx_simd_name(int level)
+{
+	static const char *names[] = { "scalar", "sse", "avx" };
+
+	return level >= MATHX_SCALAR && level <= MATHX_AVX ? names[level] : "?";
+}
+
+void vec_transform_points(float *r, const matrix m, const float *v, int n)
+{
+	kern->transform(r, m, v, n, 1);
+}
+
+void vec_transform_vectors(float *r, const matrix m, const float *v, int n)
+{
+	kern->transform(r, m, v, n, 0);
+}
+
+void vec_normalize_n(float *r, const float *v, int n)
+{
+	kern->normalize(r, v, n);
+}
+
+void vec_cross_n(float *r, const float *a, const float *b, int n)
+{
+	kern->cross(r, a, b, n);
+}
+
+void vec_bounds_n(vector min, vector max, const float *v, int n)
+{
+	vec_set(min, INFINITY, INFINITY, INFINITY);
+	vec_neg(max, min);
+	kern->bounds(min, max, v, n);
+}
+
+void vec_axpy_n(float *y, float a, const float *x, int n)
+{
+	kern->axpy(y, a, x, n);
+}
@@ -163,6 +163,39 @@ static inline void vec_to_spherical(const vector r, float *phi, float *theta)
 		*phi += 2.0f * PI;
 }
 
+/* In place vec_*() on n floats, same operations in the same order */
+static inline void vals_zero(float *r, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		r[i] = 0.0f;
+}
+
+static inline void vals_add(float *r, const float *a, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		r[i] = r[i] + a[i];
+}
+
+static inline void vals_mul(float *r, float f, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		r[i] = f * r[i];
+}
+
+static inline void vals_mad(float *r, float f, const float *a, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		r[i] += f * a[i];
+}
+
 /* Matrix operations */
 typedef float matrix[16];
 
@@ -205,4 +238,36 @@ void mat_frustum(matrix r, float left, float right, float bot, float top, float
 void mat_ortho(matrix r, float left, float right, float bot, float top, float near, float far);
 void mat_persp(matrix r, float fovy, float aspect, float near, float far);
 
+/*
+ * Batched kernels over n packed xyz triples.  Each has a scalar, SSE and
+ * AVX implementation picked at startup from what the CPU supports;
+ * mathx_set_simd() overrides the choice (clamped to what is available)
+ * and returns the level in use.  All levels give bit identical results.
+ * In-place operation (r == v) is allowed.
+ */
+enum {
+	MATHX_SCALAR,
+	MATHX_SSE,
+	MATHX_AVX,
+};
+
+int mathx_simd(void);
+int mathx_set_simd(int level);
+const char *mathx_simd_name(int level);
+
+void vec_transform_points(float *r, const matrix m, const float *v, int n);
+void vec_transform_vectors(float *r, const matrix m, const float *v, int n);
+void vec_normalize_n(float *r, const float *v, int n);
+void vec_cross_n(float *r, const float *a, const float *b, int n);
+void vec_bounds_n(vector min, vector max, const float *v, int n);
+void vec_axpy_n(float *y, float a, const float *x, int n);
+
+/*
+ * The six clip planes (a, b, c, d with a*x + b*y + c*z + d >= 0 inside) of
+ * the view volume of m.  frustum_cull_box() is non-zero when the box lies
+ * entirely outside one of them.
+ */
+void mat_frustum_planes(float *planes, const matrix m);
+int frustum_cull_box(const float *planes, const vector min, const vector max);
+
 #endif
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include "memstats.h"
+
+static __thread struct mem_stats own_stats;
+static __thread struct mem_stats *cur_stats;
+static __thread int cur_tag;
+
+static const char *tag_names[MEM_NR_TAGS] = {
+	"other",
+	"mesh",
+	"sd_mesh",
+	"obj",
+	"bvh",
+};
+
+/* Attached accounts are shared between threads, hence the atomics */
+static void mem_update(struct mem_usage *u, long old_size, long new_size)
+{
+	long cur, peak;
+
+	if (!old_size)
+		__atomic_add_fetch(&u->allocs, 1, __ATOMIC_RELAXED);
+	else if (!new_size)
+		__atomic_add_fetch(&u->frees, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_add_fetch(&u->reallocs, 1, __ATOMIC_RELAXED);
+	if (old_size && new_size)
+		__atomic_add_fetch(&u->copied, old_size < new_size ?
+				   old_size : new_size, __ATOMIC_RELAXED);
+
+	cur = __atomic_add_fetch(&u->cur, new_size - old_size, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&u->peak, __ATOMIC_RELAXED);
+	while (cur > peak &&
+	       !__atomic_compare_exchange_n(&u->peak, &peak, cur, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+struct mem_stats *mem_account_(void)
+{
+	return cur_stats ? cur_stats : &own_stats;
+}
+
+void mem_charge_(int tag, long old_size, long new_size)
+{
+	struct mem_stats *st = mem_account_();
+
+	mem_update(&st->total, old_size, new_size);
+	mem_update(&st->tag[tag], old_size, new_size);
+}
+
+const struct mem_stats *mem_stats_get(void)
+{
+	return mem_account_();
+}
+
+void mem_stats_reset(void)
+{
+	memset(mem_account_(), 0, sizeof(struct mem_stats));
+}
+
+const char *mem_tag_name(int tag)
+{
+	return tag >= 0 && tag < MEM_NR_TAGS ? tag_names[tag] : "unknown";
+}
+
+struct mem_stats *mem_stats_attach(struct mem_stats *st)
+{
+	struct mem_stats *prev = mem_account_();
+
+	cur_stats = st;
+	return prev;
+}
+
+int mem_tag_(void)
+{
+	return cur_tag;
+}
+
+int mem_set_tag_(int tag)
+{
+	int prev = cur_tag;
+
+	cur_tag = tag;
+	return prev;
+}
+
+/* Only the outermost library call picks the tag */
+int mem_enter_(int tag)
+{
+	int prev = cur_tag;
+
+	if (cur_tag == MEM_OTHER)
+		cur_tag = tag;
+	return prev;
+}
+
+/* Keeps malloc() alignment */
+struct mem_hdr {
+	size_t size;
+	int tag;
+} __attribute__((aligned(16)));
+
+void *mem_alloc(size_t size)
+{
+	struct mem_hdr *hdr;
+
+	if (!(hdr = malloc(sizeof(*hdr) + size)))
+		return NULL;
+	hdr->size = sizeof(*hdr) + size;
+	hdr->tag = cur_tag;
+	mem_charge_(hdr->tag, 0, hdr->size);
+	return hdr + 1;
+}
+
+void mem_free(void *ptr)
+{
+	struct mem_hdr *hdr;
+
+	if (!ptr)
+		return;
+	hdr = (struct mem_hdr *) ptr - 1;
+	mem_charge_(hdr->tag, hdr->size, 0);
+	free(hdr);
+}
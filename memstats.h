@@ -0,0 +1,68 @@
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include <stddef.h>
+
+/*
+ * Heap accounting for the library.  Every buffer growth and free, and the
+ * library's own fixed size allocations, are charged to the subsystem of
+ * the outermost library call that made them: the buffers of a mesh built
+ * by obj_read() count under MEM_OBJ, the same mesh built by hand under
+ * MEM_MESH, the output of subdivide() under MEM_SD and picking trees under
+ * MEM_BVH.  Anything else is MEM_OTHER.
+ *
+ * Each thread has its own account.  cur and peak count from the last
+ * mem_stats_reset(), so cur drops below zero when older blocks are freed
+ * and peak is the most a call has held on top of what came before.  Pool
+ * tasks the library starts on behalf of a call charge the caller's
+ * account.
+ */
+enum {
+	MEM_OTHER,
+	MEM_MESH,
+	MEM_SD,
+	MEM_OBJ,
+	MEM_BVH,
+	MEM_NR_TAGS
+};
+
+struct mem_usage {
+	long cur;		/* Bytes held */
+	long peak;		/* Highest cur */
+	long allocs;		/* New blocks */
+	long reallocs;		/* Resized blocks */
+	long frees;
+	long copied;		/* Bytes the resizes may have had to move */
+};
+
+struct mem_stats {
+	struct mem_usage total;
+	struct mem_usage tag[MEM_NR_TAGS];
+};
+
+const struct mem_stats *mem_stats_get(void);
+void mem_stats_reset(void);
+const char *mem_tag_name(int tag);
+
+/*
+ * Charges the calling thread's allocations to another account, NULL for
+ * its own, and returns the previous one.  For work handed to other
+ * threads.
+ */
+struct mem_stats *mem_stats_attach(struct mem_stats *st);
+
+/* Private */
+struct mem_stats *mem_account_(void);
+int mem_tag_(void);
+int mem_set_tag_(int tag);
+int mem_enter_(int tag);
+void mem_charge_(int tag, long old_size, long new_size);
+
+#define mem_enter(tag)		int mem_prev_tag_ = mem_enter_(tag)
+#define mem_leave()		mem_set_tag_(mem_prev_tag_)
+
+/* malloc() and free() charged to the current tag */
+void *mem_alloc(size_t size);
+void mem_free(void *ptr);
+
+#endif
@@ -1,66 +1,128 @@
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "buf.h"
 #include "mathx.h"
+#include "memstats.h"
 #include "mesh.h"
+#include "stats.h"
+#include "util.h"
 
-struct idx {
-	int vi, ni;
+/*
+ * Face corners index the vertex buffer through vi.  In separate mode ni
+ * holds a normal index per corner; in shared mode ni is NULL and normals
+ * are indexed by vi, which halves the index memory of every mesh whose
+ * normals are per vertex.
+ */
+struct mesh_channel {
+	int kind;
+	int width;
+	float *vals;
+	int *idx;		/* Per corner, face varying channels only */
 };
 
 struct mesh {
 	float *vbuf;
 	float *nbuf;
-	struct idx *ibuf;
+	int *vi;
+	int *ni;
 	int *faces;
+	int shared;
+	struct mesh_channel *channels;
 };
 
-struct mesh *mesh_create(void)
+/* Every buffer but ni is created here, so it is charged to this call */
+static struct mesh *mesh_alloc(int shared)
 {
-	struct mesh *mesh = malloc(sizeof(*mesh));
+	struct mesh *mesh;
+	mem_enter(MEM_MESH);
+
+	mesh = mem_alloc(sizeof(*mesh));
 	mesh->vbuf = NULL;
 	mesh->nbuf = NULL;
-	mesh->ibuf = NULL;
+	buf_init_simd(mesh->vbuf);
+	buf_init_simd(mesh->nbuf);
+	mesh->vi = NULL;
+	mesh->ni = NULL;
 	mesh->faces = NULL;
+	buf_init(mesh->vi, NULL, 0);
+	buf_init(mesh->faces, NULL, 0);
+	mesh->shared = shared;
+	mesh->channels = NULL;
+	mem_leave();
 	return mesh;
 }
 
+struct mesh *mesh_create(void)
+{
+	return mesh_alloc(0);
+}
+
+struct mesh *mesh_create_shared(void)
+{
+	return mesh_alloc(1);
+}
+
 void mesh_free(struct mesh *mesh)
 {
+	struct mesh_channel *ch;
+
 	if (!mesh)
 		return;
+	buf_foreach(ch, mesh->channels) {
+		buf_free(ch->vals);
+		buf_free(ch->idx);
+	}
+	buf_free(mesh->channels);
 	buf_free(mesh->vbuf);
 	buf_free(mesh->nbuf);
-	buf_free(mesh->ibuf);
+	buf_free(mesh->vi);
+	buf_free(mesh->ni);
 	buf_free(mesh->faces);
-	free(mesh);
+	mem_free(mesh);
 }
 
 void mesh_add_vertex(struct mesh *mesh, const float *v)
 {
-	buf_push(mesh->vbuf, v[0]);
-	buf_push(mesh->vbuf, v[1]);
-	buf_push(mesh->vbuf, v[2]);
+	buf_append(mesh->vbuf, v, 3);
+}
+
+void mesh_set_vertex(struct mesh *mesh, int vi, const float *v)
+{
+	memcpy(mesh->vbuf + 3 * vi, v, 3 * sizeof(*mesh->vbuf));
 }
 
 void mesh_add_normal(struct mesh *mesh, const float *n)
 {
-	buf_push(mesh->nbuf, n[0]);
-	buf_push(mesh->nbuf, n[1]);
-	buf_push(mesh->nbuf, n[2]);
+	buf_append(mesh->nbuf, n, 3);
 }
 
 void mesh_begin_face(struct mesh *mesh)
 {
-	buf_push(mesh->faces, buf_len(mesh->ibuf));
+	buf_push(mesh->faces, buf_len(mesh->vi));
+}
+
+/* Falls back to separate mode, giving existing corners their shared index */
+static void mesh_unshare_indices(struct mesh *mesh)
+{
+	int i, has_normals = buf_len(mesh->nbuf) > 0;
+	mem_enter(MEM_MESH);
+
+	buf_resize(mesh->ni, buf_len(mesh->vi));
+	for (i = 0; i < buf_len(mesh->vi); i++)
+		mesh->ni[i] = has_normals ? mesh->vi[i] : -1;
+	mesh->shared = 0;
+	mem_leave();
 }
 
 void mesh_add_index(struct mesh *mesh, int vi, int ni)
 {
-	struct idx idx;
-	idx.vi = vi;
-	idx.ni = ni;
-	buf_push(mesh->ibuf, idx);
+	if (mesh->shared && ni != vi && ni != -1)
+		mesh_unshare_indices(mesh);
+	buf_push(mesh->vi, vi);
+	if (!mesh->shared)
+		buf_push(mesh->ni, ni);
 }
 
 void mesh_end_face(struct mesh *mesh)
@@ -68,6 +130,134 @@ void mesh_end_face(struct mesh *mesh)
 	/* noop */
 }
 
+int mesh_reserve(struct mesh *mesh, int nr_vertices, int nr_faces,
+		 int nr_corners)
+{
+	struct mesh_channel *ch;
+	int err;
+	mem_enter(MEM_MESH);
+
+	err = buf_try_reserve(mesh->vbuf, 3 * (size_t) nr_vertices) ||
+	      buf_try_reserve(mesh->faces, nr_faces) ||
+	      buf_try_reserve(mesh->vi, nr_corners) ||
+	      (!mesh->shared && buf_try_reserve(mesh->ni, nr_corners));
+	buf_foreach(ch, mesh->channels) {
+		int n = ch->kind == MESH_FACE_VARYING ? nr_corners : nr_vertices;
+
+		err = err || buf_try_reserve(ch->vals, (size_t) n * ch->width) ||
+		      (ch->idx && buf_try_reserve(ch->idx, nr_corners));
+	}
+	mem_leave();
+	return err ? -1 : 0;
+}
+
+int mesh_share_indices(struct mesh *mesh)
+{
+	int i;
+
+	if (mesh->shared)
+		return 0;
+	for (i = 0; i < buf_len(mesh->vi); i++)
+		if (mesh->ni[i] != mesh->vi[i])
+			return -1;
+	buf_free(mesh->ni);
+	mesh->ni = NULL;
+	mesh->shared = 1;
+	return 0;
+}
+
+int mesh_has_shared_indices(const struct mesh *mesh)
+{
+	return mesh->shared;
+}
+
+int mesh_add_channel(struct mesh *mesh, int kind, int width)
+{
+	struct mesh_channel ch;
+	mem_enter(MEM_MESH);
+
+	ch.kind = kind;
+	ch.width = width;
+	ch.vals = NULL;
+	ch.idx = NULL;
+	buf_init(ch.vals, NULL, 0);
+	if (kind == MESH_FACE_VARYING) {
+		/* Corners added so far have no value */
+		buf_init(ch.idx, NULL, 0);
+		buf_resize(ch.idx, buf_len(mesh->vi));
+		memset(ch.idx, -1, buf_len(ch.idx) * sizeof(*ch.idx));
+	}
+	buf_push(mesh->channels, ch);
+	mem_leave();
+	return buf_len(mesh->channels) - 1;
+}
+
+void mesh_add_channel_value(struct mesh *mesh, int ch, const float *v)
+{
+	struct mesh_channel *c = &mesh->channels[ch];
+
+	buf_append(c->vals, v, c->width);
+}
+
+void mesh_add_channel_index(struct mesh *mesh, int ch, int idx)
+{
+	struct mesh_channel *c = &mesh->channels[ch];
+	int n = buf_len(mesh->vi);
+
+	if (!n)
+		return;
+	/* Corners skipped since the last call read -1 */
+	while (buf_len(c->idx) < n - 1)
+		buf_push(c->idx, -1);
+	if (buf_len(c->idx) < n)
+		buf_push(c->idx, idx);
+	else
+		c->idx[n - 1] = idx;
+}
+
+int mesh_channel_count(const struct mesh *mesh)
+{
+	return buf_len(mesh->channels);
+}
+
+int mesh_channel_kind(const struct mesh *mesh, int ch)
+{
+	return mesh->channels[ch].kind;
+}
+
+int mesh_channel_width(const struct mesh *mesh, int ch)
+{
+	return mesh->channels[ch].width;
+}
+
+int mesh_channel_buffer(const struct mesh *mesh, int ch, const float **buf)
+{
+	const struct mesh_channel *c = &mesh->channels[ch];
+
+	if (buf)
+		*buf = c->vals;
+	return buf_len(c->vals) / c->width;
+}
+
+int mesh_channel_index(const struct mesh *mesh, int ch, int face, int vert)
+{
+	const struct mesh_channel *c = &mesh->channels[ch];
+	int corner = mesh->faces[face] + vert;
+
+	if (c->kind == MESH_VERTEX_VARYING)
+		return mesh->vi[corner];
+	return corner < buf_len(c->idx) ? c->idx[corner] : -1;
+}
+
+float *mesh_get_channel(const struct mesh *mesh, int ch, int face, int vert)
+{
+	const struct mesh_channel *c = &mesh->channels[ch];
+	int i = mesh_channel_index(mesh, ch, face, vert);
+
+	return i >= 0 && i < buf_len(c->vals) / c->width ?
+	       &c->vals[i * c->width] : NULL;
+}
+
 int mesh_vertex_buffer(const struct mesh *mesh, const float **buf)
 {
 	if (buf)
@@ -93,48 +283,464 @@ int mesh_face_vertex_count(const struct mesh *mesh, int face)
 
 	beg = mesh->faces[face];
 	end = face != buf_len(mesh->faces) - 1 ?
-		mesh->faces[face + 1] : buf_len(mesh->ibuf);
+		mesh->faces[face + 1] : buf_len(mesh->vi);
 	return end - beg;
 }
 
+static inline int mesh_normal_index(const struct mesh *mesh, int corner)
+{
+	if (mesh->shared)
+		return buf_len(mesh->nbuf) ? mesh->vi[corner] : -1;
+	return mesh->ni[corner];
+}
+
 void mesh_face_vertex_index(const struct mesh *mesh, int face, int vert,
 			    int *vertex_idx, int *normal_idx)
 {
-	int beg;
-	struct idx *idx;
+	int corner = mesh->faces[face] + vert;
 
-	beg = mesh->faces[face];
-	idx = &mesh->ibuf[beg + vert];
-	*vertex_idx = idx->vi;
-	*normal_idx = idx->ni;
+	*vertex_idx = mesh->vi[corner];
+	*normal_idx = mesh_normal_index(mesh, corner);
 }
 
 float *mesh_get_vertex(const struct mesh *mesh, int face, int vert)
 {
-	int vi, ni;
-
-	mesh_face_vertex_index(mesh, face, vert, &vi, &ni);
-	return &mesh->vbuf[vi * 3];
+	return &mesh->vbuf[mesh->vi[mesh->faces[face] + vert] * 3];
 }
 
 float *mesh_get_normal(const struct mesh *mesh, int face, int vert)
 {
-	int vi, ni;
+	int ni = mesh_normal_index(mesh, mesh->faces[face] + vert);
 
-	mesh_face_vertex_index(mesh, face, vert, &vi, &ni);
 	return ni != -1 ? &mesh->nbuf[ni * 3] : NULL;
 }
 
+/*
+ * A mesh image is this header, the channel table and then every array at
+ * a MESH_IMAGE_ALIGN aligned byte offset from the start, 0 for an empty
+ * one.  Face varying indices are padded with -1 to one per corner.
+ */
+#define MESH_IMAGE_MAGIC	0x4853454d	/* "MESH" */
+#define MESH_IMAGE_VERSION	1
+#define MESH_IMAGE_ALIGN	64
+
+struct mesh_image_channel {
+	int32_t kind;
+	int32_t width;
+	int32_t nr_vals;
+	int32_t pad;
+	uint64_t vals;
+	uint64_t idx;
+};
+
+struct mesh_image {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	int32_t nr_vertices;
+	int32_t nr_normals;
+	int32_t nr_faces;
+	int32_t nr_corners;
+	int32_t nr_channels;
+	int32_t shared;
+	uint64_t vbuf;
+	uint64_t nbuf;
+	uint64_t faces;
+	uint64_t vi;
+	uint64_t ni;
+	struct mesh_image_channel channels[];
+};
+
+static uint64_t mesh_image_array(size_t *off, size_t bytes)
+{
+	uint64_t at;
+
+	if (!bytes)
+		return 0;
+	at = (*off + MESH_IMAGE_ALIGN - 1) & ~(size_t) (MESH_IMAGE_ALIGN - 1);
+	*off = at + bytes;
+	return at;
+}
+
+/* Fills in the header of img, when not NULL, and returns the image size */
+static size_t mesh_image_layout(const struct mesh *mesh, struct mesh_image *img)
+{
+	struct mesh_image hdr, *h = img ? img : &hdr;
+	struct mesh_image_channel *c;
+	int i, nr_corners = buf_len(mesh->vi);
+	size_t off;
+
+	h->magic = MESH_IMAGE_MAGIC;
+	h->version = MESH_IMAGE_VERSION;
+	h->nr_vertices = buf_len(mesh->vbuf) / 3;
+	h->nr_normals = buf_len(mesh->nbuf) / 3;
+	h->nr_faces = buf_len(mesh->faces);
+	h->nr_corners = nr_corners;
+	h->nr_channels = buf_len(mesh->channels);
+	h->shared = mesh->shared;
+
+	off = sizeof(*h) + h->nr_channels * sizeof(*c);
+	h->vbuf = mesh_image_array(&off, 3 * h->nr_vertices * sizeof(float));
+	h->nbuf = mesh_image_array(&off, 3 * h->nr_normals * sizeof(float));
+	h->faces = mesh_image_array(&off, h->nr_faces * sizeof(int));
+	h->vi = mesh_image_array(&off, nr_corners * sizeof(int));
+	h->ni = mesh->shared ? 0 : mesh_image_array(&off, nr_corners * sizeof(int));
+	for (i = 0; i < h->nr_channels; i++) {
+		const struct mesh_channel *ch = &mesh->channels[i];
+		struct mesh_image_channel tmp;
+
+		c = img ? &img->channels[i] : &tmp;
+		c->kind = ch->kind;
+		c->width = ch->width;
+		c->nr_vals = buf_len(ch->vals) / ch->width;
+		c->pad = 0;
+		c->vals = mesh_image_array(&off, c->nr_vals * ch->width * sizeof(float));
+		c->idx = ch->kind != MESH_FACE_VARYING ? 0 :
+			 mesh_image_array(&off, nr_corners * sizeof(int));
+	}
+	h->size = off;
+	return off;
+}
+
+size_t mesh_pack_size(const struct mesh *mesh)
+{
+	return mesh_image_layout(mesh, NULL);
+}
+
+/* Also zeroes the alignment gap before off, so equal meshes pack equal */
+static void mesh_image_copy(char *image, size_t *end, uint64_t off,
+			    const void *src, size_t bytes)
+{
+	if (!off)
+		return;
+	memset(image + *end, 0, off - *end);
+	if (bytes)
+		memcpy(image + off, src, bytes);
+	*end = off + bytes;
+}
+
+int mesh_pack(const struct mesh *mesh, void *image)
+{
+	struct mesh_image *img = image;
+	size_t end;
+	int i, n;
+
+	/* Indices past the last corner have nowhere to go */
+	for (i = 0; i < buf_len(mesh->channels); i++)
+		if (buf_len(mesh->channels[i].idx) > buf_len(mesh->vi))
+			return -1;
+	mesh_image_layout(mesh, img);
+	n = img->nr_corners;
+	end = sizeof(*img) + img->nr_channels * sizeof(img->channels[0]);
+	mesh_image_copy(image, &end, img->vbuf, mesh->vbuf,
+			buf_len(mesh->vbuf) * sizeof(float));
+	mesh_image_copy(image, &end, img->nbuf, mesh->nbuf,
+			buf_len(mesh->nbuf) * sizeof(float));
+	mesh_image_copy(image, &end, img->faces, mesh->faces,
+			buf_len(mesh->faces) * sizeof(int));
+	mesh_image_copy(image, &end, img->vi, mesh->vi, n * sizeof(int));
+	mesh_image_copy(image, &end, img->ni, mesh->ni,
+			img->ni ? n * sizeof(int) : 0);
+	for (i = 0; i < img->nr_channels; i++) {
+		const struct mesh_channel *ch = &mesh->channels[i];
+		struct mesh_image_channel *c = &img->channels[i];
+		int *idx = (int *) ((char *) image + c->idx);
+
+		mesh_image_copy(image, &end, c->vals, ch->vals,
+				buf_len(ch->vals) * sizeof(float));
+		if (!c->idx)
+			continue;
+		mesh_image_copy(image, &end, c->idx, ch->idx,
+				buf_len(ch->idx) * sizeof(int));
+		memset(idx + buf_len(ch->idx), -1,
+		       (n - buf_len(ch->idx)) * sizeof(int));
+		end = c->idx + n * sizeof(int);
+	}
+	return 0;
+}
+
+/* Points *p at count elements of size bytes at off, if they fit in the image */
+static int mesh_image_get(const void *image, size_t size, uint64_t off,
+			  int count, size_t elem, const void **p)
+{
+	*p = NULL;
+	if (count < 0)
+		return -1;
+	if (!count)
+		return 0;
+	if (!off || off % sizeof(int) || off > size ||
+	    count * elem > size - off)
+		return -1;
+	*p = (const char *) image + off;
+	return 0;
+}
+
+static int mesh_image_check_index(const int *idx, int n, int lo, int hi)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (idx[i] < lo || idx[i] >= hi)
+			return -1;
+	return 0;
+}
+
+/* Checks a copy of channel ch's entry against an image of size bytes */
+static int mesh_image_channel(const void *image, size_t size, int nr_corners,
+			      int ch, struct mesh_view_channel *c)
+{
+	const struct mesh_image *img = image;
+	struct mesh_image_channel ic;
+
+	memcpy(&ic, &img->channels[ch], sizeof(ic));
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	c->kind = ic.kind;
+	c->width = ic.width;
+	c->nr_vals = ic.nr_vals;
+	if ((ic.kind != MESH_VERTEX_VARYING && ic.kind != MESH_FACE_VARYING) ||
+	    ic.width <= 0 || ic.nr_vals < 0 ||
+	    ic.nr_vals > size / sizeof(float) / ic.width ||
+	    mesh_image_get(image, size, ic.vals, ic.nr_vals * ic.width,
+			   sizeof(float), (const void **) &c->vals))
+		return -1;
+	if (ic.kind == MESH_VERTEX_VARYING) {
+		c->idx = NULL;
+		return ic.idx ? -1 : 0;
+	}
+	return mesh_image_get(image, size, ic.idx, nr_corners, sizeof(int),
+			      (const void **) &c->idx);
+}
+
+/*
+ * The header is copied once and only the copy is checked and used, so a
+ * writer refilling a shared image cannot move the counts past the checks.
+ */
+int mesh_view(const void *image, size_t size, struct mesh_view *view)
+{
+	struct mesh_image img;
+	struct mesh_view_channel c;
+	int i, nr_normals;
+
+	if (size < sizeof(img))
+		return -1;
+	memcpy(&img, image, sizeof(img));
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	if (img.magic != MESH_IMAGE_MAGIC || img.version != MESH_IMAGE_VERSION ||
+	    img.size > size)
+		return -1;
+	size = img.size;
+	if (img.nr_channels < 0 || img.nr_corners < 0 ||
+	    img.nr_channels > (size - sizeof(img)) / sizeof(img.channels[0]))
+		return -1;
+
+	view->nr_vertices = img.nr_vertices;
+	view->nr_normals = img.nr_normals;
+	view->nr_faces = img.nr_faces;
+	view->nr_corners = img.nr_corners;
+	view->nr_channels = img.nr_channels;
+	view->shared = !!img.shared;
+	view->size = size;
+	view->image = image;
+	if (mesh_image_get(image, size, img.vbuf, img.nr_vertices,
+			   3 * sizeof(float), (const void **) &view->vbuf) ||
+	    mesh_image_get(image, size, img.nbuf, img.nr_normals,
+			   3 * sizeof(float), (const void **) &view->nbuf) ||
+	    mesh_image_get(image, size, img.faces, img.nr_faces,
+			   sizeof(int), (const void **) &view->faces) ||
+	    mesh_image_get(image, size, img.vi, img.nr_corners,
+			   sizeof(int), (const void **) &view->vi) ||
+	    mesh_image_get(image, size, img.ni, img.shared ? 0 : img.nr_corners,
+			   sizeof(int), (const void **) &view->ni))
+		return -1;
+
+	/* Faces start at 0 and never go back, so every count is >= 0 */
+	for (i = 0; i < img.nr_faces; i++)
+		if (view->faces[i] < (i ? view->faces[i - 1] : 0) ||
+		    view->faces[i] > img.nr_corners || (!i && view->faces[i]))
+			return -1;
+	if (!img.nr_faces && img.nr_corners)
+		return -1;
+
+	/* A shared mesh with normals reads them through vi */
+	nr_normals = img.shared && img.nr_normals ? img.nr_normals : INT_MAX;
+	if (mesh_image_check_index(view->vi, img.nr_corners, 0,
+				   MIN(img.nr_vertices, nr_normals)) ||
+	    (view->ni && mesh_image_check_index(view->ni, img.nr_corners, -1,
+						img.nr_normals)))
+		return -1;
+
+	for (i = 0; i < img.nr_channels; i++)
+		if (mesh_image_channel(image, size, img.nr_corners, i, &c) ||
+		    (c.idx && mesh_image_check_index(c.idx, img.nr_corners, -1,
+						     c.nr_vals)))
+			return -1;
+	return 0;
+}
+
+int mesh_view_channel(const struct mesh_view *view, int ch,
+		      struct mesh_view_channel *c)
+{
+	if (ch < 0 || ch >= view->nr_channels)
+		return -1;
+	return mesh_image_channel(view->image, view->size, view->nr_corners,
+				  ch, c);
+}
+
+struct mesh *mesh_unpack(const struct mesh_view *view)
+{
+	struct mesh *mesh;
+	int i, n = view->nr_corners;
+
+	mesh = mesh_alloc(view->shared);
+	if (mesh_reserve(mesh, view->nr_vertices, view->nr_faces, n) ||
+	    (view->nr_normals &&
+	     buf_try_reserve(mesh->nbuf, 3 * (size_t) view->nr_normals))) {
+		mesh_free(mesh);
+		return NULL;
+	}
+	mem_enter(MEM_MESH);
+	if (view->nr_vertices)
+		buf_append(mesh->vbuf, view->vbuf, 3 * view->nr_vertices);
+	if (view->nr_normals)
+		buf_append(mesh->nbuf, view->nbuf, 3 * view->nr_normals);
+	if (view->nr_faces)
+		buf_append(mesh->faces, view->faces, view->nr_faces);
+	if (n) {
+		buf_append(mesh->vi, view->vi, n);
+		if (view->ni) {
+			buf_resize(mesh->ni, n);
+			memcpy(mesh->ni, view->ni, n * sizeof(*mesh->ni));
+		}
+	}
+	mem_leave();
+
+	for (i = 0; i < view->nr_channels; i++) {
+		struct mesh_view_channel c;
+		struct mesh_channel *ch;
+		int k;
+
+		if (mesh_view_channel(view, i, &c)) {
+			mesh_free(mesh);
+			return NULL;
+		}
+		k = mesh_add_channel(mesh, c.kind, c.width);
+		ch = &mesh->channels[k];
+		mem_enter(MEM_MESH);
+		if (buf_try_reserve(ch->vals, (size_t) c.nr_vals * c.width)) {
+			mem_leave();
+			mesh_free(mesh);
+			return NULL;
+		}
+		if (c.nr_vals)
+			buf_append(ch->vals, c.vals, c.nr_vals * c.width);
+		if (c.idx && n)
+			memcpy(ch->idx, c.idx, n * sizeof(int));
+		mem_leave();
+	}
+	return mesh;
+}
+
+/* FNV-1a over 64-bit words, then the trailing bytes */
+static uint64_t mesh_hash_bytes(uint64_t h, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		uint64_t w;
+
+		memcpy(&w, p + i, sizeof(w));
+		h = (h ^ w) * 0x100000001b3ull;
+	}
+	for (; i < size; i++)
+		h = (h ^ p[i]) * 0x100000001b3ull;
+	return h;
+}
+
+#define mesh_hash_buf(h, a)	mesh_hash_bytes(h, a, buf_len(a) * sizeof(*(a)))
+
+uint64_t mesh_hash(const struct mesh *mesh)
+{
+	const struct mesh_channel *ch;
+	uint64_t h = 0xcbf29ce484222325ull;
+	int counts[6];
+
+	/* The lengths keep buffers from running into each other */
+	counts[0] = buf_len(mesh->vbuf);
+	counts[1] = buf_len(mesh->nbuf);
+	counts[2] = buf_len(mesh->faces);
+	counts[3] = buf_len(mesh->vi);
+	counts[4] = buf_len(mesh->channels);
+	counts[5] = mesh->shared;
+	h = mesh_hash_bytes(h, counts, sizeof(counts));
+	h = mesh_hash_buf(h, mesh->vbuf);
+	h = mesh_hash_buf(h, mesh->nbuf);
+	h = mesh_hash_buf(h, mesh->faces);
+	h = mesh_hash_buf(h, mesh->vi);
+	h = mesh_hash_buf(h, mesh->ni);
+	buf_foreach(ch, mesh->channels) {
+		counts[0] = ch->kind;
+		counts[1] = ch->width;
+		counts[2] = buf_len(ch->vals);
+		counts[3] = buf_len(ch->idx);
+		h = mesh_hash_bytes(h, counts, 4 * sizeof(*counts));
+		h = mesh_hash_buf(h, ch->vals);
+		h = mesh_hash_buf(h, ch->idx);
+	}
+
+	/* Word at a time FNV only mixes upwards, finish with an avalanche */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+size_t mesh_size(const struct mesh *mesh)
+{
+	struct mesh_channel *ch;
+	size_t bytes;
+
+	bytes = sizeof(*mesh) +
+		buf_cap(mesh->vbuf) * sizeof(*mesh->vbuf) +
+		buf_cap(mesh->nbuf) * sizeof(*mesh->nbuf) +
+		buf_cap(mesh->vi) * sizeof(*mesh->vi) +
+		buf_cap(mesh->ni) * sizeof(*mesh->ni) +
+		buf_cap(mesh->faces) * sizeof(*mesh->faces) +
+		buf_cap(mesh->channels) * sizeof(*mesh->channels);
+	buf_foreach(ch, mesh->channels)
+		bytes += buf_cap(ch->vals) * sizeof(*ch->vals) +
+			 buf_cap(ch->idx) * sizeof(*ch->idx);
+	return bytes;
+}
+
+/* Face corners whose normals are computed per vec_*_n() call */
+#define NORMAL_BATCH	256
+
+static void mesh_add_corner_normals(float *u, const float *v, float **vn, int n)
+{
+	int i;
+
+	vec_cross_n(u, u, v, n);
+	vec_normalize_n(u, u, n);
+	for (i = 0; i < n; i++)
+		vec_add(vn[i], vn[i], u + 3 * i);
+}
+
 void mesh_compute_normals(struct mesh *mesh)
 {
-	int i, nr_faces;
-	struct idx *idx;
+	int i, k = 0, nr_faces;
+	float u[3 * NORMAL_BATCH], v[3 * NORMAL_BATCH], *vn[NORMAL_BATCH];
+	stats_timer(t);
 
 	buf_resize(mesh->nbuf, buf_len(mesh->vbuf));
 	memset(mesh->nbuf, 0, buf_len(mesh->nbuf) * sizeof(*mesh->nbuf));
 
-	buf_foreach(idx, mesh->ibuf)
-		idx->ni = idx->vi;
+	/* Normals become per vertex, so the normal indices can go */
+	buf_free(mesh->ni);
+	mesh->ni = NULL;
+	mesh->shared = 1;
 
 	nr_faces = mesh_face_count(mesh);
 	for (i = 0; i < nr_faces; i++) {
@@ -142,25 +748,24 @@ void mesh_compute_normals(struct mesh *mesh)
 
 		nr_verts = mesh_face_vertex_count(mesh, i);
 		for (j = 0; j < nr_verts; j++) {
-			vector u, v, n;
-			float *v0, *v1, *v2, *vn;
+			float *v0, *v1, *v2;
 
 			v0 = mesh_get_vertex(mesh, i, j);
 			v1 = mesh_get_vertex(mesh, i, (j + 1) % nr_verts);
 			v2 = mesh_get_vertex(mesh, i, (j + nr_verts - 1) % nr_verts);
 
-			vec_sub(u, v1, v0);
-			vec_sub(v, v2, v0);
-			vec_cross(n, u, v);
-			vec_normalize(n, n);
-
-			vn = mesh_get_normal(mesh, i, j);
-			vec_add(vn, vn, n);
+			vec_sub(u + 3 * k, v1, v0);
+			vec_sub(v + 3 * k, v2, v0);
+			vn[k] = mesh_get_normal(mesh, i, j);
+			if (++k == NORMAL_BATCH) {
+				mesh_add_corner_normals(u, v, vn, k);
+				k = 0;
+			}
 		}
 	}
+	mesh_add_corner_normals(u, v, vn, k);
 
-	for (i = 0; i < buf_len(mesh->nbuf); i += 3) {
-		float *n = mesh->nbuf + i;
-		vec_normalize(n, n);
-	}
+	vec_normalize_n(mesh->nbuf, mesh->nbuf, buf_len(mesh->nbuf) / 3);
+	stats_lap(t, normals);
+	stats_set(mesh_bytes, mesh_size(mesh));
 }
@@ -1,18 +1,64 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 /*
  * Mesh construction
+ *
+ * mesh_create() keeps a normal index per face corner.  A mesh from
+ * mesh_create_shared() indexes normals by the vertex index instead and
+ * ignores the ni of mesh_add_index() (which should be the vertex index or
+ * -1), unless a different one is added and it falls back to separate
+ * indices.  mesh_compute_normals() always leaves the mesh shared and
+ * mesh_share_indices() converts one whose corners all have ni == vi,
+ * returning -1 otherwise.
+ *
+ * mesh_reserve() makes room for that many vertices, faces and corners,
+ * with their values in the channels added so far, so adding them cannot
+ * run out of memory.  It returns -1 when the room cannot be had.
  */
 struct mesh *mesh_create(void);
+struct mesh *mesh_create_shared(void);
 void mesh_free(struct mesh *mesh);
 
 void mesh_add_vertex(struct mesh *mesh, const float *v);
+void mesh_set_vertex(struct mesh *mesh, int vi, const float *v);
 void mesh_add_normal(struct mesh *mesh, const float *n);
 void mesh_begin_face(struct mesh *mesh);
 void mesh_add_index(struct mesh *mesh, int vi, int ni);
 void mesh_end_face(struct mesh *mesh);
+int mesh_reserve(struct mesh *mesh, int nr_vertices, int nr_faces,
+		 int nr_corners);
 void mesh_compute_normals(struct mesh *mesh);
+int mesh_share_indices(struct mesh *mesh);
+int mesh_has_shared_indices(const struct mesh *mesh);
+
+/*
+ * Extra float channels such as texture coordinates or colours.  A vertex
+ * varying channel has a value per vertex and is indexed like positions.
+ * A face varying channel has its own values and an index per face corner,
+ * so corners that share a vertex can differ across a seam; each
+ * mesh_add_channel_index() gives the value of the corner most recently
+ * added with mesh_add_index(), and corners without one read -1 and NULL.
+ * mesh_add_channel() returns the channel number.
+ */
+enum {
+	MESH_VERTEX_VARYING,
+	MESH_FACE_VARYING,
+};
+
+int mesh_add_channel(struct mesh *mesh, int kind, int width);
+void mesh_add_channel_value(struct mesh *mesh, int ch, const float *v);
+void mesh_add_channel_index(struct mesh *mesh, int ch, int idx);
+
+int mesh_channel_count(const struct mesh *mesh);
+int mesh_channel_kind(const struct mesh *mesh, int ch);
+int mesh_channel_width(const struct mesh *mesh, int ch);
+int mesh_channel_buffer(const struct mesh *mesh, int ch, const float **buf);
+int mesh_channel_index(const struct mesh *mesh, int ch, int face, int vert);
+float *mesh_get_channel(const struct mesh *mesh, int ch, int face, int vert);
 
 /*
  * Vertex buffer access
@@ -31,4 +77,61 @@ void mesh_face_vertex_index(const struct mesh *mesh, int face, int vert,
 float *mesh_get_vertex(const struct mesh *mesh, int face, int vert);
 float *mesh_get_normal(const struct mesh *mesh, int face, int vert);
 
+/* Bytes held by the mesh and its buffers */
+size_t mesh_size(const struct mesh *mesh);
+
+/*
+ * Flat images
+ *
+ * mesh_pack() writes the mesh into the mesh_pack_size() bytes at image as
+ * one block with a versioned header and offsets instead of pointers, in
+ * the byte order of the machine, so it can be mapped from a file or from
+ * shared memory and read in place; it returns -1, writing nothing, for a
+ * mesh with more channel indices than corners.  mesh_view() checks an
+ * image of size bytes, every index included, and points view into it; it
+ * returns -1 when the image is not a whole mesh image of this version.
+ * Faces hold the first corner of every face and ni is NULL when normals
+ * are indexed by vi, as in a shared mesh.  mesh_view_channel() checks the
+ * channel's entry again and returns -1 when it no longer fits the image.
+ * mesh_unpack() copies a view into a mesh, or returns NULL when a channel
+ * does not fit.
+ */
+struct mesh_view_channel {
+	int kind;
+	int width;
+	int nr_vals;
+	const float *vals;
+	const int *idx;		/* Per corner, face varying channels only */
+};
+
+struct mesh_view {
+	int nr_vertices;
+	int nr_normals;
+	int nr_faces;
+	int nr_corners;
+	int nr_channels;
+	int shared;
+	const float *vbuf;
+	const float *nbuf;
+	const int *faces;
+	const int *vi;
+	const int *ni;
+	const void *image;
+	size_t size;
+};
+
+size_t mesh_pack_size(const struct mesh *mesh);
+int mesh_pack(const struct mesh *mesh, void *image);
+int mesh_view(const void *image, size_t size, struct mesh_view *view);
+int mesh_view_channel(const struct mesh_view *view, int ch,
+		      struct mesh_view_channel *c);
+struct mesh *mesh_unpack(const struct mesh_view *view);
+
+/*
+ * 64-bit hash of every buffer of the mesh, for content addressed caches.
+ * Meshes with different positions, normals, faces or channels hash
+ * differently but for collisions.
+ */
+uint64_t mesh_hash(const struct mesh *mesh);
+
 #endif
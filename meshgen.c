@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "mesh.h"
+#include "obj.h"
+#include "gen.h"
+#include "sys.h"
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: meshgen [-f faces] [-s seed] [-o output.obj] shape[:key=value,...]\n"
+		"\n"
+		"  shapes       torus, sphere, ngon, pole\n"
+		"  keys         faces, seed, irregular (sphere), sides (ngon),\n"
+		"               valence (pole), noise\n"
+		"  -f faces     approximate face count, overrides the spec\n"
+		"  -s seed      random seed, overrides the spec\n"
+		"  -o output    output file (default: <shape>.obj)\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct gen_params p;
+	struct mesh *mesh;
+	int c, faces = 0, seed = -1;
+	const char *out = NULL;
+	char name[64];
+	double t;
+
+	while ((c = getopt(argc, argv, "f:s:o:h")) != -1) {
+		switch (c) {
+		case 'f':
+			faces = atof(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind + 1 != argc || gen_parse(&p, argv[optind]))
+		usage();
+	if (faces > 0)
+		p.faces = faces;
+	if (seed >= 0)
+		p.seed = seed;
+	if (!out) {
+		snprintf(name, sizeof(name), "%s.obj", gen_shape_name(p.shape));
+		out = name;
+	}
+
+	t = sys_time();
+	mesh = gen_mesh(&p);
+	t = sys_time() - t;
+	printf("%s: %d verts, %d faces, generated in %.3fs\n", out,
+	       mesh_vertex_buffer(mesh, NULL), mesh_face_count(mesh), t);
+
+	if (obj_write(out, mesh)) {
+		fprintf(stderr, "meshgen: cannot write %s\n", out);
+		return 1;
+	}
+	mesh_free(mesh);
+	return 0;
+}
@@ -1,50 +1,321 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include "gl.h"
+#include "buf.h"
 #include "mesh.h"
 #include "mathx.h"
+#include "subd.h"
+#include "meshrend.h"
 
-void mesh_render(const struct mesh *mesh)
+struct mesh_vert {
+	float p[3];
+	float n[3];
+};
+
+static const struct sd_layout mesh_vert_layout = {
+	sizeof(struct mesh_vert),
+	offsetof(struct mesh_vert, p),
+	offsetof(struct mesh_vert, n),
+	sizeof(GLuint),
+};
+
+struct mesh_vbo {
+	GLuint vbuf;
+	GLuint ibuf;
+	GLuint ebuf;
+	int nr_verts;
+	int nr_tris;
+	int nr_edges;
+	struct sd_layout layout;
+	GLenum index_type;
+
+	/* Patch i spans [patch_tris[i], patch_tris[i+1]) triangles and
+	 * [patch_edges[i], patch_edges[i+1]) edges */
+	int *patch_tris;
+	int *patch_edges;
+	float *patch_bounds;
+};
+
+/* Normals share the vertex indexing, so positions can be used as is */
+static int mesh_has_shared_normals(const struct mesh *mesh)
+{
+	int i, j, nr_faces;
+
+	if (mesh_has_shared_indices(mesh))
+		return mesh_normal_buffer(mesh, NULL) == mesh_vertex_buffer(mesh, NULL);
+
+	nr_faces = mesh_face_count(mesh);
+	for (i = 0; i < nr_faces; i++) {
+		int nr_verts = mesh_face_vertex_count(mesh, i);
+
+		for (j = 0; j < nr_verts; j++) {
+			int vi, ni;
+
+			mesh_face_vertex_index(mesh, i, j, &vi, &ni);
+			if (vi != ni)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static void mesh_vert_set(struct mesh_vert *mv, const float *p, const float *n)
 {
-	int i, nr_faces;
+	vec_copy(mv->p, p);
+	if (n)
+		vec_copy(mv->n, n);
+	else
+		vec_zero(mv->n);
+}
+
+struct mesh_vbo *mesh_vbo_create(const struct mesh *mesh)
+{
+	int i, j, nr_faces, shared;
+	struct mesh_vbo *vbo;
+	struct mesh_vert *verts = NULL;
+	GLuint *tris = NULL, *edges = NULL;
+
+	shared = mesh_has_shared_normals(mesh);
+	if (shared) {
+		const float *vbuf, *nbuf;
+		int nr_verts;
+
+		nr_verts = mesh_vertex_buffer(mesh, &vbuf);
+		mesh_normal_buffer(mesh, &nbuf);
+		buf_resize(verts, nr_verts);
+		for (i = 0; i < nr_verts; i++)
+			mesh_vert_set(&verts[i], vbuf + 3 * i, nbuf + 3 * i);
+	}
 
 	nr_faces = mesh_face_count(mesh);
 	for (i = 0; i < nr_faces; i++) {
-		int j, nr_verts;
+		int base, nr_verts;
+		GLuint idx[64], *fidx = idx;
 
 		nr_verts = mesh_face_vertex_count(mesh, i);
-		glBegin(GL_POLYGON);
+		if (nr_verts > (int) (sizeof(idx) / sizeof(idx[0])))
+			fidx = malloc(nr_verts * sizeof(*fidx));
+
+		/* Corner indices into the interleaved vertex buffer */
+		base = buf_len(verts);
 		for (j = 0; j < nr_verts; j++) {
-			const float *v;
+			if (shared) {
+				int vi, ni;
+
+				mesh_face_vertex_index(mesh, i, j, &vi, &ni);
+				fidx[j] = vi;
+			} else {
+				struct mesh_vert mv;
+
+				mesh_vert_set(&mv, mesh_get_vertex(mesh, i, j),
+					      mesh_get_normal(mesh, i, j));
+				buf_push(verts, mv);
+				fidx[j] = base + j;
+			}
+		}
 
-			v = mesh_get_normal(mesh, i, j);
-			if (v)
-				glNormal3fv(v);
+		/* Fan triangulation */
+		for (j = 1; j + 1 < nr_verts; j++) {
+			buf_push(tris, fidx[0]);
+			buf_push(tris, fidx[j]);
+			buf_push(tris, fidx[j + 1]);
+		}
 
-			v = mesh_get_vertex(mesh, i, j);
-			glVertex3fv(v);
+		for (j = 0; j < nr_verts; j++) {
+			buf_push(edges, fidx[j]);
+			buf_push(edges, fidx[(j + 1) % nr_verts]);
 		}
-		glEnd();
+
+		if (fidx != idx)
+			free(fidx);
 	}
+
+	vbo = mesh_vbo_create_interleaved(&mesh_vert_layout, verts, buf_len(verts),
+					  tris, buf_len(tris) / 3,
+					  edges, buf_len(edges) / 2);
+	buf_free(verts);
+	buf_free(tris);
+	buf_free(edges);
+	return vbo;
 }
 
-void mesh_compile_list(const struct mesh *mesh, GLuint list)
+struct mesh_vbo *mesh_vbo_create_interleaved(const struct sd_layout *layout,
+					     const void *verts, int nr_verts,
+					     const void *tris, int nr_tris,
+					     const void *lines, int nr_lines)
 {
-	glNewList(list, GL_COMPILE);
-	mesh_render(mesh);
-	glEndList();
+	struct mesh_vbo *vbo;
+
+	vbo = malloc(sizeof(*vbo));
+	vbo->nr_verts = nr_verts;
+	vbo->nr_tris = nr_tris;
+	vbo->nr_edges = nr_lines;
+	vbo->layout = *layout;
+	vbo->index_type = layout->index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	vbo->patch_tris = NULL;
+	vbo->patch_edges = NULL;
+	vbo->patch_bounds = NULL;
+
+	glGenBuffers(1, &vbo->vbuf);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo->vbuf);
+	glBufferData(GL_ARRAY_BUFFER, (size_t) nr_verts * layout->stride,
+		     verts, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &vbo->ibuf);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo->ibuf);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t) 3 * nr_tris * layout->index_size,
+		     tris, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &vbo->ebuf);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo->ebuf);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t) 2 * nr_lines * layout->index_size,
+		     lines, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	return vbo;
+}
+
+void mesh_vbo_free(struct mesh_vbo *vbo)
+{
+	if (!vbo)
+		return;
+	glDeleteBuffers(1, &vbo->vbuf);
+	glDeleteBuffers(1, &vbo->ibuf);
+	glDeleteBuffers(1, &vbo->ebuf);
+	buf_free(vbo->patch_tris);
+	buf_free(vbo->patch_edges);
+	buf_free(vbo->patch_bounds);
+	free(vbo);
+}
+
+static void mesh_vbo_bind(const struct mesh_vbo *vbo, GLuint ibuf)
+{
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo->vbuf);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, vbo->layout.stride,
+			(const GLvoid *) (size_t) vbo->layout.position);
+	if (vbo->layout.normal >= 0) {
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glNormalPointer(GL_FLOAT, vbo->layout.stride,
+				(const GLvoid *) (size_t) vbo->layout.normal);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibuf);
+}
+
+static void mesh_vbo_unbind(void)
+{
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glPopClientAttrib();
+}
+
+static void mesh_vbo_draw(const struct mesh_vbo *vbo, GLuint ibuf,
+			  GLenum mode, GLsizei count)
+{
+	mesh_vbo_bind(vbo, ibuf);
+	glDrawElements(mode, count, vbo->index_type, NULL);
+	mesh_vbo_unbind();
+}
+
+/* Draws runs of consecutive visible patches with one glMultiDrawElements */
+static int mesh_vbo_draw_culled(const struct mesh_vbo *vbo, GLuint ibuf,
+				GLenum mode, int verts, const int *ranges,
+				const float *planes)
+{
+	static GLsizei *counts, *firsts;
+	static const GLvoid **offsets;
+	int i, nr_patches, nr_visible = 0;
+
+	nr_patches = buf_len(ranges) - 1;
+	buf_resize(counts, 0);
+	buf_resize(firsts, 0);
+	for (i = 0; i < nr_patches; i++) {
+		const float *b = vbo->patch_bounds + 6 * i;
+		int beg, end;
+
+		if (frustum_cull_box(planes, b, b + 3))
+			continue;
+
+		nr_visible++;
+		beg = ranges[i] * verts;
+		end = ranges[i + 1] * verts;
+		if (buf_len(counts) && buf_last(firsts) + buf_last(counts) == beg) {
+			buf_last(counts) += end - beg;
+		} else {
+			buf_push(counts, end - beg);
+			buf_push(firsts, beg);
+		}
+	}
+
+	if (buf_len(counts)) {
+		buf_resize(offsets, buf_len(firsts));
+		for (i = 0; i < buf_len(firsts); i++)
+			offsets[i] = (const GLvoid *) ((size_t) firsts[i] *
+						       vbo->layout.index_size);
+
+		mesh_vbo_bind(vbo, ibuf);
+		glMultiDrawElements(mode, counts, vbo->index_type,
+				    offsets, buf_len(counts));
+		mesh_vbo_unbind();
+	}
+	return nr_visible;
+}
+
+void mesh_vbo_render(const struct mesh_vbo *vbo)
+{
+	mesh_vbo_draw(vbo, vbo->ibuf, GL_TRIANGLES, 3 * vbo->nr_tris);
+}
+
+void mesh_vbo_render_edges(const struct mesh_vbo *vbo)
+{
+	mesh_vbo_draw(vbo, vbo->ebuf, GL_LINES, 2 * vbo->nr_edges);
+}
+
+int mesh_vbo_render_culled(const struct mesh_vbo *vbo, const float *planes)
+{
+	if (!vbo->patch_tris) {
+		mesh_vbo_render(vbo);
+		return 1;
+	}
+	return mesh_vbo_draw_culled(vbo, vbo->ibuf, GL_TRIANGLES, 3,
+				    vbo->patch_tris, planes);
+}
+
+int mesh_vbo_render_edges_culled(const struct mesh_vbo *vbo, const float *planes)
+{
+	if (!vbo->patch_edges) {
+		mesh_vbo_render_edges(vbo);
+		return 1;
+	}
+	return mesh_vbo_draw_culled(vbo, vbo->ebuf, GL_LINES, 2,
+				    vbo->patch_edges, planes);
+}
+
+void mesh_vbo_set_patches(struct mesh_vbo *vbo, const int *first_tri,
+			  const int *first_edge, const float *bounds,
+			  int nr_patches)
+{
+	buf_resize(vbo->patch_tris, nr_patches + 1);
+	buf_resize(vbo->patch_edges, nr_patches + 1);
+	buf_resize(vbo->patch_bounds, 6 * nr_patches);
+	memcpy(vbo->patch_tris, first_tri, (nr_patches + 1) * sizeof(*first_tri));
+	memcpy(vbo->patch_edges, first_edge, (nr_patches + 1) * sizeof(*first_edge));
+	memcpy(vbo->patch_bounds, bounds, 6 * nr_patches * sizeof(*bounds));
+}
+
+size_t mesh_vbo_size(const struct mesh_vbo *vbo)
+{
+	return (size_t) vbo->nr_verts * vbo->layout.stride +
+	       (size_t) (3 * vbo->nr_tris + 2 * vbo->nr_edges) * vbo->layout.index_size;
 }
 
 void mesh_calc_bounds(const struct mesh *mesh, float *min, float *max)
 {
-	int i, nr;
 	const float *vbuf;
+	int nr;
 
 	nr = mesh_vertex_buffer(mesh, &vbuf);
-	vec_set(min, INFINITY, INFINITY, INFINITY);
-	vec_neg(max, min);
-	for (i = 0; i < nr; i++) {
-		vec_min(min, min, vbuf + 3 * i);
-		vec_max(max, max, vbuf + 3 * i);
-	}
+	vec_bounds_n(min, max, vbuf, nr);
 }
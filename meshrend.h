@@ -1,8 +1,43 @@
 #ifndef MESHREND_H
 #define MESHREND_H
 
-void mesh_render(const struct mesh *mesh);
-void mesh_compile_list(const struct mesh *mesh, GLuint list);
+#include <stddef.h>
+
+/*
+ * GPU resident mesh: faces are fan-triangulated once into an interleaved
+ * position+normal vertex buffer and an index buffer.  Face edges are kept
+ * in a separate line index buffer for wireframe rendering.
+ */
+struct mesh_vbo *mesh_vbo_create(const struct mesh *mesh);
+void mesh_vbo_free(struct mesh_vbo *vbo);
+
+/*
+ * Uploads vertex and index arrays already in the given layout, e.g. from
+ * sd_export(): 3 * nr_tris triangle and 2 * nr_lines line indices.
+ */
+struct sd_layout;
+struct mesh_vbo *mesh_vbo_create_interleaved(const struct sd_layout *layout,
+					     const void *verts, int nr_verts,
+					     const void *tris, int nr_tris,
+					     const void *lines, int nr_lines);
+
+void mesh_vbo_render(const struct mesh_vbo *vbo);
+void mesh_vbo_render_edges(const struct mesh_vbo *vbo);
+size_t mesh_vbo_size(const struct mesh_vbo *vbo);
+
+/*
+ * Splits the mesh into patches of consecutive faces, patch i covering
+ * triangles first_tri[i]..first_tri[i+1]-1 and edges first_edge[i]..
+ * first_edge[i+1]-1, bounded by the box at bounds + 6 * i (min xyz, max
+ * xyz).  The culled renderers skip patches outside the view volume given by
+ * mat_frustum_planes() and return how many were drawn.
+ */
+void mesh_vbo_set_patches(struct mesh_vbo *vbo, const int *first_tri,
+			  const int *first_edge, const float *bounds,
+			  int nr_patches);
+int mesh_vbo_render_culled(const struct mesh_vbo *vbo, const float *planes);
+int mesh_vbo_render_edges_culled(const struct mesh_vbo *vbo, const float *planes);
+
 void mesh_calc_bounds(const struct mesh *mesh, float *min, float *max);
 
 #endif
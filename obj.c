@@ -2,6 +2,7 @@
 #include <ctype.h>
 #include <string.h>
 #include "mathx.h"
+#include "memstats.h"
 #include "mesh.h"
 
 static const char *skip_space(const char *str)
@@ -24,10 +25,13 @@ struct mesh *obj_read(const char *file)
 	char line[512];
 	const char *str;
 	struct mesh *mesh;
-	int has_normals = 0;
+	int has_normals = 0, uv = -1;
+	mem_enter(MEM_OBJ);
 
-	if (!(f = fopen(file, "r")))
+	if (!(f = fopen(file, "r"))) {
+		mem_leave();
 		return NULL;
+	}
 
 	mesh = mesh_create();
 	while (!feof(f)) {
@@ -47,6 +51,14 @@ struct mesh *obj_read(const char *file)
 
 			sscanf(str, "vn %f %f %f", n, n + 1, n + 2);
 			mesh_add_normal(mesh, n);
+		} else if (strncmp(str, "vt ", 3) == 0) {
+			/* Texture coordinate command */
+			float t[2] = { 0.0f, 0.0f };
+
+			if (uv == -1)
+				uv = mesh_add_channel(mesh, MESH_FACE_VARYING, 2);
+			sscanf(str, "vt %f %f", t, t + 1);
+			mesh_add_channel_value(mesh, uv, t);
 		} else if (strncmp(str, "f ", 2) == 0) {
 			/* Face command */
 			int vi, ti, ni;
@@ -55,9 +67,12 @@ struct mesh *obj_read(const char *file)
 			str = skip_space(++str); /* Skip 'f ' */
 			while (*str) {
 				vi = ti = ni = 0;
-				if (sscanf(str, "%d/%d/%d", &vi, &ti, &ni) == 3)
+				if (sscanf(str, "%d/%d/%d", &vi, &ti, &ni) == 3 ||
+				    sscanf(str, "%d//%d", &vi, &ni) == 2)
 					has_normals = 1;
 				mesh_add_index(mesh, vi - 1, ni - 1);
+				if (uv != -1)
+					mesh_add_channel_index(mesh, uv, ti - 1);
 				str = skip_non_space(str);
 				str = skip_space(str);
 			}
@@ -69,6 +84,66 @@ struct mesh *obj_read(const char *file)
 
 	if (!has_normals)
 		mesh_compute_normals(mesh);
+	else
+		mesh_share_indices(mesh);
 
+	mem_leave();
 	return mesh;
 }
+
+/* Texture coordinates are the first face varying channel two floats wide */
+static int obj_uv_channel(const struct mesh *mesh)
+{
+	int i;
+
+	for (i = 0; i < mesh_channel_count(mesh); i++)
+		if (mesh_channel_kind(mesh, i) == MESH_FACE_VARYING &&
+		    mesh_channel_width(mesh, i) == 2)
+			return i;
+	return -1;
+}
+
+int obj_write(const char *file, const struct mesh *mesh)
+{
+	FILE *f;
+	int i, j, nr, nr_faces, uv = obj_uv_channel(mesh);
+	const float *buf;
+
+	if (!(f = fopen(file, "w")))
+		return -1;
+
+	nr = mesh_vertex_buffer(mesh, &buf);
+	for (i = 0; i < nr; i++, buf += 3)
+		fprintf(f, "v %.9g %.9g %.9g\n", buf[0], buf[1], buf[2]);
+
+	nr = mesh_normal_buffer(mesh, &buf);
+	for (i = 0; i < nr; i++, buf += 3)
+		fprintf(f, "vn %.9g %.9g %.9g\n", buf[0], buf[1], buf[2]);
+
+	nr = uv != -1 ? mesh_channel_buffer(mesh, uv, &buf) : 0;
+	for (i = 0; i < nr; i++, buf += 2)
+		fprintf(f, "vt %.9g %.9g\n", buf[0], buf[1]);
+
+	nr_faces = mesh_face_count(mesh);
+	for (i = 0; i < nr_faces; i++) {
+		fputc('f', f);
+		nr = mesh_face_vertex_count(mesh, i);
+		for (j = 0; j < nr; j++) {
+			int vi, ni, ti;
+
+			mesh_face_vertex_index(mesh, i, j, &vi, &ni);
+			ti = uv != -1 ? mesh_channel_index(mesh, uv, i, j) : -1;
+			if (ti != -1 && ni != -1)
+				fprintf(f, " %d/%d/%d", vi + 1, ti + 1, ni + 1);
+			else if (ti != -1)
+				fprintf(f, " %d/%d", vi + 1, ti + 1);
+			else if (ni != -1)
+				fprintf(f, " %d//%d", vi + 1, ni + 1);
+			else
+				fprintf(f, " %d", vi + 1);
+		}
+		fputc('\n', f);
+	}
+
+	return fclose(f) ? -1 : 0;
+}
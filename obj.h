@@ -2,5 +2,6 @@
 #define OBJ_H
 
 struct mesh *obj_read(const char *file);
+int obj_write(const char *file, const struct mesh *mesh);
 
 #endif
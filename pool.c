@@ -0,0 +1,184 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "buf.h"
+#include "sys.h"
+#include "util.h"
+#include "pool.h"
+
+struct pool_task {
+	void (*fn)(void *);
+	void *arg;
+	struct pool_group *group;
+};
+
+struct pool {
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	struct pool_task *tasks;
+	int head;
+	int busy;
+	int quit;
+};
+
+/*
+ * Dequeues task i, which moves the head task into its slot; called with
+ * the lock held.
+ */
+static struct pool_task pool_take(struct pool *pool, int i)
+{
+	struct pool_task task = pool->tasks[i];
+
+	pool->tasks[i] = pool->tasks[pool->head];
+	pool->tasks[pool->head++] = task;
+	if (task.group)
+		task.group->queued--;
+	if (pool->head == buf_len(pool->tasks)) {
+		pool->head = 0;
+		buf_resize(pool->tasks, 0);
+	}
+	return task;
+}
+
+/* Runs task with the lock dropped; called and returns with it held */
+static void pool_run(struct pool *pool, struct pool_task task)
+{
+	pool->busy++;
+	pthread_mutex_unlock(&pool->lock);
+
+	task.fn(task.arg);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->busy--;
+	if ((task.group && !--task.group->pending) ||
+	    (!pool->busy && pool->head == buf_len(pool->tasks)))
+		pthread_cond_broadcast(&pool->done);
+}
+
+static void *pool_worker(void *arg)
+{
+	struct pool *pool = arg;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && pool->head == buf_len(pool->tasks))
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->head == buf_len(pool->tasks))
+			break;
+		pool_run(pool, pool_take(pool, pool->head));
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct pool *pool_create(int nr_threads)
+{
+	int i;
+	struct pool *pool;
+
+	if (nr_threads <= 0)
+		nr_threads = sys_nr_cpus();
+
+	pool = malloc(sizeof(*pool));
+	pool->threads = NULL;
+	/* Takes the memstats tag of the creator, not of pool_add() callers */
+	pool->tasks = NULL;
+	buf_init(pool->tasks, NULL, 0);
+	pool->head = 0;
+	pool->busy = 0;
+	pool->quit = 0;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	buf_resize(pool->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&pool->threads[i], NULL, pool_worker, pool);
+	return pool;
+}
+
+void pool_free(struct pool *pool)
+{
+	pthread_t *t;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	buf_foreach(t, pool->threads)
+		pthread_join(*t, NULL);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	buf_free(pool->threads);
+	buf_free(pool->tasks);
+	free(pool);
+}
+
+void pool_add(struct pool *pool, void (*fn)(void *), void *arg)
+{
+	pool_add_group(pool, NULL, fn, arg);
+}
+
+void pool_add_group(struct pool *pool, struct pool_group *group,
+		    void (*fn)(void *), void *arg)
+{
+	struct pool_task task;
+
+	task.fn = fn;
+	task.arg = arg;
+	task.group = group;
+
+	pthread_mutex_lock(&pool->lock);
+	if (group) {
+		if (!group->queued)
+			group->next = buf_len(pool->tasks);
+		group->pending++;
+		group->queued++;
+	}
+	buf_push(pool->tasks, task);
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(struct pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy || pool->head != buf_len(pool->tasks))
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait_group(struct pool *pool, struct pool_group *group)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	while (group->pending) {
+		if (!group->queued) {
+			pthread_cond_wait(&pool->done, &pool->lock);
+			continue;
+		}
+		/*
+		 * The group's queued tasks all sit at or after next: slots
+		 * before it only ever receive tasks moved from the head.
+		 */
+		i = MAX(group->next, pool->head);
+		while (pool->tasks[i].group != group)
+			i++;
+		group->next = i + 1;
+		pool_run(pool, pool_take(pool, i));
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int pool_size(const struct pool *pool)
+{
+	return buf_len(pool->threads);
+}
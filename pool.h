@@ -0,0 +1,30 @@
+#ifndef POOL_H
+#define POOL_H
+
+/*
+ * Fixed size thread pool.  Tasks run in submission order on the worker
+ * threads; pool_wait() blocks until every queued task has finished.
+ *
+ * Tasks added with pool_add_group() also count in a zeroed pool_group,
+ * and pool_wait_group() returns once that group's tasks have finished,
+ * whatever else is queued.  The waiting thread runs the group's tasks
+ * still queued itself instead of sleeping behind unrelated work; each
+ * one it takes swaps places with the task at the head of the queue.
+ */
+struct pool_group {
+	int pending;		/* Queued or running */
+	int queued;
+	int next;		/* No queued task of the group before this */
+};
+
+struct pool *pool_create(int nr_threads);
+void pool_free(struct pool *pool);
+
+void pool_add(struct pool *pool, void (*fn)(void *), void *arg);
+void pool_wait(struct pool *pool);
+void pool_add_group(struct pool *pool, struct pool_group *group,
+		    void (*fn)(void *), void *arg);
+void pool_wait_group(struct pool *pool, struct pool_group *group);
+int pool_size(const struct pool *pool);
+
+#endif
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <string.h>
+#include "gl.h"
+#include "gl_util.h"
+#include "sys.h"
+#include "prof.h"
+
+#define NR_SAMPLES		1024
+#define NR_GRAPH		240
+#define NR_QUERIES		4
+
+struct prof_sample {
+	double frame;			/* Wall clock seconds */
+	double cpu[PROF_NR_STAGES];	/* Thread CPU seconds */
+	double gpu;			/* Seconds, negative when unknown */
+};
+
+static struct prof_sample samples[NR_SAMPLES];
+static int nr_samples, head;
+static struct prof_sample cur;
+static double frame_start, stage_start[PROF_NR_STAGES];
+static int visible;
+
+/* Timer queries are read back a few frames late to avoid stalls */
+static int has_timer_query = -1;
+static GLuint queries[NR_QUERIES];
+static int query_frame[NR_QUERIES];
+static int frame_nr;
+
+static int check_timer_query(void)
+{
+	const char *ext = (const char *) glGetString(GL_EXTENSIONS);
+	const char *ver = (const char *) glGetString(GL_VERSION);
+	int major = 0, minor = 0;
+
+	if (ver)
+		sscanf(ver, "%d.%d", &major, &minor);
+	if (major > 3 || (major == 3 && minor >= 3))
+		return 1;
+	return ext && (strstr(ext, "GL_ARB_timer_query") ||
+		       strstr(ext, "GL_EXT_timer_query"));
+}
+
+static struct prof_sample *sample(int i)
+{
+	return &samples[(head - nr_samples + i + NR_SAMPLES) % NR_SAMPLES];
+}
+
+void prof_frame(void)
+{
+	double now = sys_time();
+
+	if (frame_start > 0.0) {
+		cur.frame = now - frame_start;
+		samples[head] = cur;
+		head = (head + 1) % NR_SAMPLES;
+		if (nr_samples < NR_SAMPLES)
+			nr_samples++;
+	}
+	frame_start = now;
+	memset(&cur, 0, sizeof(cur));
+	cur.gpu = -1.0;
+	frame_nr++;
+}
+
+void prof_begin(enum prof_stage stage)
+{
+	stage_start[stage] = sys_cpu_time();
+}
+
+void prof_end(enum prof_stage stage)
+{
+	cur.cpu[stage] += sys_cpu_time() - stage_start[stage];
+}
+
+void prof_gpu_begin(void)
+{
+	GLuint q;
+	int i = frame_nr % NR_QUERIES;
+
+	if (has_timer_query < 0) {
+		has_timer_query = check_timer_query();
+		if (has_timer_query)
+			glGenQueries(NR_QUERIES, queries);
+	}
+	if (!has_timer_query)
+		return;
+
+	/* Collect the result this query slot held before reusing it */
+	q = queries[i];
+	if (query_frame[i]) {
+		GLuint64 ns;
+		GLint ready = 0;
+
+		glGetQueryObjectiv(q, GL_QUERY_RESULT_AVAILABLE, &ready);
+		if (ready) {
+			int age = frame_nr - query_frame[i];
+
+			glGetQueryObjectui64v(q, GL_QUERY_RESULT, &ns);
+			if (age <= nr_samples)
+				sample(nr_samples - age)->gpu = ns * 1e-9;
+		}
+	}
+	query_frame[i] = frame_nr;
+	glBeginQuery(GL_TIME_ELAPSED, q);
+}
+
+void prof_gpu_end(void)
+{
+	if (has_timer_query > 0)
+		glEndQuery(GL_TIME_ELAPSED);
+}
+
+static void draw_graph(float x, float y, float w, float h)
+{
+	int i, n = nr_samples < NR_GRAPH ? nr_samples : NR_GRAPH;
+	const float full = 1.0f / 30.0f;	/* Top of the graph, seconds */
+
+	glColor4f(0.0f, 0.0f, 0.0f, 0.5f);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glRectf(x, y, x + w, y + h);
+
+	/* 60 Hz reference line */
+	glColor3f(0.5f, 0.5f, 0.5f);
+	glBegin(GL_LINES);
+	glVertex2f(x, y + h * 0.5f);
+	glVertex2f(x + w, y + h * 0.5f);
+	glEnd();
+
+	glColor3f(0.0f, 1.0f, 0.0f);
+	glBegin(GL_LINE_STRIP);
+	for (i = 0; i < n; i++) {
+		float t = sample(nr_samples - n + i)->frame / full;
+
+		glVertex2f(x + w * i / NR_GRAPH, y + h * (t < 1.0f ? t : 1.0f));
+	}
+	glEnd();
+
+	glColor3f(1.0f, 0.5f, 0.0f);
+	glBegin(GL_LINE_STRIP);
+	for (i = 0; i < n; i++) {
+		float t = sample(nr_samples - n + i)->gpu / full;
+
+		glVertex2f(x + w * i / NR_GRAPH,
+			   y + h * (t < 0.0f ? 0.0f : t < 1.0f ? t : 1.0f));
+	}
+	glEnd();
+}
+
+void prof_draw(float x, float y)
+{
+	int i, n = nr_samples < NR_GRAPH ? nr_samples : NR_GRAPH;
+	struct prof_sample avg;
+	int nr_gpu = 0;
+
+	if (!visible || !n)
+		return;
+
+	memset(&avg, 0, sizeof(avg));
+	for (i = 0; i < n; i++) {
+		struct prof_sample *s = sample(nr_samples - n + i);
+		int j;
+
+		avg.frame += s->frame / n;
+		for (j = 0; j < PROF_NR_STAGES; j++)
+			avg.cpu[j] += s->cpu[j] / n;
+		if (s->gpu >= 0.0) {
+			avg.gpu += s->gpu;
+			nr_gpu++;
+		}
+	}
+
+	glColor3f(1.0f, 1.0f, 1.0f);
+	glRasterPos2f(x, y);
+	gl_printf(GLUT_BITMAP_HELVETICA_12, "frame %.2f ms (%.0f fps)",
+		  avg.frame * 1e3, avg.frame > 0.0 ? 1.0 / avg.frame : 0.0);
+	glRasterPos2f(x, y - 0.025f);
+	gl_printf(GLUT_BITMAP_HELVETICA_12,
+		  "cpu display %.2f render %.2f overlay %.2f ms",
+		  avg.cpu[PROF_DISPLAY] * 1e3, avg.cpu[PROF_RENDER] * 1e3,
+		  avg.cpu[PROF_OVERLAY] * 1e3);
+	glRasterPos2f(x, y - 0.050f);
+	if (nr_gpu)
+		gl_printf(GLUT_BITMAP_HELVETICA_12, "gpu render %.2f ms",
+			  avg.gpu / nr_gpu * 1e3);
+	else
+		gl_printf(GLUT_BITMAP_HELVETICA_12, "gpu render n/a");
+	glRasterPos2f(x, y - 0.075f);
+	gl_printf(GLUT_BITMAP_HELVETICA_12, "rss %.1f MiB, peak %.1f MiB",
+		  sys_cur_rss() / (1024.0 * 1024.0),
+		  sys_peak_rss() / (1024.0 * 1024.0));
+
+	draw_graph(x, y - 0.25f, 0.3f, 0.15f);
+}
+
+void prof_toggle(void)
+{
+	visible = !visible;
+}
+
+int prof_dump_csv(const char *file)
+{
+	int i;
+	FILE *f;
+
+	if (!(f = fopen(file, "w")))
+		return -1;
+
+	fprintf(f, "frame_ms,display_cpu_ms,render_cpu_ms,overlay_cpu_ms,render_gpu_ms\n");
+	for (i = 0; i < nr_samples; i++) {
+		struct prof_sample *s = sample(i);
+
+		fprintf(f, "%.4f,%.4f,%.4f,%.4f,", s->frame * 1e3,
+			s->cpu[PROF_DISPLAY] * 1e3, s->cpu[PROF_RENDER] * 1e3,
+			s->cpu[PROF_OVERLAY] * 1e3);
+		if (s->gpu >= 0.0)
+			fprintf(f, "%.4f", s->gpu * 1e3);
+		fputc('\n', f);
+	}
+
+	return fclose(f) ? -1 : 0;
+}
@@ -0,0 +1,27 @@
+#ifndef PROF_H
+#define PROF_H
+
+/*
+ * Frame profiler.  Every frame records the wall clock frame time, the
+ * thread CPU time of each stage and, where timer queries are supported,
+ * the GPU time spent between prof_gpu_begin() and prof_gpu_end().
+ */
+enum prof_stage {
+	PROF_DISPLAY,
+	PROF_RENDER,
+	PROF_OVERLAY,
+	PROF_NR_STAGES
+};
+
+void prof_frame(void);
+void prof_begin(enum prof_stage stage);
+void prof_end(enum prof_stage stage);
+void prof_gpu_begin(void);
+void prof_gpu_end(void);
+
+/* Draws the overlay, call between gl_begin_2d() and gl_end_2d() */
+void prof_draw(float x, float y);
+void prof_toggle(void);
+int prof_dump_csv(const char *file);
+
+#endif
@@ -0,0 +1,195 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "mesh.h"
+#include "rpc.h"
+#include "subd.h"
+#include "util.h"
+
+struct sd_client {
+	int fd;
+};
+
+static int rpc_write(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+
+	while (size) {
+		ssize_t n = write(fd, p, size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int rpc_read(int fd, void *data, size_t size)
+{
+	char *p = data;
+
+	while (size) {
+		ssize_t n = read(fd, p, size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+void sd_rpc_init(struct sd_rpc_msg *msg, int type, uint64_t size)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->magic = SD_RPC_MAGIC;
+	msg->version = SD_RPC_VERSION;
+	msg->type = type;
+	msg->size = size;
+}
+
+int sd_rpc_send(int fd, const struct sd_rpc_msg *msg, const void *payload)
+{
+	if (rpc_write(fd, msg, sizeof(*msg)))
+		return -1;
+	return msg->size ? rpc_write(fd, payload, msg->size) : 0;
+}
+
+/* Bytes read before the buffer has to grow, so a header alone ties up little */
+#define RPC_CHUNK	(1 << 20)
+
+int sd_rpc_recv(int fd, struct sd_rpc_msg *msg, void **payload)
+{
+	size_t got = 0, cap = 0;
+	void *buf = NULL;
+
+	*payload = NULL;
+	if (rpc_read(fd, msg, sizeof(*msg)) || msg->magic != SD_RPC_MAGIC ||
+	    msg->version != SD_RPC_VERSION || msg->size > SD_RPC_MAX_SIZE)
+		return -1;
+
+	/*
+	 * Mesh images keep their arrays aligned for whoever maps them.  The
+	 * buffer doubles as the payload arrives rather than trusting the size
+	 * in the header up front.
+	 */
+	while (got < msg->size) {
+		size_t n;
+
+		if (got == cap) {
+			void *p;
+
+			cap = MIN(MAX(2 * cap, RPC_CHUNK), msg->size);
+			if (posix_memalign(&p, 64, cap)) {
+				free(buf);
+				return -1;
+			}
+			if (got)
+				memcpy(p, buf, got);
+			free(buf);
+			buf = p;
+		}
+		n = cap - got;
+		if (rpc_read(fd, (char *) buf + got, n)) {
+			free(buf);
+			return -1;
+		}
+		got += n;
+	}
+	*payload = buf;
+	return 0;
+}
+
+struct sd_client *sd_client_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	struct sd_client *c;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return NULL;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return NULL;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+	    !(c = malloc(sizeof(*c)))) {
+		close(fd);
+		return NULL;
+	}
+	c->fd = fd;
+	return c;
+}
+
+/* Sends a request and reads a reply of the same type */
+static int sd_client_call(struct sd_client *c, struct sd_rpc_msg *msg,
+			  const void *payload, void **reply)
+{
+	int type = msg->type;
+
+	*reply = NULL;
+	if (sd_rpc_send(c->fd, msg, payload) || sd_rpc_recv(c->fd, msg, reply))
+		return -1;
+	if (msg->type != type || msg->status != SD_RPC_OK) {
+		free(*reply);
+		*reply = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+struct mesh *sd_client_subdivide(struct sd_client *c, const struct mesh *mesh,
+				 int level, const struct sd_options *opt)
+{
+	struct sd_rpc_msg msg;
+	struct mesh_view view;
+	struct mesh *res = NULL;
+	void *image, *reply = NULL;
+
+	sd_rpc_init(&msg, SD_RPC_SUBDIVIDE, mesh_pack_size(mesh));
+	msg.level = level;
+	msg.flags = opt && opt->local_order ? SD_RPC_LOCAL_ORDER : 0;
+	if (posix_memalign(&image, 64, msg.size))
+		return NULL;
+	if (!mesh_pack(mesh, image) && !sd_client_call(c, &msg, image, &reply) &&
+	    !mesh_view(reply, msg.size, &view))
+		res = mesh_unpack(&view);
+	free(image);
+	free(reply);
+	return res;
+}
+
+int sd_client_stats(struct sd_client *c, struct sd_rpc_stats *st)
+{
+	struct sd_rpc_msg msg;
+	void *reply;
+
+	sd_rpc_init(&msg, SD_RPC_STATS, 0);
+	if (sd_client_call(c, &msg, NULL, &reply))
+		return -1;
+	if (msg.size != sizeof(*st)) {
+		free(reply);
+		return -1;
+	}
+	memcpy(st, reply, sizeof(*st));
+	free(reply);
+	return 0;
+}
+
+void sd_client_close(struct sd_client *c)
+{
+	if (!c)
+		return;
+	close(c->fd);
+	free(c);
+}
@@ -0,0 +1,88 @@
+#ifndef RPC_H
+#define RPC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Subdivision over a Unix domain socket, served by sdserve
+ *
+ * Every message is a struct sd_rpc_msg followed by size bytes of payload.
+ * A SD_RPC_SUBDIVIDE request carries the base mesh as a mesh image (see
+ * mesh_pack()) and its reply the refined one; a SD_RPC_STATS reply
+ * carries a struct sd_rpc_stats.  Replies have the request's type and a
+ * status of 0, or SD_RPC_EBAD for a request that cannot be served.  A
+ * connection takes any number of requests, one at a time.
+ *
+ * sd_client_subdivide() returns NULL when the server fails the request
+ * or the connection breaks; opt may be NULL for the defaults.
+ */
+#define SD_RPC_MAGIC		0x43505253	/* "SRPC" */
+#define SD_RPC_VERSION		1
+#define SD_RPC_MAX_LEVEL	8
+#define SD_RPC_MAX_SIZE		(1UL << 31)
+
+enum {
+	SD_RPC_SUBDIVIDE = 1,
+	SD_RPC_STATS,
+};
+
+enum {
+	SD_RPC_OK,
+	SD_RPC_EBAD,
+};
+
+#define SD_RPC_LOCAL_ORDER	1	/* Flag for sd_options.local_order */
+
+struct sd_rpc_msg {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t type;
+	uint32_t status;
+	int32_t level;
+	uint32_t flags;
+	uint64_t size;
+};
+
+/* Latencies are from a request's arrival to its reply, over a recent window */
+struct sd_rpc_stats {
+	double uptime;
+	int64_t requests;
+	int64_t failed;
+	int64_t result_hits;
+	int64_t topo_hits;
+	int64_t topo_builds;
+	int32_t threads;
+	int32_t queued;		/* Requests waiting for a worker now */
+	int32_t max_queued;
+	int32_t result_entries;
+	int64_t result_bytes;
+	double latency_mean;
+	double latency_p50;
+	double latency_p95;
+	double latency_p99;
+	double latency_max;
+	double wait_mean;	/* Part of the latency spent queued */
+};
+
+/*
+ * Message framing for both sides.  sd_rpc_recv() reads a header and
+ * returns its payload in a malloc()ed buffer in *payload, NULL when
+ * empty; it returns -1 on a short read or a header of the wrong magic,
+ * version or size.
+ */
+int sd_rpc_send(int fd, const struct sd_rpc_msg *msg, const void *payload);
+int sd_rpc_recv(int fd, struct sd_rpc_msg *msg, void **payload);
+void sd_rpc_init(struct sd_rpc_msg *msg, int type, uint64_t size);
+
+struct mesh;
+struct sd_options;
+struct sd_client;
+
+struct sd_client *sd_client_connect(const char *path);
+struct mesh *sd_client_subdivide(struct sd_client *c, const struct mesh *mesh,
+				 int level, const struct sd_options *opt);
+int sd_client_stats(struct sd_client *c, struct sd_rpc_stats *st);
+void sd_client_close(struct sd_client *c);
+
+#endif
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "buf.h"
+#include "mathx.h"
+#include "mesh.h"
+#include "obj.h"
+#include "gen.h"
+#include "pool.h"
+#include "subd.h"
+#include "sys.h"
+#include "util.h"
+
+static const char *assets[] = {
+	"objs/cube.obj",
+	"objs/tetra.obj",
+	"objs/bigguy.obj",
+	"objs/monsterfrog.obj",
+};
+
+#define MAX_LEVEL		8
+
+/* Samples of one pipeline stage on one asset at one level */
+struct stage {
+	char name[32];
+	const char *asset;
+	int level;
+	int faces;
+	double *samples;
+};
+
+static struct stage *stages;
+static int nr_runs = 10, nr_warmup = 2;
+static struct sd_options opt;
+
+static struct stage *get_stage(const char *name, const char *asset, int level)
+{
+	struct stage *s, st;
+
+	buf_foreach(s, stages)
+		if (!strcmp(s->name, name) && s->asset == asset && s->level == level)
+			return s;
+
+	memset(&st, 0, sizeof(st));
+	snprintf(st.name, sizeof(st.name), "%s", name);
+	st.asset = asset;
+	st.level = level;
+	buf_push(stages, st);
+	return &buf_last(stages);
+}
+
+static void record(int run, const char *name, const char *asset, int level,
+		   int faces, double t)
+{
+	struct stage *s;
+
+	if (run < nr_warmup)
+		return;
+	s = get_stage(name, asset, level);
+	s->faces = faces;
+	buf_push(s->samples, t);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, int n, double p)
+{
+	int i = (int) (p * (n - 1) + 0.5);
+	return sorted[MIN(i, n - 1)];
+}
+
+/* Reads the asset, or generates it when it is a gen_parse() spec */
+static struct mesh *load_asset(const char *asset, int generated, int run)
+{
+	struct gen_params p;
+	struct mesh *mesh;
+	double t;
+
+	t = sys_time();
+	if (generated) {
+		gen_parse(&p, asset);
+		mesh = gen_mesh(&p);
+	} else {
+		mesh = obj_read(asset);
+	}
+	t = sys_time() - t;
+	if (!mesh) {
+		fprintf(stderr, "sdbench: cannot read %s\n", asset);
+		exit(1);
+	}
+	record(run, generated ? "gen_mesh" : "obj_read", asset, 0,
+	       mesh_face_count(mesh), t);
+	return mesh;
+}
+
+static void bench_asset(const char *asset, int generated, int max_level)
+{
+	int run, i;
+
+	for (run = 0; run < nr_warmup + nr_runs; run++) {
+		struct mesh *mesh, *res, *levels[MAX_LEVEL];
+		struct sd_mesh *sd;
+		double t, t_iter;
+
+		mesh = load_asset(asset, generated, run);
+
+		t = sys_time();
+		sd = sd_init_opts(mesh, &opt);
+		t = sys_time() - t;
+		record(run, "sd_init", asset, 0, mesh_face_count(mesh), t);
+
+		for (i = 1; i <= max_level; i++) {
+			t = sys_time();
+			sd_do_iteration(sd, i == 1, i == max_level);
+			t_iter = sys_time() - t;
+
+			t = sys_time();
+			res = sd_convert(sd);
+			t = sys_time() - t;
+			record(run, "sd_do_iteration", asset, i,
+			       mesh_face_count(res), t_iter);
+			record(run, "sd_convert", asset, i, mesh_face_count(res), t);
+
+			t = sys_time();
+			mesh_compute_normals(res);
+			t = sys_time() - t;
+			record(run, "mesh_compute_normals", asset, i,
+			       mesh_face_count(res), t);
+			mesh_free(res);
+		}
+		sd_free(sd);
+
+		for (i = 1; i <= max_level; i++) {
+			int j, faces = 0;
+
+			t = sys_time();
+			subdivide_levels_opts(mesh, levels, i, &opt);
+			t = sys_time() - t;
+			for (j = 0; j < i; j++) {
+				faces += mesh_face_count(levels[j]);
+				mesh_free(levels[j]);
+			}
+			record(run, "subdivide_levels", asset, i, faces, t);
+		}
+
+		mesh_free(mesh);
+	}
+}
+
+/*
+ * Every input at once, each subdivide()d in turn and then through
+ * subdivide_batch() on a pool of nr_threads workers.
+ */
+static void bench_batch(const char **names, const int *generated, int nr,
+			int max_level, int nr_threads)
+{
+	static const char all[] = "(all inputs)";
+	const struct mesh **meshes = NULL;
+	struct mesh **res = NULL;
+	int *levels = NULL;
+	struct pool *pool;
+	int run, i, j;
+
+	/* As a warm-up run, so loading is not recorded again */
+	for (i = 0; i < nr; i++)
+		buf_push(meshes, load_asset(names[i], generated[i], -1));
+	buf_resize(res, nr);
+	buf_resize(levels, nr);
+	pool = pool_create(nr_threads);
+
+	for (i = 1; i <= max_level; i++) {
+		for (j = 0; j < nr; j++)
+			levels[j] = i;
+		for (run = 0; run < nr_warmup + nr_runs; run++) {
+			double t;
+			int faces = 0;
+
+			t = sys_time();
+			for (j = 0; j < nr; j++)
+				res[j] = subdivide_opts(meshes[j], i, &opt);
+			t = sys_time() - t;
+			for (j = 0; j < nr; j++) {
+				faces += mesh_face_count(res[j]);
+				mesh_free(res[j]);
+			}
+			record(run, "subdivide", all, i, faces, t);
+
+			t = sys_time();
+			subdivide_batch(meshes, levels, res, nr, &opt, pool);
+			t = sys_time() - t;
+			for (j = 0; j < nr; j++)
+				mesh_free(res[j]);
+			record(run, "subdivide_batch", all, i, faces, t);
+		}
+	}
+
+	pool_free(pool);
+	for (i = 0; i < nr; i++)
+		mesh_free((struct mesh *) meshes[i]);
+	buf_free(meshes);
+	buf_free(res);
+	buf_free(levels);
+}
+
+static void report(FILE *json)
+{
+	struct stage *s;
+
+	printf("%-22s %-24s %5s %10s %12s %12s %14s\n", "stage", "asset",
+	       "level", "faces", "median ms", "p95 ms", "faces/s");
+	fprintf(json, "{\n  \"runs\": %d,\n  \"warmup\": %d,\n  \"simd\": \"%s\",\n"
+		"  \"local_order\": %d,\n  \"valence_kernels\": %d,\n  \"results\": [",
+		nr_runs, nr_warmup, mathx_simd_name(mathx_simd()), opt.local_order,
+		opt.valence_kernels);
+	buf_foreach(s, stages) {
+		int n = buf_len(s->samples);
+		double median, p95, rate;
+
+		qsort(s->samples, n, sizeof(*s->samples), cmp_double);
+		median = percentile(s->samples, n, 0.50);
+		p95 = percentile(s->samples, n, 0.95);
+		rate = median > 0.0 ? s->faces / median : 0.0;
+
+		printf("%-22s %-24s %5d %10d %12.3f %12.3f %14.0f\n",
+		       s->name, s->asset, s->level, s->faces,
+		       median * 1e3, p95 * 1e3, rate);
+		fprintf(json, "%s\n    { \"stage\": \"%s\", \"asset\": \"%s\", "
+			"\"level\": %d, \"faces\": %d, \"median_s\": %.9f, "
+			"\"p95_s\": %.9f, \"faces_per_s\": %.1f }",
+			s == stages ? "" : ",", s->name, s->asset, s->level,
+			s->faces, median, p95, rate);
+	}
+	fprintf(json, "\n  ]\n}\n");
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: sdbench [-l max_level] [-n runs] [-w warmup] [-s scalar|sse|avx]\n"
+		"               [-g shape[:key=value,...]] [-j threads] [-r] [-V]\n"
+		"               [-o out.json] [input.obj...]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int i, c, max_level = 4, nr_threads = 0;
+	const char *out = "bench.json", **specs = NULL, **names = NULL;
+	int *generated = NULL;
+	struct gen_params gp;
+	struct stage *s;
+	FILE *json;
+
+	sd_defaults(&opt);
+	while ((c = getopt(argc, argv, "l:n:w:s:g:j:rVo:h")) != -1) {
+		switch (c) {
+		case 'l':
+			max_level = atoi(optarg);
+			break;
+		case 'n':
+			nr_runs = atoi(optarg);
+			break;
+		case 'w':
+			nr_warmup = atoi(optarg);
+			break;
+		case 's':
+			for (i = MATHX_SCALAR; i <= MATHX_AVX; i++)
+				if (!strcmp(optarg, mathx_simd_name(i)))
+					break;
+			if (i > MATHX_AVX)
+				usage();
+			if (mathx_set_simd(i) != i)
+				fprintf(stderr, "sdbench: %s not supported, using %s\n",
+					optarg, mathx_simd_name(mathx_simd()));
+			break;
+		case 'g':
+			if (gen_parse(&gp, optarg))
+				usage();
+			buf_push(specs, optarg);
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		case 'r':
+			opt.local_order = 1;
+			break;
+		case 'V':
+			opt.valence_kernels = 0;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (max_level < 1 || max_level > MAX_LEVEL || nr_runs < 1 || nr_warmup < 0)
+		usage();
+
+	for (i = 0; i < buf_len(specs); i++) {
+		buf_push(names, specs[i]);
+		buf_push(generated, 1);
+	}
+	if (optind < argc) {
+		for (i = optind; i < argc; i++) {
+			buf_push(names, argv[i]);
+			buf_push(generated, 0);
+		}
+	} else if (!specs) {
+		for (i = 0; i < ARRAY_SIZE(assets); i++) {
+			buf_push(names, assets[i]);
+			buf_push(generated, 0);
+		}
+	}
+	for (i = 0; i < buf_len(names); i++)
+		bench_asset(names[i], generated[i], max_level);
+	if (nr_threads > 0)
+		bench_batch(names, generated, buf_len(names), max_level,
+			    nr_threads);
+	buf_free(specs);
+	buf_free(names);
+	buf_free(generated);
+
+	if (!(json = fopen(out, "w"))) {
+		fprintf(stderr, "sdbench: cannot write %s\n", out);
+		return 1;
+	}
+	report(json);
+	fclose(json);
+
+	buf_foreach(s, stages)
+		buf_free(s->samples);
+	buf_free(stages);
+	return 0;
+}
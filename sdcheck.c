@@ -0,0 +1,1108 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "buf.h"
+#include "bvh.h"
+#include "mathx.h"
+#include "mesh.h"
+#include "obj.h"
+#include "gen.h"
+#include "subd.h"
+#include "pool.h"
+#include "shm.h"
+#include "stats.h"
+#include "sys.h"
+#include "topo.h"
+#include "util.h"
+
+/*
+ * Differential check of the optimised subdivision paths.  Every engine
+ * must give the reference's topology exactly, up to a renumbering of the
+ * vertices, and its positions and normals within a tolerance.  It must
+ * also stay within its time budget, a multiple of the reference time, on
+ * inputs that take long enough to time.
+ */
+
+#define MAX_LEVEL		6
+#define MIN_TIMED		2e-3	/* Reference seconds below which budgets are skipped */
+
+static const char *assets[] = {
+	"objs/cube.obj",
+	"objs/tetra.obj",
+	"objs/bigguy.obj",
+	"objs/monsterfrog.obj",
+};
+
+/* Generated inputs, see gen_parse() */
+static const char *gen_assets[] = {
+	"torus:faces=2000",
+	"sphere:faces=2400,irregular=0.1",
+	"ngon:faces=2000,sides=12",
+	"pole:faces=1500,valence=48",
+};
+
+/* The reference: plain subdivide() with scalar vector kernels */
+static struct mesh *run_reference(const struct mesh *mesh, int level)
+{
+	struct mesh *res;
+	int simd = mathx_simd();
+
+	mathx_set_simd(MATHX_SCALAR);
+	res = subdivide(mesh, level);
+	mathx_set_simd(simd);
+	return res;
+}
+
+static struct mesh *run_simd(const struct mesh *mesh, int level)
+{
+	return subdivide(mesh, level);
+}
+
+static struct mesh *run_levels(const struct mesh *mesh, int level)
+{
+	struct mesh *levels[MAX_LEVEL];
+	int i;
+
+	subdivide_levels(mesh, levels, level);
+	for (i = 0; i < level - 1; i++)
+		mesh_free(levels[i]);
+	return levels[level - 1];
+}
+
+struct thread_job {
+	const struct mesh *mesh;
+	int level;
+	struct mesh *res;
+};
+
+static void thread_run(void *arg)
+{
+	struct thread_job *job = arg;
+
+	job->res = subdivide(job->mesh, job->level);
+}
+
+/* On a worker thread, which has its own allocator and stats state */
+static struct mesh *run_thread(const struct mesh *mesh, int level)
+{
+	static struct pool *pool;
+	struct thread_job job = { mesh, level, NULL };
+
+	if (!pool)
+		pool = pool_create(1);
+	pool_add(pool, thread_run, &job);
+	pool_wait(pool);
+	return job.res;
+}
+
+/* Two workers, so large meshes take the split path even on one cpu */
+static struct mesh *run_batch(const struct mesh *mesh, int level)
+{
+	static struct pool *pool;
+	struct mesh *res;
+
+	if (!pool)
+		pool = pool_create(2);
+	subdivide_batch(&mesh, &level, &res, 1, NULL, pool);
+	return res;
+}
+
+/* Same geometry with the vertices in another order */
+static struct mesh *run_local(const struct mesh *mesh, int level)
+{
+	struct sd_options opt;
+
+	sd_defaults(&opt);
+	opt.local_order = 1;
+	return subdivide_opts(mesh, level, &opt);
+}
+
+/* Every old vertex through the generic rule, which must match to the bit */
+static struct mesh *run_generic(const struct mesh *mesh, int level)
+{
+	struct sd_options opt;
+
+	sd_defaults(&opt);
+	opt.valence_kernels = 0;
+	return subdivide_opts(mesh, level, &opt);
+}
+
+/*
+ * Positions evaluated over a saved topology, through a file so the mapped
+ * path is the one checked.  The topology is kept for the next runs on the
+ * same mesh, so the timed runs are the warm ones.
+ */
+static struct mesh *run_topo(const struct mesh *mesh, int level)
+{
+	static const struct mesh *topo_mesh;
+	static struct sd_topo *topo;
+	char file[64];
+
+	if (!topo || mesh != topo_mesh || sd_topo_levels(topo) < level) {
+		struct sd_topo *built = sd_topo_build(mesh, level);
+
+		sd_topo_free(topo);
+		topo = NULL;
+		snprintf(file, sizeof(file), "/tmp/sdcheck.%d.sdtopo", (int) getpid());
+		if (built && !sd_topo_save(built, file))
+			topo = sd_topo_load(file);
+		unlink(file);
+		sd_topo_free(built);
+		topo_mesh = mesh;
+	}
+	return topo ? sd_topo_subdivide(topo, mesh, level) : NULL;
+}
+
+/*
+ * sd_export() into an unusual layout, 16-bit indices where they fit, read
+ * back into a mesh.  Refined faces are quads, so every face is four
+ * consecutive edges of the line buffer.  NULL when memory runs out.
+ */
+static struct mesh *run_export(const struct mesh *mesh, int level)
+{
+	struct sd_layout layout = { 32, 16, 0, 4 };
+	struct sd_counts c;
+	struct sd_mesh *sd;
+	struct mesh *res;
+	char *verts = NULL;
+	void *lines = NULL;
+	int i, j, err = 0;
+
+	if (!(sd = sd_init(mesh)))
+		return NULL;
+	for (i = 0; i < level && !err; i++)
+		err = sd_do_iteration(sd, i == 0, i + 1 == level);
+	if (!err) {
+		sd_export_counts(sd, &c);
+		if (c.verts <= 0x10000)
+			layout.index_size = 2;
+		verts = malloc((size_t) c.verts * layout.stride);
+		lines = malloc((size_t) 2 * c.lines * layout.index_size);
+		err = !verts || !lines ||
+		      sd_export(sd, &layout, verts, NULL, lines);
+	}
+	sd_free(sd);
+	if (err) {
+		free(verts);
+		free(lines);
+		return NULL;
+	}
+
+	res = mesh_create_shared();
+	for (i = 0; i < c.verts; i++) {
+		mesh_add_vertex(res, (float *) (verts + i * layout.stride + layout.position));
+		mesh_add_normal(res, (float *) (verts + i * layout.stride + layout.normal));
+	}
+	for (i = 0; i < c.faces; i++) {
+		mesh_begin_face(res);
+		for (j = 0; j < 4; j++) {
+			int k = 8 * i + 2 * j;
+			int vi = layout.index_size == 2 ? ((unsigned short *) lines)[k] :
+							  ((unsigned int *) lines)[k];
+
+			mesh_add_index(res, vi, vi);
+		}
+		mesh_end_face(res);
+	}
+	free(verts);
+	free(lines);
+	return res;
+}
+
+/*
+ * Published into shared memory and copied out by a reader, which must
+ * then see each later publish in turn.
+ */
+static struct mesh *run_shm(const struct mesh *mesh, int level)
+{
+	struct mesh *ref, *res = NULL, *next = NULL;
+	struct mesh_shm *writer, *reader = NULL;
+	char name[64];
+
+	snprintf(name, sizeof(name), "/sdcheck.%d", (int) getpid());
+	ref = subdivide(mesh, level);
+	if ((writer = mesh_shm_create(name)) && !mesh_shm_publish(writer, ref) &&
+	    (reader = mesh_shm_open(name)) && mesh_shm_acquire(reader, &res) == 1) {
+		if (mesh_shm_publish(writer, ref) || mesh_shm_publish(writer, ref) ||
+		    mesh_shm_acquire(reader, &next) != 3) {
+			mesh_free(res);
+			res = NULL;
+		}
+	}
+	mesh_free(next);
+	mesh_shm_close(reader);
+	mesh_shm_close(writer);
+	mesh_shm_unlink(name);
+	mesh_free(ref);
+	return res ? res : mesh_create();
+}
+
+/*
+ * Through the on-disk cache.  The first run on a mesh and level misses
+ * and fills it, so the timed runs are hits.  The entries are removed at
+ * exit.
+ */
+static char cache_dir[64];
+
+static struct mesh *run_cache(const struct mesh *mesh, int level)
+{
+	struct sd_options opt;
+
+	if (!cache_dir[0]) {
+		snprintf(cache_dir, sizeof(cache_dir), "/tmp/sdcheck.%d.cache",
+			 (int) getpid());
+		mkdir(cache_dir, 0755);
+	}
+	sd_defaults(&opt);
+	opt.cache_dir = cache_dir;
+	return subdivide_opts(mesh, level, &opt);
+}
+
+static void remove_cache(void)
+{
+	char file[512];
+	struct dirent *de;
+	DIR *d;
+
+	if (!cache_dir[0] || !(d = opendir(cache_dir)))
+		return;
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(file, sizeof(file), "%s/%s", cache_dir, de->d_name);
+		unlink(file);
+	}
+	closedir(d);
+	rmdir(cache_dir);
+}
+
+struct engine {
+	const char *name;
+	struct mesh *(*run)(const struct mesh *mesh, int level);
+	double budget;		/* Max best time relative to the reference */
+	int channels;		/* Carries the mesh channels */
+};
+
+static const struct engine engines[] = {
+	{ "simd",	run_simd,	1.25, 1 },
+	{ "levels",	run_levels,	1.75, 1 },
+	{ "thread",	run_thread,	1.50, 1 },
+	{ "export",	run_export,	1.50, 0 },
+	{ "batch",	run_batch,	1.50, 1 },
+	{ "local",	run_local,	1.50, 1 },
+	{ "generic",	run_generic,	1.50, 1 },
+	{ "topo",	run_topo,	0.75, 1 },
+	{ "shm",	run_shm,	2.00, 1 },
+	{ "cache",	run_cache,	0.25, 1 },
+};
+
+struct input {
+	char name[64];
+	struct mesh *mesh;
+	int pos_channel;	/* Vertex varying copy of the positions */
+};
+
+static struct input *inputs;
+static int nr_runs = 5, max_level = 3;
+static float tol = 1e-5f;
+
+static void add_input(const char *name, struct mesh *mesh)
+{
+	struct input in;
+
+	snprintf(in.name, sizeof(in.name), "%s", name);
+	in.mesh = mesh;
+	in.pos_channel = -1;
+	if (mesh) {
+		const float *vbuf;
+		int i, n = mesh_vertex_buffer(mesh, &vbuf);
+
+		in.pos_channel = mesh_add_channel(mesh, MESH_VERTEX_VARYING, 3);
+		for (i = 0; i < n; i++)
+			mesh_add_channel_value(mesh, in.pos_channel, vbuf + 3 * i);
+	}
+	buf_push(inputs, in);
+}
+
+static int check_failed(const char *engine, const struct input *in, int level,
+			const char *what)
+{
+	printf("FAIL  %-8s %-32s %d  %s\n", engine, in->name, level, what);
+	return -1;
+}
+
+static int near(const float *a, const float *b, float eps)
+{
+	return fabsf(a[0] - b[0]) <= eps && fabsf(a[1] - b[1]) <= eps &&
+	       fabsf(a[2] - b[2]) <= eps;
+}
+
+static int near_n(const float *a, const float *b, int n, float eps)
+{
+	int i;
+
+	if (!a || !b)
+		return !a == !b;
+	for (i = 0; i < n; i++)
+		if (fabsf(a[i] - b[i]) > eps)
+			return 0;
+	return 1;
+}
+
+/* Channel values of one corner, and the copy of the positions */
+static int compare_channels(const struct input *in, const struct mesh *ref,
+			    const struct mesh *res, int face, int vert,
+			    float eps, char *msg, int size)
+{
+	int ch;
+
+	for (ch = 0; ch < mesh_channel_count(ref); ch++) {
+		if (!near_n(mesh_get_channel(ref, ch, face, vert),
+			    mesh_get_channel(res, ch, face, vert),
+			    mesh_channel_width(ref, ch), eps)) {
+			snprintf(msg, size, "face %d corner %d: channel %d differs",
+				 face, vert, ch);
+			return -1;
+		}
+	}
+	if (!near_n(mesh_get_channel(res, in->pos_channel, face, vert),
+		    mesh_get_vertex(res, face, vert), 3, eps)) {
+		snprintf(msg, size, "face %d corner %d: vertex varying channel "
+			 "does not follow the position", face, vert);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Same faces with the same corner order, and a one to one vertex map
+ * that is consistent across all faces.  Positions, normals and channel
+ * values are compared through that map.
+ */
+static int compare(const struct engine *e, const struct input *in, int level,
+		   const struct mesh *ref, const struct mesh *res)
+{
+	const char *engine = e->name;
+	int i, j, nr_verts, nr_faces, err = 0;
+	int *fwd = NULL, *bwd = NULL;
+	vector min, max;
+	const float *vbuf;
+	float eps;
+	char msg[128];
+
+	if (!ref || !res)
+		return check_failed(engine, in, level, ref ? "no result" :
+				    "no reference result");
+	nr_verts = mesh_vertex_buffer(ref, &vbuf);
+	nr_faces = mesh_face_count(ref);
+	if (nr_verts != mesh_vertex_buffer(res, NULL) ||
+	    nr_faces != mesh_face_count(res)) {
+		snprintf(msg, sizeof(msg), "size %d/%d verts, %d/%d faces",
+			 mesh_vertex_buffer(res, NULL), nr_verts,
+			 mesh_face_count(res), nr_faces);
+		return check_failed(engine, in, level, msg);
+	}
+	if (e->channels && mesh_channel_count(ref) != mesh_channel_count(res)) {
+		snprintf(msg, sizeof(msg), "%d channels, expected %d",
+			 mesh_channel_count(res), mesh_channel_count(ref));
+		return check_failed(engine, in, level, msg);
+	}
+
+	vec_bounds_n(min, max, vbuf, nr_verts);
+	eps = tol * MAX(1.0f, vec_dist(min, max));
+
+	buf_resize(fwd, nr_verts);
+	buf_resize(bwd, nr_verts);
+	memset(fwd, -1, nr_verts * sizeof(*fwd));
+	memset(bwd, -1, nr_verts * sizeof(*bwd));
+	for (i = 0; i < nr_faces && !err; i++) {
+		int n = mesh_face_vertex_count(ref, i);
+
+		if (n != mesh_face_vertex_count(res, i)) {
+			snprintf(msg, sizeof(msg), "face %d has %d corners, expected %d",
+				 i, mesh_face_vertex_count(res, i), n);
+			err = check_failed(engine, in, level, msg);
+			break;
+		}
+		for (j = 0; j < n; j++) {
+			int a, b, ni;
+			const float *na, *nb;
+
+			mesh_face_vertex_index(ref, i, j, &a, &ni);
+			mesh_face_vertex_index(res, i, j, &b, &ni);
+			if ((fwd[a] != -1 && fwd[a] != b) ||
+			    (bwd[b] != -1 && bwd[b] != a)) {
+				snprintf(msg, sizeof(msg), "face %d corner %d: vertex %d "
+					 "maps to both %d and %d", i, j, a, fwd[a], b);
+				err = check_failed(engine, in, level, msg);
+				break;
+			}
+			fwd[a] = b;
+			bwd[b] = a;
+
+			if (!near(mesh_get_vertex(ref, i, j), mesh_get_vertex(res, i, j), eps)) {
+				snprintf(msg, sizeof(msg), "vertex %d off by more than %g",
+					 a, eps);
+				err = check_failed(engine, in, level, msg);
+				break;
+			}
+			na = mesh_get_normal(ref, i, j);
+			nb = mesh_get_normal(res, i, j);
+			if (!na != !nb || (na && !near(na, nb, 100 * tol))) {
+				snprintf(msg, sizeof(msg), "normal of vertex %d differs", a);
+				err = check_failed(engine, in, level, msg);
+				break;
+			}
+			if (e->channels &&
+			    compare_channels(in, ref, res, i, j, eps, msg, sizeof(msg))) {
+				err = check_failed(engine, in, level, msg);
+				break;
+			}
+		}
+	}
+	buf_free(fwd);
+	buf_free(bwd);
+	return err;
+}
+
+static double time_one(struct mesh *(*run)(const struct mesh *, int),
+		       const struct mesh *mesh, int level, struct mesh **res)
+{
+	double t;
+
+	mesh_free(*res);
+	t = sys_time();
+	*res = run(mesh, level);
+	return sys_time() - t;
+}
+
+/*
+ * Best of nr_runs for the reference and the engine, run alternately so
+ * that both see the same machine load.  The results of the last runs are
+ * left in ref and res.
+ */
+static double time_ratio(const struct engine *e, const struct mesh *mesh,
+			 int level, struct mesh **ref, struct mesh **res,
+			 double *t_ref)
+{
+	double t = INFINITY;
+	int i;
+
+	*t_ref = INFINITY;
+	for (i = 0; i < nr_runs; i++) {
+		*t_ref = MIN(*t_ref, time_one(run_reference, mesh, level, ref));
+		t = MIN(t, time_one(e->run, mesh, level, res));
+	}
+	return t / *t_ref;
+}
+
+static int check_input(const struct input *in, const char *only)
+{
+	int i, level, fails = 0;
+
+	for (level = 1; level <= max_level; level++) {
+		for (i = 0; i < ARRAY_SIZE(engines); i++) {
+			const struct engine *e = &engines[i];
+			struct mesh *ref = NULL, *res = NULL;
+			double t_ref, ratio;
+			char msg[128];
+
+			if (only && strcmp(only, e->name))
+				continue;
+			ratio = time_ratio(e, in->mesh, level, &ref, &res, &t_ref);
+			/* Confirm an over budget time before calling it a regression */
+			if (t_ref >= MIN_TIMED && ratio > e->budget)
+				ratio = time_ratio(e, in->mesh, level, &ref, &res, &t_ref);
+			if (compare(e, in, level, ref, res)) {
+				fails++;
+			} else if (t_ref >= MIN_TIMED && ratio > e->budget) {
+				snprintf(msg, sizeof(msg), "%.2fx reference time, budget %.2fx",
+					 ratio, e->budget);
+				check_failed(e->name, in, level, msg);
+				fails++;
+			} else {
+				printf("ok    %-8s %-32s %d  %.2fx%s\n", e->name,
+				       in->name, level, ratio,
+				       t_ref >= MIN_TIMED ? "" : " (untimed)");
+			}
+			mesh_free(ref);
+			mesh_free(res);
+		}
+	}
+	return fails;
+}
+
+/*
+ * Picking trees, on every level: rays and closest points must match a
+ * brute force search over all triangles, with a serial and a pooled
+ * build, before and after the vertices move and the trees are refitted.
+ * The queries must also take less than BVH_BUDGET of the brute force time.
+ * A ray that grazes an edge may hit the triangle behind instead, hence
+ * the looser tolerance.
+ */
+#define NR_RAYS			128
+#define NR_POINTS		32
+#define BVH_BUDGET		0.25
+#define BVH_MAX_LEVEL		2	/* Brute force beyond takes too long */
+
+static unsigned int rnd_state = 1;
+
+static float rnd(void)
+{
+	rnd_state = rnd_state * 1664525u + 1013904223u;
+	return (rnd_state >> 8) / 16777216.0f;
+}
+
+/* Plane hit, then inside all three edges, unlike bvh.c's Moller-Trumbore */
+static float brute_ray_tri(const float *org, const float *dir, const float *a,
+			   const float *b, const float *c)
+{
+	const float *v[3] = { a, b, c };
+	vector ab, ac, n, d, p, e, x;
+	float denom, t;
+	int i;
+
+	vec_sub(ab, b, a);
+	vec_sub(ac, c, a);
+	vec_cross(n, ab, ac);
+	denom = vec_dot(n, dir);
+	if (denom == 0.0f)
+		return INFINITY;
+	vec_sub(d, a, org);
+	t = vec_dot(n, d) / denom;
+	if (t < 0.0f)
+		return INFINITY;
+	vec_copy(p, org);
+	vec_mad(p, t, dir);
+	for (i = 0; i < 3; i++) {
+		vec_sub(e, v[(i + 1) % 3], v[i]);
+		vec_sub(d, p, v[i]);
+		vec_cross(x, e, d);
+		if (vec_dot(n, x) < 0.0f)
+			return INFINITY;
+	}
+	return t;
+}
+
+static float segment_dist(const float *p, const float *a, const float *b)
+{
+	vector ab, ap, q;
+	float l2, t;
+
+	vec_sub(ab, b, a);
+	vec_sub(ap, p, a);
+	l2 = vec_dot(ab, ab);
+	t = l2 > 0.0f ? clampf(vec_dot(ap, ab) / l2, 0.0f, 1.0f) : 0.0f;
+	vec_copy(q, a);
+	vec_mad(q, t, ab);
+	return vec_dist(p, q);
+}
+
+/* Distance to the plane when p projects inside, else to the nearest edge */
+static float brute_tri_dist(const float *p, const float *a, const float *b,
+			    const float *c)
+{
+	const float *v[3] = { a, b, c };
+	vector ab, ac, n, d, e, x;
+	float l2, h;
+	int i, inside = 1;
+
+	vec_sub(ab, b, a);
+	vec_sub(ac, c, a);
+	vec_cross(n, ab, ac);
+	l2 = vec_dot(n, n);
+	for (i = 0; i < 3 && l2 > 0.0f; i++) {
+		vec_sub(e, v[(i + 1) % 3], v[i]);
+		vec_sub(d, p, v[i]);
+		vec_cross(x, e, d);
+		if (vec_dot(n, x) < 0.0f)
+			inside = 0;
+	}
+	if (l2 > 0.0f && inside) {
+		vec_sub(d, p, a);
+		h = vec_dot(n, d);
+		return fabsf(h) / sqrtf(l2);
+	}
+	return MIN(segment_dist(p, a, b),
+		   MIN(segment_dist(p, b, c), segment_dist(p, c, a)));
+}
+
+/* Calls fn on every fan triangle of the mesh */
+#define foreach_tri(mesh, f, j, a, b, c)					\
+	for (f = 0; f < mesh_face_count(mesh); f++)				\
+		for (j = 1; j + 1 < mesh_face_vertex_count(mesh, f) &&		\
+		     (a = mesh_get_vertex(mesh, f, 0),				\
+		      b = mesh_get_vertex(mesh, f, j),				\
+		      c = mesh_get_vertex(mesh, f, j + 1)); j++)
+
+struct bvh_query {
+	vector org, dir;	/* dir unused for closest points */
+	float want;		/* Brute force t or distance */
+	struct bvh_hit hit;
+};
+
+/*
+ * Rays from outside the bounds at points inside random triangles, plus
+ * some in random directions that may miss, and points around the mesh.
+ */
+static void bvh_queries(const struct mesh *mesh, struct bvh_query *q)
+{
+	vector min, max, size;
+	const float *vbuf;
+	int i, k, nr_verts;
+
+	nr_verts = mesh_vertex_buffer(mesh, &vbuf);
+	vec_bounds_n(min, max, vbuf, nr_verts);
+	vec_sub(size, max, min);
+	for (i = 0; i < NR_RAYS + NR_POINTS; i++) {
+		vector at;
+
+		for (k = 0; k < 3; k++)
+			at[k] = min[k] + (1.5f * rnd() - 0.25f) * size[k];
+		if (i < NR_RAYS && i % 4) {
+			int f = rnd() * mesh_face_count(mesh);
+			int j = 1 + rnd() * (mesh_face_vertex_count(mesh, f) - 2);
+
+			vec_zero(at);
+			vec_mad(at, 0.2f, mesh_get_vertex(mesh, f, 0));
+			vec_mad(at, 0.3f, mesh_get_vertex(mesh, f, j));
+			vec_mad(at, 0.5f, mesh_get_vertex(mesh, f, j + 1));
+		}
+		vec_spherical(q[i].dir, TAU * rnd(), acosf(2.0f * rnd() - 1.0f));
+		vec_copy(q[i].org, at);
+		vec_mad(q[i].org, -2.0f * vec_len(size), q[i].dir);
+		if (i >= NR_RAYS)
+			vec_copy(q[i].org, at);
+	}
+}
+
+static double bvh_brute(const struct mesh *mesh, struct bvh_query *q)
+{
+	const float *a, *b, *c;
+	double t = sys_time();
+	int i, f, j;
+
+	for (i = 0; i < NR_RAYS + NR_POINTS; i++) {
+		q[i].want = INFINITY;
+		foreach_tri(mesh, f, j, a, b, c) {
+			float d = i < NR_RAYS ?
+				  brute_ray_tri(q[i].org, q[i].dir, a, b, c) :
+				  brute_tri_dist(q[i].org, a, b, c);
+
+			q[i].want = MIN(q[i].want, d);
+		}
+	}
+	return sys_time() - t;
+}
+
+static double bvh_run(const struct bvh *bvh, struct bvh_query *q)
+{
+	double t = sys_time();
+	int i;
+
+	for (i = 0; i < NR_RAYS; i++)
+		bvh_ray(bvh, q[i].org, q[i].dir, INFINITY, &q[i].hit);
+	for (; i < NR_RAYS + NR_POINTS; i++)
+		bvh_nearest(bvh, q[i].org, INFINITY, &q[i].hit);
+	return sys_time() - t;
+}
+
+static int bvh_compare(const struct input *in, int level, const char *what,
+		       const struct mesh *mesh, const struct bvh_query *q,
+		       float eps)
+{
+	char msg[128];
+	int i;
+
+	for (i = 0; i < NR_RAYS + NR_POINTS; i++) {
+		const struct bvh_hit *h = &q[i].hit;
+		float got = h->face >= 0 ? h->t : INFINITY;
+
+		if (got == q[i].want || fabsf(got - q[i].want) <= eps)
+			continue;
+		snprintf(msg, sizeof(msg), "%s %s %d: %g, brute force %g", what,
+			 i < NR_RAYS ? "ray" : "point", i, got, q[i].want);
+		return check_failed("bvh", in, level, msg);
+	}
+	return 0;
+}
+
+static int check_bvh(const struct input *in, int level)
+{
+	static struct pool *pool;
+	struct bvh_query q[NR_RAYS + NR_POINTS], qp[NR_RAYS + NR_POINTS];
+	struct bvh *bvh, *pooled;
+	struct mesh *mesh;
+	double t_bvh, t_brute;
+	vector min, max;
+	const float *vbuf;
+	float eps, scale;
+	int i, k, err, nr_verts;
+
+	if (!pool)
+		pool = pool_create(2);
+	if (!(mesh = subdivide(in->mesh, level)))
+		return -check_failed("bvh", in, level, "no refined mesh");
+	nr_verts = mesh_vertex_buffer(mesh, &vbuf);
+	vec_bounds_n(min, max, vbuf, nr_verts);
+	scale = vec_dist(min, max);
+	eps = 1e-3f * MAX(1.0f, scale);
+
+	bvh = bvh_build(mesh, NULL);
+	pooled = bvh_build(mesh, pool);
+	bvh_queries(mesh, q);
+	t_brute = bvh_brute(mesh, q);
+	memcpy(qp, q, sizeof(q));
+	t_bvh = bvh_run(bvh, q);
+	bvh_run(pooled, qp);
+	err = bvh_compare(in, level, "built", mesh, q, eps) ||
+	      bvh_compare(in, level, "pooled", mesh, qp, eps);
+
+	/* A smooth bend, large next to the triangles */
+	for (i = 0; i < nr_verts && !err; i++) {
+		vector p;
+
+		vec_copy(p, vbuf + 3 * i);
+		for (k = 0; k < 3; k++)
+			p[k] += 0.05f * scale * sinf(7.0f * p[(k + 1) % 3] / scale);
+		mesh_set_vertex(mesh, i, p);
+	}
+	if (!err) {
+		bvh_refit(bvh);
+		bvh_refit(pooled);
+		bvh_queries(mesh, q);
+		bvh_brute(mesh, q);
+		memcpy(qp, q, sizeof(q));
+		bvh_run(bvh, q);
+		bvh_run(pooled, qp);
+		err = bvh_compare(in, level, "refit", mesh, q, eps) ||
+		      bvh_compare(in, level, "refit pooled", mesh, qp, eps);
+	}
+
+	if (!err && t_brute >= MIN_TIMED && t_bvh / t_brute > BVH_BUDGET) {
+		char msg[128];
+
+		snprintf(msg, sizeof(msg), "%.3fx brute force time, budget %.2fx",
+			 t_bvh / t_brute, BVH_BUDGET);
+		err = check_failed("bvh", in, level, msg);
+	} else if (!err) {
+		printf("ok    %-8s %-32s %d  %.3fx%s\n", "bvh", in->name, level,
+		       t_bvh / t_brute, t_brute >= MIN_TIMED ? "" : " (untimed)");
+	}
+	bvh_free(bvh);
+	bvh_free(pooled);
+	mesh_free(mesh);
+	return err ? 1 : 0;
+}
+
+/*
+ * Counters of a mesh refined through subdivide_batch(), whose iterations
+ * are split across a pool for large meshes, must match those of a serial
+ * subdivide().  Only meaningful in a library built with SD_STATS.
+ */
+static int check_stats(const struct input *in, int level)
+{
+	static struct pool *pool;
+	const struct mesh *mesh = in->mesh;
+	const struct sd_stats *st = sd_stats_get();
+	struct sd_stats serial;
+	struct mesh *res = NULL;
+	char msg[128];
+	int i;
+
+	if (!pool)
+		pool = pool_create(4);
+	mesh_free(subdivide(mesh, level));
+	serial = *st;
+	sd_stats_reset();
+	subdivide_batch(&mesh, &level, &res, 1, NULL, pool);
+	mesh_free(res);
+
+	if (!st->nr_levels) {
+		printf("ok    %-8s %-32s %d  (refined on a worker)\n", "stats",
+		       in->name, level);
+		return 0;
+	}
+	for (i = 0; i < serial.nr_levels; i++) {
+		const struct sd_level_stats *a = &serial.level[i], *b = &st->level[i];
+
+		if (st->nr_levels != serial.nr_levels ||
+		    a->edge_lookups != b->edge_lookups ||
+		    a->edge_probes != b->edge_probes ||
+		    a->nr_verts != b->nr_verts || a->nr_faces != b->nr_faces ||
+		    a->nr_edges != b->nr_edges) {
+			snprintf(msg, sizeof(msg), "level %d: %ld/%ld lookups, "
+				 "%ld/%ld probes with a pool", i, b->edge_lookups,
+				 a->edge_lookups, b->edge_probes, a->edge_probes);
+			return -check_failed("stats", in, level, msg);
+		}
+	}
+	printf("ok    %-8s %-32s %d  %ld lookups\n", "stats", in->name, level,
+	       serial.level[level].edge_lookups);
+	return 0;
+}
+
+/*
+ * Every SIMD level of the batched vector kernels against the scalar one,
+ * which they must match bit for bit, on lengths that leave tails of every
+ * size and on pointers that are not 16 byte aligned.
+ */
+#define KERNEL_MAX		1001
+#define KERNEL_OUT		(8 * 3 * KERNEL_MAX + 6)
+#define NR_BOXES		4096
+
+static const int kernel_lengths[] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 15, 16, 17, 23, 31, 33,
+	KERNEL_MAX,
+};
+
+static const char *kernel_names[] = {
+	"transform points", "transform vectors", "transform in place",
+	"normalize", "normalize in place", "cross", "axpy", "bounds",
+};
+
+/* Each kernel's output, 3n floats apiece and then the bounds */
+static void run_kernels(float *out, const matrix m, const float *a,
+			const float *b, int n)
+{
+	int k = 3 * n;
+
+	vec_transform_points(out, m, a, n);
+	vec_transform_vectors(out + k, m, a, n);
+	memcpy(out + 2 * k, a, k * sizeof(float));
+	vec_transform_points(out + 2 * k, m, out + 2 * k, n);
+	vec_normalize_n(out + 3 * k, a, n);
+	memcpy(out + 4 * k, b, k * sizeof(float));
+	vec_normalize_n(out + 4 * k, out + 4 * k, n);
+	vec_cross_n(out + 5 * k, a, b, n);
+	memcpy(out + 6 * k, b, k * sizeof(float));
+	vec_axpy_n(out + 6 * k, 0.37f, a, n);
+	vec_bounds_n(out + 7 * k, out + 7 * k + 3, a, n);
+}
+
+static int kernels_failed(int level, int n, const char *what)
+{
+	printf("FAIL  %-8s %-32s %d  n=%d: %s differs from scalar\n", "kernels",
+	       mathx_simd_name(level), level, n, what);
+	return 1;
+}
+
+/* Brute force: all eight corners behind one plane */
+static int brute_cull_box(const float *planes, const vector min,
+			  const vector max)
+{
+	int i, j;
+
+	for (i = 0; i < 6; i++) {
+		const float *p = planes + 4 * i;
+
+		for (j = 0; j < 8; j++) {
+			vector v;
+
+			v[0] = j & 1 ? max[0] : min[0];
+			v[1] = j & 2 ? max[1] : min[1];
+			v[2] = j & 4 ? max[2] : min[2];
+			if (vec_dot(p, v) + p[3] >= 0.0f)
+				break;
+		}
+		if (j == 8)
+			return 1;
+	}
+	return 0;
+}
+
+static int check_frustum(void)
+{
+	static const vector eye = { 1.0f, 2.0f, 6.0f }, at = { 0.0f, 0.5f, 0.0f };
+	static const vector up = { 0.0f, 1.0f, 0.0f };
+	matrix proj, view, m;
+	float planes[24];
+	vector min, max, c;
+	int i, k, culled = 0;
+
+	mat_persp(proj, 45.0f, 1.5f, 0.1f, 20.0f);
+	mat_lookat(view, eye, at, up);
+	mat_mul(m, proj, view);
+	mat_frustum_planes(planes, m);
+
+	/* Around the point looked at and around a point behind the eye */
+	for (k = 0; k < 3; k++) {
+		min[k] = at[k] - 0.1f;
+		max[k] = at[k] + 0.1f;
+	}
+	if (frustum_cull_box(planes, min, max)) {
+		printf("FAIL  %-8s %-32s %d  box in view culled\n", "kernels",
+		       "frustum", 0);
+		return 1;
+	}
+	for (k = 0; k < 3; k++) {
+		c[k] = 2.0f * eye[k] - at[k];
+		min[k] = c[k] - 0.1f;
+		max[k] = c[k] + 0.1f;
+	}
+	if (!frustum_cull_box(planes, min, max)) {
+		printf("FAIL  %-8s %-32s %d  box behind the eye kept\n",
+		       "kernels", "frustum", 0);
+		return 1;
+	}
+
+	for (i = 0; i < NR_BOXES; i++) {
+		for (k = 0; k < 3; k++) {
+			float a = 30.0f * rnd() - 15.0f, b = a + 4.0f * rnd();
+
+			min[k] = a;
+			max[k] = b;
+		}
+		culled += frustum_cull_box(planes, min, max);
+		if (frustum_cull_box(planes, min, max) !=
+		    brute_cull_box(planes, min, max)) {
+			printf("FAIL  %-8s %-32s %d  box %d differs from brute "
+			       "force\n", "kernels", "frustum", 0, i);
+			return 1;
+		}
+	}
+	printf("ok    %-8s %-32s %d  %d of %d boxes culled\n", "kernels",
+	       "frustum", 0, culled, NR_BOXES);
+	return 0;
+}
+
+static int check_kernels(void)
+{
+	int simd = mathx_simd(), level, i, j, n, fails = 0;
+	float *src, *a, *b, *ref, *out;
+	matrix m;
+
+	/* One float past a 16 byte boundary, so no access is aligned */
+	src = malloc((2 * 3 * KERNEL_MAX + 1) * sizeof(float));
+	ref = malloc((KERNEL_OUT + 1) * sizeof(float));
+	out = malloc((KERNEL_OUT + 1) * sizeof(float));
+	a = src + 1;
+	b = a + 3 * KERNEL_MAX;
+	for (i = 0; i < 3 * KERNEL_MAX; i++) {
+		a[i] = 4.0f * rnd() - 2.0f;
+		b[i] = 4.0f * rnd() - 2.0f;
+	}
+	for (i = 0; i < 16; i++)
+		m[i] = 2.0f * rnd() - 1.0f;
+
+	for (level = MATHX_SSE; level <= MATHX_AVX; level++) {
+		if (mathx_set_simd(level) != level) {
+			printf("ok    %-8s %-32s %d  (not supported)\n", "kernels",
+			       mathx_simd_name(level), level);
+			continue;
+		}
+		for (i = 0; i < ARRAY_SIZE(kernel_lengths); i++) {
+			n = kernel_lengths[i];
+			mathx_set_simd(MATHX_SCALAR);
+			run_kernels(ref + 1, m, a, b, n);
+			mathx_set_simd(level);
+			run_kernels(out + 1, m, a, b, n);
+			for (j = 0; j < ARRAY_SIZE(kernel_names); j++) {
+				int size = j < 7 ? 3 * n : 6;
+
+				if (memcmp(ref + 1 + 3 * n * j, out + 1 + 3 * n * j,
+					   size * sizeof(float)))
+					break;
+			}
+			if (j < ARRAY_SIZE(kernel_names)) {
+				fails += kernels_failed(level, n, kernel_names[j]);
+				break;
+			}
+		}
+		if (i == ARRAY_SIZE(kernel_lengths))
+			printf("ok    %-8s %-32s %d\n", "kernels",
+			       mathx_simd_name(level), level);
+	}
+	mathx_set_simd(simd);
+	free(src);
+	free(ref);
+	free(out);
+	return fails + check_frustum();
+}
+
+static void add_generated(const char *spec)
+{
+	struct gen_params p;
+
+	if (gen_parse(&p, spec)) {
+		fprintf(stderr, "sdcheck: bad generator spec %s\n", spec);
+		exit(1);
+	}
+	add_input(spec, gen_mesh(&p));
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: sdcheck [-l max_level] [-n runs] [-t tolerance] [-e engine]\n"
+		"               [-g shape[:key=value,...]] [input.obj...]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int i, c, fails = 0;
+	const char *only = NULL;
+	struct input *in;
+
+	while ((c = getopt(argc, argv, "l:n:t:e:g:h")) != -1) {
+		switch (c) {
+		case 'l':
+			max_level = atoi(optarg);
+			break;
+		case 'n':
+			nr_runs = atoi(optarg);
+			break;
+		case 't':
+			tol = atof(optarg);
+			break;
+		case 'e':
+			only = optarg;
+			break;
+		case 'g':
+			add_generated(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (max_level < 1 || max_level > MAX_LEVEL || nr_runs < 1)
+		usage();
+
+	if (optind < argc || inputs) {
+		for (i = optind; i < argc; i++)
+			add_input(argv[i], obj_read(argv[i]));
+	} else {
+		for (i = 0; i < ARRAY_SIZE(assets); i++)
+			add_input(assets[i], obj_read(assets[i]));
+		for (i = 0; i < ARRAY_SIZE(gen_assets); i++)
+			add_generated(gen_assets[i]);
+	}
+
+	if (!only || !strcmp(only, "kernels"))
+		fails += check_kernels();
+	buf_foreach(in, inputs) {
+		if (!in->mesh) {
+			printf("FAIL  cannot read %s\n", in->name);
+			fails++;
+			continue;
+		}
+		fails += check_input(in, only);
+		if (sd_stats_get()->enabled && (!only || !strcmp(only, "stats")))
+			fails += check_stats(in, max_level);
+		for (i = 1; i <= MIN(max_level, BVH_MAX_LEVEL) &&
+			    (!only || !strcmp(only, "bvh")); i++)
+			fails += check_bvh(in, i);
+		mesh_free(in->mesh);
+	}
+	buf_free(inputs);
+	remove_cache();
+
+	printf("%s: %d failure%s\n", fails ? "FAILED" : "passed", fails,
+	       fails == 1 ? "" : "s");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "buf.h"
+#include "mesh.h"
+#include "obj.h"
+#include "pool.h"
+#include "rpc.h"
+#include "subd.h"
+#include "sys.h"
+#include "util.h"
+
+/*
+ * Load generator for sdserve.  Every client opens its own connection and
+ * sends its requests back to back, cycling through the inputs from a
+ * different one each, then the client and server side latencies are
+ * printed.  With -v the vertices of each input move a little every
+ * request, so results miss the cache while topologies still hit.
+ */
+
+struct client {
+	int id;
+	double *latencies;
+	int failed;
+};
+
+static const char *path;
+static struct mesh **inputs;
+static int nr_requests = 100, level = 2, move;
+static struct sd_options opt;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: sdload [-c clients] [-n requests] [-l level] [-r] [-v] socket input.obj...\n"
+		"\n"
+		"  -c clients   number of concurrent connections (default 4)\n"
+		"  -n requests  requests per connection (default 100)\n"
+		"  -l level     number of subdivision iterations (default 2)\n"
+		"  -r           renumber vertices for locality after each level\n"
+		"  -v           move the vertices so results are never cached\n");
+	exit(1);
+}
+
+static void run_client(void *arg)
+{
+	struct client *cl = arg;
+	struct sd_client *c;
+	struct mesh *copy = NULL;
+	int i;
+
+	if (!(c = sd_client_connect(path))) {
+		cl->failed = nr_requests;
+		return;
+	}
+	for (i = 0; i < nr_requests; i++) {
+		const struct mesh *mesh = inputs[(cl->id + i) % buf_len(inputs)];
+		struct mesh *res;
+		double t;
+
+		if (move) {
+			float v[3];
+			const float *vbuf;
+			size_t size = mesh_pack_size(mesh);
+			struct mesh_view view;
+			void *image = malloc(size);
+
+			if (image && !mesh_pack(mesh, image) &&
+			    !mesh_view(image, size, &view))
+				copy = mesh_unpack(&view);
+			free(image);
+			if (!copy) {
+				cl->failed++;
+				continue;
+			}
+			mesh_vertex_buffer(copy, &vbuf);
+			memcpy(v, vbuf, sizeof(v));
+			v[0] += 1e-3f * (cl->id * nr_requests + i + 1);
+			mesh_set_vertex(copy, 0, v);
+			mesh = copy;
+		}
+
+		t = sys_time();
+		res = sd_client_subdivide(c, mesh, level, &opt);
+		buf_push(cl->latencies, sys_time() - t);
+		if (!res)
+			cl->failed++;
+		mesh_free(res);
+		mesh_free(copy);
+		copy = NULL;
+	}
+	sd_client_close(c);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, int n, double p)
+{
+	int i = (int) (p * (n - 1) + 0.5);
+	return sorted[MIN(i, n - 1)];
+}
+
+int main(int argc, char **argv)
+{
+	int i, c, nr_clients = 4, failed = 0;
+	struct client *clients;
+	double *lat = NULL, t;
+	struct sd_rpc_stats st;
+	struct sd_client *sc;
+	struct pool *pool;
+
+	sd_defaults(&opt);
+	while ((c = getopt(argc, argv, "c:n:l:rvh")) != -1) {
+		switch (c) {
+		case 'c':
+			nr_clients = atoi(optarg);
+			break;
+		case 'n':
+			nr_requests = atoi(optarg);
+			break;
+		case 'l':
+			level = atoi(optarg);
+			break;
+		case 'r':
+			opt.local_order = 1;
+			break;
+		case 'v':
+			move = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind < 2 || nr_clients <= 0 || nr_requests <= 0 || level < 0)
+		usage();
+	path = argv[optind];
+	for (i = optind + 1; i < argc; i++) {
+		struct mesh *mesh = obj_read(argv[i]);
+
+		if (!mesh) {
+			fprintf(stderr, "sdload: cannot read %s\n", argv[i]);
+			return 1;
+		}
+		buf_push(inputs, mesh);
+	}
+
+	clients = calloc(nr_clients, sizeof(*clients));
+	t = sys_time();
+	pool = pool_create(nr_clients);
+	for (i = 0; i < nr_clients; i++) {
+		clients[i].id = i;
+		pool_add(pool, run_client, &clients[i]);
+	}
+	pool_wait(pool);
+	pool_free(pool);
+	t = sys_time() - t;
+
+	for (i = 0; i < nr_clients; i++) {
+		int j;
+
+		for (j = 0; j < buf_len(clients[i].latencies); j++)
+			buf_push(lat, clients[i].latencies[j]);
+		failed += clients[i].failed;
+		buf_free(clients[i].latencies);
+	}
+	printf("%d requests, %d failed in %.3fs, %.1f requests/s\n",
+	       nr_clients * nr_requests, failed, t, buf_len(lat) / t);
+	if (buf_len(lat)) {
+		int n = buf_len(lat);
+
+		qsort(lat, n, sizeof(*lat), cmp_double);
+		printf("client latency: p50 %.3fms p95 %.3fms p99 %.3fms max %.3fms\n",
+		       percentile(lat, n, 0.50) * 1e3, percentile(lat, n, 0.95) * 1e3,
+		       percentile(lat, n, 0.99) * 1e3, lat[n - 1] * 1e3);
+	}
+
+	if ((sc = sd_client_connect(path)) && !sd_client_stats(sc, &st)) {
+		printf("server: up %.1fs, %d threads, %lld requests, %lld failed, "
+		       "max queue %d\n", st.uptime, st.threads,
+		       (long long) st.requests, (long long) st.failed, st.max_queued);
+		printf("server: %lld result hits, %d results in %.1f MiB, "
+		       "%lld topology hits, %lld built\n",
+		       (long long) st.result_hits, st.result_entries,
+		       st.result_bytes / (1024.0 * 1024.0),
+		       (long long) st.topo_hits, (long long) st.topo_builds);
+		printf("server latency: mean %.3fms p50 %.3fms p95 %.3fms "
+		       "p99 %.3fms max %.3fms, queued %.3fms\n",
+		       st.latency_mean * 1e3, st.latency_p50 * 1e3,
+		       st.latency_p95 * 1e3, st.latency_p99 * 1e3,
+		       st.latency_max * 1e3, st.wait_mean * 1e3);
+	} else {
+		fprintf(stderr, "sdload: cannot get server stats\n");
+		failed++;
+	}
+	sd_client_close(sc);
+
+	free(clients);
+	for (i = 0; i < buf_len(inputs); i++)
+		mesh_free(inputs[i]);
+	buf_free(inputs);
+	buf_free(lat);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,567 @@
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "buf.h"
+#include "mesh.h"
+#include "pool.h"
+#include "rpc.h"
+#include "subd.h"
+#include "sys.h"
+#include "topo.h"
+#include "util.h"
+
+/*
+ * Subdivision daemon.  A thread per connection reads requests and queues
+ * them on a pool that lives as long as the server, so the workers and
+ * their allocations stay warm.  Recent results are cached by a hash of
+ * the request and recent topologies by sd_topo_hash() of the base mesh,
+ * so a cage that only moved its vertices skips the topology work.
+ */
+
+#define NR_LATENCIES		4096	/* Window the latency stats cover */
+
+/*
+ * Entries are shared with the requests using them: the cache holds one
+ * reference and every user another, and the last one frees the data.
+ * level is the number of levels of a topology.
+ */
+struct cache_entry {
+	uint64_t key;
+	int level;
+	void *data;
+	size_t bytes;
+	int refs;
+	unsigned long used;
+};
+
+struct cache {
+	struct cache_entry **entries;
+	size_t bytes, budget;
+	int max_entries;
+	void (*free)(void *data);
+};
+
+struct job {
+	void *image;
+	size_t size;
+	int level;
+	struct sd_options opt;
+	double arrival, wait;
+	struct cache_entry *result;
+	pthread_mutex_t lock;
+	pthread_cond_t done_cond;
+	int done;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pool *pool;
+static struct cache results, topos;
+static unsigned long tick;
+static struct sd_rpc_stats stats;
+static double latencies[NR_LATENCIES], waits[NR_LATENCIES];
+static long nr_latencies;
+static double start_time, max_faces = 1 << 22;
+static volatile sig_atomic_t quit;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: sdserve [-j threads] [-t topologies] [-m MiB] [-f faces] socket\n"
+		"\n"
+		"  -j threads     number of worker threads (default: all cpus)\n"
+		"  -t topologies  number of refinement topologies to keep (default 16)\n"
+		"  -m MiB         memory for cached results (default 256)\n"
+		"  -f faces       largest refined mesh served (default 4194304)\n");
+	exit(1);
+}
+
+/* FNV-1a over 64-bit words, then the trailing bytes */
+static uint64_t hash_bytes(const void *data, size_t size, uint64_t h)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		uint64_t w;
+
+		memcpy(&w, p + i, sizeof(w));
+		h = (h ^ w) * 0x100000001b3ULL;
+	}
+	for (; i < size; i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+static void cache_put_locked(struct cache *c, struct cache_entry *e)
+{
+	if (--e->refs)
+		return;
+	c->free(e->data);
+	free(e);
+}
+
+static void cache_put(struct cache *c, struct cache_entry *e)
+{
+	pthread_mutex_lock(&lock);
+	cache_put_locked(c, e);
+	pthread_mutex_unlock(&lock);
+}
+
+static void cache_remove_locked(struct cache *c, int i)
+{
+	struct cache_entry *e = c->entries[i];
+
+	c->bytes -= e->bytes;
+	c->entries[i] = buf_last(c->entries);
+	buf_resize(c->entries, buf_len(c->entries) - 1);
+	cache_put_locked(c, e);
+}
+
+/* Takes a reference to an entry for key with at least level levels */
+static struct cache_entry *cache_get(struct cache *c, uint64_t key, int level)
+{
+	struct cache_entry *e = NULL;
+	int i;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < buf_len(c->entries); i++) {
+		if (c->entries[i]->key == key && c->entries[i]->level >= level) {
+			e = c->entries[i];
+			e->refs++;
+			e->used = ++tick;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return e;
+}
+
+/*
+ * Adds data to the cache, replacing older entries for the same key and
+ * evicting the least recently used ones until it fits, and returns it
+ * referenced.  Data too large for the cache is only handed back.
+ */
+static struct cache_entry *cache_add(struct cache *c, uint64_t key, int level,
+				     void *data, size_t bytes)
+{
+	struct cache_entry *e = malloc(sizeof(*e));
+	int i;
+
+	if (!e) {
+		c->free(data);
+		return NULL;
+	}
+	e->key = key;
+	e->level = level;
+	e->data = data;
+	e->bytes = bytes;
+	e->refs = 1;
+
+	pthread_mutex_lock(&lock);
+	e->used = ++tick;
+	if (bytes > c->budget || !c->max_entries) {
+		pthread_mutex_unlock(&lock);
+		return e;
+	}
+	for (i = buf_len(c->entries) - 1; i >= 0; i--)
+		if (c->entries[i]->key == key)
+			cache_remove_locked(c, i);
+	while (buf_len(c->entries) &&
+	       (c->bytes + bytes > c->budget ||
+		buf_len(c->entries) >= c->max_entries)) {
+		int lru = 0;
+
+		for (i = 1; i < buf_len(c->entries); i++)
+			if (c->entries[i]->used < c->entries[lru]->used)
+				lru = i;
+		cache_remove_locked(c, lru);
+	}
+	e->refs++;
+	c->bytes += bytes;
+	buf_push(c->entries, e);
+	pthread_mutex_unlock(&lock);
+	return e;
+}
+
+static void free_topo(void *data)
+{
+	sd_topo_free(data);
+}
+
+static void count(int64_t *counter)
+{
+	pthread_mutex_lock(&lock);
+	(*counter)++;
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Over a cached topology when there can be one, which gives the same mesh
+ * as subdivide_opts() with the default options.
+ */
+static struct mesh *serve_subdivide(const struct mesh *base, int level,
+				    const struct sd_options *opt)
+{
+	struct cache_entry *e;
+	struct mesh *res = NULL;
+	uint64_t key;
+
+	if (opt->local_order || !topos.max_entries)
+		return subdivide_opts(base, level, opt);
+
+	key = sd_topo_hash(base);
+	if ((e = cache_get(&topos, key, level))) {
+		count(&stats.topo_hits);
+	} else {
+		struct sd_topo *topo = sd_topo_build(base, level);
+
+		count(&stats.topo_builds);
+		e = topo ? cache_add(&topos, key, level, topo, 0) : NULL;
+	}
+	if (e) {
+		res = sd_topo_subdivide(e->data, base, level);
+		cache_put(&topos, e);
+	}
+	return res ? res : subdivide_opts(base, level, opt);
+}
+
+static int cmp_edge(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * The refinement only takes closed manifold cages: every face has at least
+ * three corners and every edge joins two distinct vertices and is shared
+ * by exactly two faces.  The result must also stay within max_faces, after
+ * the first level every corner is a quad and every level quadruples them.
+ */
+static int check_request(const struct mesh_view *view, int level)
+{
+	uint64_t *edges = NULL;
+	int i, j, err = 0;
+
+	if (level && view->nr_corners * pow(4.0, level - 1) > max_faces)
+		return -1;
+	for (i = 0; i < view->nr_faces && !err; i++) {
+		int first = view->faces[i];
+		int n = (i + 1 < view->nr_faces ? view->faces[i + 1] :
+			 view->nr_corners) - first;
+
+		if (n < 3) {
+			err = -1;
+			break;
+		}
+		for (j = 0; j < n; j++) {
+			uint32_t v0 = view->vi[first + j];
+			uint32_t v1 = view->vi[first + (j + 1) % n];
+
+			if (v0 == v1)
+				err = -1;
+			buf_push(edges, (uint64_t) MIN(v0, v1) << 32 | MAX(v0, v1));
+		}
+	}
+	if (!err) {
+		qsort(edges, buf_len(edges), sizeof(*edges), cmp_edge);
+		for (i = 0; i < buf_len(edges); i += 2)
+			if (i + 1 == buf_len(edges) || edges[i] != edges[i + 1] ||
+			    (i + 2 < buf_len(edges) && edges[i + 2] == edges[i]))
+				err = -1;
+	}
+	buf_free(edges);
+	return err;
+}
+
+static void run_job(void *arg)
+{
+	struct job *job = arg;
+	struct mesh_view view;
+	struct mesh *base, *res;
+	uint64_t key;
+	void *image;
+	size_t size;
+
+	job->wait = sys_time() - job->arrival;
+	pthread_mutex_lock(&lock);
+	stats.queued--;
+	pthread_mutex_unlock(&lock);
+
+	key = hash_bytes(job->image, job->size, 0xcbf29ce484222325ULL);
+	key = hash_bytes(&job->level, sizeof(job->level), key);
+	key = hash_bytes(&job->opt.local_order, sizeof(job->opt.local_order), key);
+	if ((job->result = cache_get(&results, key, 0))) {
+		count(&stats.result_hits);
+	} else if (!mesh_view(job->image, job->size, &view) &&
+		   !check_request(&view, job->level) &&
+		   (base = mesh_unpack(&view))) {
+		res = serve_subdivide(base, job->level, &job->opt);
+		mesh_free(base);
+		size = res ? mesh_pack_size(res) : 0;
+		if (res && !posix_memalign(&image, 64, size)) {
+			if (!mesh_pack(res, image))
+				job->result = cache_add(&results, key, 0,
+							image, size);
+			else
+				free(image);
+		}
+		mesh_free(res);
+	}
+
+	pthread_mutex_lock(&job->lock);
+	job->done = 1;
+	pthread_cond_signal(&job->done_cond);
+	pthread_mutex_unlock(&job->lock);
+}
+
+static int serve_request(int fd, const struct sd_rpc_msg *req, void *payload,
+			 double arrival)
+{
+	struct sd_rpc_msg msg;
+	struct job job;
+	int err;
+
+	if (req->level < 0 || req->level > SD_RPC_MAX_LEVEL) {
+		sd_rpc_init(&msg, req->type, 0);
+		msg.status = SD_RPC_EBAD;
+		count(&stats.failed);
+		return sd_rpc_send(fd, &msg, NULL);
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.image = payload;
+	job.size = req->size;
+	job.level = req->level;
+	sd_defaults(&job.opt);
+	job.opt.local_order = !!(req->flags & SD_RPC_LOCAL_ORDER);
+	job.arrival = arrival;
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.done_cond, NULL);
+
+	pthread_mutex_lock(&lock);
+	stats.queued++;
+	stats.max_queued = MAX(stats.max_queued, stats.queued);
+	pthread_mutex_unlock(&lock);
+	pool_add(pool, run_job, &job);
+
+	pthread_mutex_lock(&job.lock);
+	while (!job.done)
+		pthread_cond_wait(&job.done_cond, &job.lock);
+	pthread_mutex_unlock(&job.lock);
+	pthread_cond_destroy(&job.done_cond);
+	pthread_mutex_destroy(&job.lock);
+
+	sd_rpc_init(&msg, req->type, job.result ? job.result->bytes : 0);
+	if (!job.result) {
+		msg.status = SD_RPC_EBAD;
+		count(&stats.failed);
+	}
+	err = sd_rpc_send(fd, &msg, job.result ? job.result->data : NULL);
+	if (job.result)
+		cache_put(&results, job.result);
+
+	pthread_mutex_lock(&lock);
+	latencies[nr_latencies % NR_LATENCIES] = sys_time() - arrival;
+	waits[nr_latencies % NR_LATENCIES] = job.wait;
+	nr_latencies++;
+	pthread_mutex_unlock(&lock);
+	return err;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, int n, double p)
+{
+	int i = (int) (p * (n - 1) + 0.5);
+	return sorted[MIN(i, n - 1)];
+}
+
+static void get_stats(struct sd_rpc_stats *st)
+{
+	double lat[NR_LATENCIES], wait = 0.0, sum = 0.0;
+	int i, n;
+
+	pthread_mutex_lock(&lock);
+	*st = stats;
+	st->result_entries = buf_len(results.entries);
+	st->result_bytes = results.bytes;
+	n = MIN(nr_latencies, NR_LATENCIES);
+	memcpy(lat, latencies, n * sizeof(*lat));
+	for (i = 0; i < n; i++)
+		wait += waits[i];
+	pthread_mutex_unlock(&lock);
+
+	st->uptime = sys_time() - start_time;
+	st->threads = pool_size(pool);
+	if (!n)
+		return;
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+	st->latency_mean = sum / n;
+	st->latency_p50 = percentile(lat, n, 0.50);
+	st->latency_p95 = percentile(lat, n, 0.95);
+	st->latency_p99 = percentile(lat, n, 0.99);
+	st->latency_max = lat[n - 1];
+	st->wait_mean = wait / n;
+}
+
+static void *serve_conn(void *arg)
+{
+	int fd = (intptr_t) arg;
+	struct sd_rpc_msg req, msg;
+	struct sd_rpc_stats st;
+	void *payload;
+
+	while (!sd_rpc_recv(fd, &req, &payload)) {
+		double arrival = sys_time();
+		int err;
+
+		if (req.type == SD_RPC_SUBDIVIDE) {
+			count(&stats.requests);
+			err = serve_request(fd, &req, payload, arrival);
+		} else if (req.type == SD_RPC_STATS) {
+			get_stats(&st);
+			sd_rpc_init(&msg, req.type, sizeof(st));
+			err = sd_rpc_send(fd, &msg, &st);
+		} else {
+			sd_rpc_init(&msg, req.type, 0);
+			msg.status = SD_RPC_EBAD;
+			err = sd_rpc_send(fd, &msg, NULL);
+		}
+		free(payload);
+		if (err)
+			break;
+	}
+	close(fd);
+	return NULL;
+}
+
+static void on_signal(int sig)
+{
+	quit = 1;
+}
+
+/* Only the main thread takes SIGINT and SIGTERM, to break out of accept() */
+static void block_signals(int block)
+{
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	int c, fd, nr_threads = 0, nr_topos = 16;
+	double result_mib = 256.0;
+	struct sockaddr_un addr;
+	struct sd_rpc_stats st;
+	struct sigaction sa;
+	const char *path;
+
+	while ((c = getopt(argc, argv, "j:t:m:f:h")) != -1) {
+		switch (c) {
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		case 't':
+			nr_topos = atoi(optarg);
+			break;
+		case 'm':
+			result_mib = atof(optarg);
+			break;
+		case 'f':
+			max_faces = atof(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind + 1 != argc || nr_topos < 0 || result_mib < 0.0 ||
+	    max_faces < 1.0)
+		usage();
+	path = argv[optind];
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "sdserve: socket path too long\n");
+		return 1;
+	}
+	if (nr_threads <= 0)
+		nr_threads = sys_nr_cpus();
+
+	results.budget = result_mib * 1024 * 1024;
+	results.max_entries = INT_MAX;
+	results.free = free;
+	topos.budget = SIZE_MAX;
+	topos.max_entries = nr_topos;
+	topos.free = free_topo;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		perror("sdserve: socket");
+		return 1;
+	}
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) || listen(fd, 64)) {
+		perror("sdserve: bind");
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	start_time = sys_time();
+	block_signals(1);
+	pool = pool_create(nr_threads);
+	block_signals(0);
+	printf("sdserve: listening on %s with %d threads\n", path, nr_threads);
+	fflush(stdout);
+
+	while (!quit) {
+		pthread_t thread;
+		int conn;
+
+		if ((conn = accept(fd, NULL, NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("sdserve: accept");
+			break;
+		}
+		block_signals(1);
+		if (pthread_create(&thread, NULL, serve_conn, (void *) (intptr_t) conn))
+			close(conn);
+		else
+			pthread_detach(thread);
+		block_signals(0);
+	}
+	close(fd);
+	unlink(path);
+
+	get_stats(&st);
+	printf("sdserve: %lld requests, %lld failed, %lld result hits, "
+	       "%lld topology hits, %lld topologies built, max queue %d\n",
+	       (long long) st.requests, (long long) st.failed,
+	       (long long) st.result_hits, (long long) st.topo_hits,
+	       (long long) st.topo_builds, st.max_queued);
+	return 0;
+}
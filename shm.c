@@ -0,0 +1,280 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mesh.h"
+#include "shm.h"
+#include "util.h"
+
+#define SHM_MAGIC	0x4d485343	/* "CSHM" */
+#define SHM_VERSION	1
+#define SHM_RETRIES	1000	/* Acquire attempts while the writer races ahead */
+
+/*
+ * The writer bumps an image's seq to odd before it touches the image and
+ * back to even once it is whole, and only then publishes it.  gen counts
+ * the segments the image has had: one too small for the next mesh is
+ * unlinked and replaced, so readers still mapping it are never cut short.
+ */
+struct shm_image {
+	uint32_t seq;
+	uint32_t gen;
+	uint64_t size;		/* Bytes of the mesh image */
+};
+
+struct shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t published;	/* Image k lives in images[k & 1] */
+	struct shm_image images[2];
+};
+
+struct shm_map {
+	void *addr;
+	size_t len;
+	uint32_t gen;		/* 0 while unmapped */
+};
+
+struct mesh_shm {
+	char name[256];
+	struct shm_header *hdr;
+	struct shm_map maps[2];
+};
+
+static void shm_image_name(char *buf, size_t len, const char *name, int i)
+{
+	snprintf(buf, len, "%s-%d", name, i);
+}
+
+static void shm_unmap(struct shm_map *m)
+{
+	if (m->gen)
+		munmap(m->addr, m->len);
+	m->gen = 0;
+}
+
+/* Maps an existing segment, read only unless writing */
+static void *shm_map_fd(int fd, int writer, size_t *len)
+{
+	struct stat st;
+	void *addr;
+
+	if (fstat(fd, &st) || st.st_size <= 0)
+		return NULL;
+	addr = mmap(NULL, st.st_size, writer ? PROT_READ | PROT_WRITE : PROT_READ,
+		    MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+	*len = st.st_size;
+	return addr;
+}
+
+static struct mesh_shm *shm_alloc(const char *name)
+{
+	struct mesh_shm *shm;
+
+	if (strlen(name) >= sizeof(shm->name))
+		return NULL;
+	if (!(shm = calloc(1, sizeof(*shm))))
+		return NULL;
+	snprintf(shm->name, sizeof(shm->name), "%s", name);
+	return shm;
+}
+
+struct mesh_shm *mesh_shm_create(const char *name)
+{
+	struct mesh_shm *shm;
+	size_t len;
+	int fd;
+
+	if (!(shm = shm_alloc(name)))
+		return NULL;
+
+	/* Readers of a previous writer keep its segments, not these */
+	mesh_shm_unlink(name);
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+		free(shm);
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(*shm->hdr)) ||
+	    !(shm->hdr = shm_map_fd(fd, 1, &len))) {
+		close(fd);
+		shm_unlink(name);
+		free(shm);
+		return NULL;
+	}
+	close(fd);
+	shm->hdr->version = SHM_VERSION;
+	__atomic_store_n(&shm->hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+	return shm;
+}
+
+/* Replaces the segment of image i with one of at least size bytes */
+static int shm_grow(struct mesh_shm *shm, int i, size_t size)
+{
+	struct shm_map *m = &shm->maps[i];
+	char name[sizeof(shm->name) + 16];
+	size_t page = sysconf(_SC_PAGESIZE);
+	int fd;
+
+	size = MAX(size, m->gen ? m->len + m->len / 2 : 0);
+	size = (size + page - 1) / page * page;
+	shm_image_name(name, sizeof(name), shm->name, i);
+	shm_unmap(m);
+	shm_unlink(name);
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+		return -1;
+	if (ftruncate(fd, size) || !(m->addr = shm_map_fd(fd, 1, &m->len))) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	close(fd);
+	m->gen = shm->hdr->images[i].gen + 1;
+	return 0;
+}
+
+int mesh_shm_publish(struct mesh_shm *shm, const struct mesh *mesh)
+{
+	uint64_t k = shm->hdr->published + 1;
+	struct shm_image *img = &shm->hdr->images[k & 1];
+	struct shm_map *m = &shm->maps[k & 1];
+	size_t size = mesh_pack_size(mesh);
+	int err = 0;
+
+	__atomic_store_n(&img->seq, img->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (!m->gen || size > m->len) {
+		err = shm_grow(shm, k & 1, size);
+		__atomic_store_n(&img->gen, m->gen, __ATOMIC_RELAXED);
+	}
+	if (!err && !(err = mesh_pack(mesh, m->addr)))
+		__atomic_store_n(&img->size, size, __ATOMIC_RELAXED);
+	__atomic_store_n(&img->seq, img->seq + 1, __ATOMIC_RELEASE);
+
+	/* A failed image is never published, the next publish retries it */
+	if (err)
+		return -1;
+	__atomic_store_n(&shm->hdr->published, k, __ATOMIC_RELEASE);
+	return 0;
+}
+
+struct mesh_shm *mesh_shm_open(const char *name)
+{
+	struct mesh_shm *shm;
+	size_t len = 0;
+	int fd;
+
+	if (!(shm = shm_alloc(name)))
+		return NULL;
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+		free(shm);
+		return NULL;
+	}
+	shm->hdr = shm_map_fd(fd, 0, &len);
+	close(fd);
+	if (shm->hdr && (len < sizeof(*shm->hdr) ||
+	    __atomic_load_n(&shm->hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+	    shm->hdr->version != SHM_VERSION)) {
+		munmap(shm->hdr, len);
+		shm->hdr = NULL;
+	}
+	if (!shm->hdr) {
+		free(shm);
+		return NULL;
+	}
+	return shm;
+}
+
+/* Maps generation gen of image i, which may already have been replaced */
+static int shm_map_image(struct mesh_shm *shm, int i, uint32_t gen)
+{
+	struct shm_map *m = &shm->maps[i];
+	char name[sizeof(shm->name) + 16];
+	int fd;
+
+	shm_unmap(m);
+	shm_image_name(name, sizeof(name), shm->name, i);
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+		return -1;
+	m->addr = shm_map_fd(fd, 0, &m->len);
+	close(fd);
+	if (!m->addr)
+		return -1;
+	m->gen = gen;
+	return 0;
+}
+
+long mesh_shm_acquire(struct mesh_shm *shm, struct mesh **mesh)
+{
+	struct shm_header *hdr = shm->hdr;
+	int tries;
+
+	*mesh = NULL;
+	for (tries = 0; tries < SHM_RETRIES; tries++) {
+		uint64_t k = __atomic_load_n(&hdr->published, __ATOMIC_ACQUIRE);
+		struct shm_image *img = &hdr->images[k & 1];
+		struct shm_map *m = &shm->maps[k & 1];
+		struct mesh_view view;
+		struct mesh *res = NULL;
+		uint32_t seq, gen;
+		uint64_t size;
+
+		if (!k)
+			return 0;
+		seq = __atomic_load_n(&img->seq, __ATOMIC_ACQUIRE);
+		gen = __atomic_load_n(&img->gen, __ATOMIC_RELAXED);
+		size = __atomic_load_n(&img->size, __ATOMIC_RELAXED);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		/*
+		 * Whatever was read is only trusted if seq has not moved.  The
+		 * view keeps every read inside the mapping, which never
+		 * shrinks, so a refill can only tear the copy, not fault.
+		 */
+		if ((m->gen == gen || !shm_map_image(shm, k & 1, gen)) &&
+		    size <= m->len && !mesh_view(m->addr, size, &view))
+			res = mesh_unpack(&view);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&img->seq, __ATOMIC_RELAXED) != seq) {
+			mesh_free(res);
+			continue;
+		}
+		if (!res)
+			return -1;
+		*mesh = res;
+		return k;
+	}
+	return -1;
+}
+
+void mesh_shm_close(struct mesh_shm *shm)
+{
+	if (!shm)
+		return;
+	shm_unmap(&shm->maps[0]);
+	shm_unmap(&shm->maps[1]);
+	munmap(shm->hdr, sizeof(*shm->hdr));
+	free(shm);
+}
+
+int mesh_shm_unlink(const char *name)
+{
+	char buf[4096];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		shm_image_name(buf, sizeof(buf), name, i);
+		shm_unlink(buf);
+	}
+	return shm_unlink(name);
+}
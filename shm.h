@@ -0,0 +1,34 @@
+#ifndef SHM_H
+#define SHM_H
+
+/*
+ * Meshes shared with other processes on the same machine
+ *
+ * A writer publishes meshes under a POSIX shared memory name such as
+ * "/cc-mesh".  The segment of that name holds a small versioned header
+ * and name-0 and name-1 hold mesh images (see mesh_pack()), filled in
+ * turn, so a publish never writes to the image readers were last pointed
+ * at.  Readers map everything read only and copy the newest image out
+ * without parsing it.  The segments are only open to the writer's user.
+ *
+ * mesh_shm_acquire() unpacks the newest image into *mesh and returns its
+ * publish number, counting from 1, 0 when nothing has been published yet
+ * and -1 on error.  The copy is checked against the image's seqlock, so
+ * one the writer started refilling meanwhile is dropped and read again.
+ *
+ * Closing the writer leaves the segments for later readers and
+ * mesh_shm_unlink() removes them.  A new writer under the same name
+ * replaces the segments, and readers must reopen to see it.
+ */
+struct mesh;
+
+struct mesh_shm *mesh_shm_create(const char *name);
+int mesh_shm_publish(struct mesh_shm *shm, const struct mesh *mesh);
+
+struct mesh_shm *mesh_shm_open(const char *name);
+long mesh_shm_acquire(struct mesh_shm *shm, struct mesh **mesh);
+
+void mesh_shm_close(struct mesh_shm *shm);
+int mesh_shm_unlink(const char *name);
+
+#endif
@@ -0,0 +1,57 @@
+#include <string.h>
+#include "stats.h"
+
+#ifdef SD_STATS
+#define SD_STATS_ENABLED	1
+#else
+#define SD_STATS_ENABLED	0
+#endif
+
+static __thread struct sd_stats own_stats = { SD_STATS_ENABLED };
+static __thread struct sd_stats *cur_stats;
+
+struct sd_stats *sd_stats_account_(void)
+{
+	return cur_stats ? cur_stats : &own_stats;
+}
+
+const struct sd_stats *sd_stats_get(void)
+{
+	return sd_stats_account_();
+}
+
+void sd_stats_reset(void)
+{
+	struct sd_stats *st = sd_stats_account_();
+
+	memset(st, 0, sizeof(*st));
+	st->enabled = SD_STATS_ENABLED;
+}
+
+struct sd_stats *sd_stats_attach(struct sd_stats *st)
+{
+	struct sd_stats *prev = sd_stats_account_();
+
+	cur_stats = st;
+	return prev;
+}
+
+#ifdef SD_STATS
+struct sd_level_stats *sd_stats_level_(void)
+{
+	struct sd_stats *st = sd_stats_account_();
+
+	return &st->level[st->cur_level];
+}
+
+void sd_stats_set_level_(int level)
+{
+	struct sd_stats *st = sd_stats_account_();
+
+	if (level >= SD_STATS_MAX_LEVELS)
+		level = SD_STATS_MAX_LEVELS - 1;
+	st->cur_level = level;
+	if (st->nr_levels < level + 1)
+		st->nr_levels = level + 1;
+}
+#endif
@@ -0,0 +1,83 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+
+/*
+ * Subdivision instrumentation, recorded per thread when the library is
+ * built with -DSD_STATS.  Without it every hook below compiles to nothing
+ * and sd_stats_get() returns a zeroed struct with enabled == 0.
+ *
+ * Level 0 describes the base topology built by sd_init(), level i the
+ * state after the i-th call to sd_do_iteration().
+ */
+#define SD_STATS_MAX_LEVELS	16
+
+struct sd_level_stats {
+	/* Wall time in seconds per phase */
+	double face_points;
+	double edge_points;
+	double vertex_points;
+	double faces;		/* Building the new faces */
+	double links;		/* Edge and adjacency rebuild */
+	double convert;		/* sd_convert() */
+	double normals;		/* mesh_compute_normals() */
+
+	/* sd_find_edge() calls and edges visited by them */
+	long edge_lookups;
+	long edge_probes;
+
+	int nr_verts, nr_faces, nr_edges;
+	double face_span;	/* Mean spread of a face's vertex indices */
+	size_t sd_bytes;	/* Buffers held by the sd_mesh */
+	size_t mesh_bytes;	/* Buffers held by the converted mesh */
+};
+
+struct sd_stats {
+	int enabled;
+	int nr_levels;
+	int cur_level;		/* The one the hooks record into */
+	struct sd_level_stats level[SD_STATS_MAX_LEVELS];
+};
+
+/*
+ * Stats of the last subdivide() or subdivide_levels() on this thread,
+ * including the phases it split across a pool.
+ */
+const struct sd_stats *sd_stats_get(void);
+void sd_stats_reset(void);
+
+/*
+ * Records the calling thread's stats into another struct, NULL for its
+ * own, and returns the previous one.  For work handed to other threads;
+ * counters added from several threads at once stay exact.
+ */
+struct sd_stats *sd_stats_attach(struct sd_stats *st);
+
+/* Private */
+struct sd_stats *sd_stats_account_(void);
+
+#ifdef SD_STATS
+#include "sys.h"
+
+struct sd_level_stats *sd_stats_level_(void);
+void sd_stats_set_level_(int level);
+
+#define stats_timer(t)		double t = sys_time()
+#define stats_lap(t, field)	(sd_stats_level_()->field += sys_time() - (t), \
+				 (t) = sys_time())
+#define stats_add(field, n)	__atomic_add_fetch(&sd_stats_level_()->field, (n), \
+					   __ATOMIC_RELAXED)
+#define stats_set(field, v)	(sd_stats_level_()->field = (v))
+#define stats_level(l)		sd_stats_set_level_(l)
+#define stats_reset()		sd_stats_reset()
+#else
+#define stats_timer(t)		((void) 0)
+#define stats_lap(t, field)	((void) 0)
+#define stats_add(field, n)	((void) 0)
+#define stats_set(field, v)	((void) 0)
+#define stats_level(l)		((void) 0)
+#define stats_reset()		((void) 0)
+#endif
+
+#endif
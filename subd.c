@@ -1,9 +1,17 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include "buf.h"
+#include "cache.h"
 #include "mathx.h"
+#include "memstats.h"
 #include "mesh.h"
+#include "pool.h"
 #include "util.h"
+#include "stats.h"
+#include "subd.h"
+#include "topo.h"
 
 struct sd_vert {
 	vector p, newp;
@@ -22,10 +30,28 @@ struct sd_edge {
 	int evert;
 };
 
+/*
+ * Mesh channels ride along with the positions: vertex varying ones are
+ * packed vwidth floats per vertex in vv and refined with the same rules,
+ * face varying ones fwidth floats per face corner in fv, corners in face
+ * order, and interpolated linearly within each face.
+ */
+struct sd_channel {
+	int kind;
+	int width;
+	int offset;		/* In vv or fv */
+};
+
 struct sd_mesh {
 	struct sd_vert *verts;
 	struct sd_face *faces;
 	struct sd_edge *edges;
+	int level;
+	struct sd_options opt;
+	struct sd_channel *channels;
+	int vwidth, fwidth;
+	float *vv;
+	float *fv;
 };
 
 #define sd_v(vi)		(sd->verts[vi])
@@ -34,6 +60,7 @@ struct sd_mesh {
 #define sd_vi(v)		((int)((v) - sd->verts))
 #define sd_fi(f)		((int)((f) - sd->faces))
 #define sd_ei(e)		((int)((e) - sd->edges))
+#define sd_vv(vi)		(sd->vv + (size_t) (vi) * sd->vwidth)
 
 static int sd_find_edge(struct sd_mesh *sd, int v0, int v1)
 {
@@ -41,9 +68,11 @@ static int sd_find_edge(struct sd_mesh *sd, int v0, int v1)
 	struct sd_vert *v;
 
 	v = &sd_v(v0);
+	stats_add(edge_lookups, 1);
 	buf_foreach(ei, v->es) {
 		struct sd_edge *e = &sd_e(*ei);
 
+		stats_add(edge_probes, 1);
 		if ((e->v0 == v0 && e->v1 == v1) ||
 		    (e->v0 == v1 && e->v1 == v0))
 			return *ei;
@@ -101,20 +130,158 @@ static void sd_update_links(struct sd_mesh *sd)
 	}
 }
 
-static struct sd_mesh *sd_init(const struct mesh *mesh)
+#ifdef SD_STATS
+static double sd_face_span(struct sd_mesh *sd)
+{
+	struct sd_face *f;
+	double span = 0.0;
+	int *vi;
+
+	buf_foreach(f, sd->faces) {
+		int lo = INT_MAX, hi = 0;
+
+		buf_foreach(vi, f->vs) {
+			lo = MIN(lo, *vi);
+			hi = MAX(hi, *vi);
+		}
+		span += hi - lo;
+	}
+	return buf_len(sd->faces) ? span / buf_len(sd->faces) : 0.0;
+}
+
+static size_t sd_bytes(struct sd_mesh *sd)
+{
+	size_t bytes;
+	struct sd_vert *v;
+	struct sd_face *f;
+
+	bytes = sizeof(*sd);
+	bytes += buf_cap(sd->verts) * sizeof(*sd->verts);
+	bytes += buf_cap(sd->faces) * sizeof(*sd->faces);
+	bytes += buf_cap(sd->edges) * sizeof(*sd->edges);
+	buf_foreach(v, sd->verts)
+		bytes += (buf_cap(v->es) + buf_cap(v->fs)) * sizeof(int);
+	buf_foreach(f, sd->faces)
+		bytes += buf_cap(f->vs) * sizeof(int);
+	bytes += buf_cap(sd->channels) * sizeof(*sd->channels);
+	bytes += (buf_cap(sd->vv) + buf_cap(sd->fv)) * sizeof(float);
+	return bytes;
+}
+#endif
+
+void sd_defaults(struct sd_options *opt)
+{
+	opt->local_order = 0;
+	opt->valence_kernels = 1;
+	opt->cache_dir = NULL;
+	opt->cache_size = (size_t) 1 << 30;
+}
+
+static void sd_init_channels(struct sd_mesh *sd, const struct mesh *mesh)
+{
+	struct sd_channel *c;
+	int i, j, k, nr_verts, nr_faces;
+	float *dst;
+
+	for (i = 0; i < mesh_channel_count(mesh); i++) {
+		struct sd_channel ch;
+
+		ch.kind = mesh_channel_kind(mesh, i);
+		ch.width = mesh_channel_width(mesh, i);
+		if (ch.kind == MESH_VERTEX_VARYING) {
+			ch.offset = sd->vwidth;
+			sd->vwidth += ch.width;
+		} else {
+			ch.offset = sd->fwidth;
+			sd->fwidth += ch.width;
+		}
+		buf_push(sd->channels, ch);
+	}
+
+	/* Values the mesh lacks are zero */
+	nr_verts = buf_len(sd->verts);
+	if (sd->vwidth) {
+		buf_resize(sd->vv, nr_verts * sd->vwidth);
+		buf_foreach(c, sd->channels) {
+			const float *vals;
+			int n, ci = c - sd->channels;
+
+			if (c->kind != MESH_VERTEX_VARYING)
+				continue;
+			n = mesh_channel_buffer(mesh, ci, &vals);
+			for (i = 0; i < nr_verts; i++) {
+				dst = sd_vv(i) + c->offset;
+				if (i < n)
+					memcpy(dst, vals + i * c->width,
+					       c->width * sizeof(*dst));
+				else
+					vals_zero(dst, c->width);
+			}
+		}
+	}
+
+	nr_faces = buf_len(sd->faces);
+	if (sd->fwidth) {
+		int nr_corners = 0;
+
+		for (i = 0; i < nr_faces; i++)
+			nr_corners += buf_len(sd_f(i).vs);
+		buf_resize(sd->fv, (size_t) nr_corners * sd->fwidth);
+		dst = sd->fv;
+		for (i = 0; i < nr_faces; i++) {
+			for (j = 0; j < buf_len(sd_f(i).vs); j++, dst += sd->fwidth) {
+				buf_foreach(c, sd->channels) {
+					const float *val;
+
+					if (c->kind != MESH_FACE_VARYING)
+						continue;
+					val = mesh_get_channel(mesh, c - sd->channels, i, j);
+					for (k = 0; k < c->width; k++)
+						dst[c->offset + k] = val ? val[k] : 0.0f;
+				}
+			}
+		}
+	}
+}
+
+struct sd_mesh *sd_init_opts(const struct mesh *mesh,
+			     const struct sd_options *opt)
 {
 	int i, j, nr_verts, nr_faces;
 	const float *vbuf;
 	struct sd_vert *v;
 	struct sd_mesh *sd;
+	mem_enter(MEM_SD);
 
-	sd = malloc(sizeof(*sd));
+	stats_timer(t);
+
+	stats_reset();
+	stats_level(0);
+
+	sd = mem_alloc(sizeof(*sd));
 	sd->verts = NULL;
 	sd->faces = NULL;
 	sd->edges = NULL;
+	sd->level = 0;
+	sd->channels = NULL;
+	sd->vwidth = 0;
+	sd->fwidth = 0;
+	sd->vv = NULL;
+	sd->fv = NULL;
+	if (opt)
+		sd->opt = *opt;
+	else
+		sd_defaults(&sd->opt);
 
 	/* Create vertices */
 	nr_verts = mesh_vertex_buffer(mesh, &vbuf);
+	nr_faces = mesh_face_count(mesh);
+	if (buf_try_reserve(sd->verts, nr_verts) ||
+	    buf_try_reserve(sd->faces, nr_faces)) {
+		sd_free(sd);
+		mem_leave();
+		return NULL;
+	}
 	buf_resize(sd->verts, nr_verts);
 	buf_foreach(v, sd->verts) {
 		vec_copy(v->p, vbuf);
@@ -124,7 +291,6 @@ static struct sd_mesh *sd_init(const struct mesh *mesh)
 	}
 
 	/* Create faces */
-	nr_faces = mesh_face_count(mesh);
 	buf_resize(sd->faces, nr_faces);
 	for (i = 0; i < nr_faces; i++) {
 		struct sd_face *f;
@@ -143,13 +309,27 @@ static struct sd_mesh *sd_init(const struct mesh *mesh)
 		}
 	}
 
+	sd_init_channels(sd, mesh);
+
 	/* Create edges */
 	sd_update_links(sd);
 
+	stats_lap(t, links);
+	stats_set(nr_verts, buf_len(sd->verts));
+	stats_set(nr_faces, buf_len(sd->faces));
+	stats_set(nr_edges, buf_len(sd->edges));
+	stats_set(face_span, sd_face_span(sd));
+	stats_set(sd_bytes, sd_bytes(sd));
+	mem_leave();
 	return sd;
 }
 
-static void sd_free(struct sd_mesh *sd)
+struct sd_mesh *sd_init(const struct mesh *mesh)
+{
+	return sd_init_opts(mesh, NULL);
+}
+
+void sd_free(struct sd_mesh *sd)
 {
 	struct sd_vert *v;
 	struct sd_face *f;
@@ -166,113 +346,298 @@ static void sd_free(struct sd_mesh *sd)
 
 	buf_free(sd->edges);
 
-	free(sd);
+	buf_free(sd->channels);
+	buf_free(sd->vv);
+	buf_free(sd->fv);
+	mem_free(sd);
 }
 
-static int sd_add_vert(struct sd_mesh *sd, vector p)
+/*
+ * One iteration's phases work on ranges of faces, edges or vertices that
+ * are independent of each other, so large meshes can spread them over a
+ * pool.  Every new point has a fixed index: face points follow the old
+ * vertices in face order, then edge points in edge order.
+ */
+#define SD_CHUNK		4096	/* Min items per pool task */
+
+struct sd_iter {
+	struct sd_mesh *sd;
+	struct pool *pool;
+	struct mem_stats *mem;	/* The caller's account and tag */
+	int tag;
+	struct sd_stats *stats;	/* And its stats, at its level */
+	int V, F;
+	struct sd_face *faces;	/* The new faces */
+	int *first;		/* First new face per face, NULL for quads */
+	float *vvnew;		/* Moved vertex varying values of old vertices */
+	float *fv;		/* Face varying values of the new faces */
+};
+
+typedef void (*sd_range_fn)(struct sd_iter *it, int begin, int end);
+
+struct sd_range {
+	struct sd_iter *it;
+	sd_range_fn fn;
+	int begin, end;
+};
+
+static void sd_run_range(void *arg)
 {
-	struct sd_vert v;
-	vec_copy(v.p, p);
-	v.es = NULL;
-	v.fs = NULL;
-	buf_push(sd->verts, v);
-	return buf_len(sd->verts) - 1;
+	struct sd_range *r = arg;
+	struct mem_stats *mem = mem_stats_attach(r->it->mem);
+	struct sd_stats *stats = sd_stats_attach(r->it->stats);
+	int tag = mem_set_tag_(r->it->tag);
+
+	r->fn(r->it, r->begin, r->end);
+	mem_set_tag_(tag);
+	sd_stats_attach(stats);
+	mem_stats_attach(mem);
 }
 
-static void sd_do_iteration(struct sd_mesh *sd, int first_iteration, int last_iteration)
+static void sd_split(struct sd_iter *it, int n, sd_range_fn fn)
 {
-	int V, F, E, Vn, Fn, En;
-	struct sd_face *faces = NULL;
-	struct sd_vert *v;
-	struct sd_face *f;
-	struct sd_edge *e;
-	int *vi, *fi, *ei;
+	struct pool_group group = { 0 };
+	struct sd_range *ranges = NULL;
+	int i, nr;
 
-	/* V' = V + F + E
-	 * F' = Sum_i=0^F(f_i), (F' = 4F, when quad-mesh)
-	 * E' = 2E + F'
-	 */
-	V = buf_len(sd->verts);
-	F = buf_len(sd->faces);
-	E = buf_len(sd->edges);
-	Vn = V + F + E;
-	if (first_iteration) {
-		Fn = 0;
-		buf_foreach(f, sd->faces)
-			Fn += buf_len(f->vs);
-	} else {
-		/* After the first iteration all faces are quads */
-		Fn = 4 * F;
+	nr = it->pool ? MIN(4 * pool_size(it->pool), n / SD_CHUNK) : 0;
+	if (nr < 2) {
+		fn(it, 0, n);
+		return;
 	}
-	En = 2 * E + Fn;
 
-	/* 1. Update vertices */
-	buf_reserve(sd->verts, Vn);
+	buf_resize(ranges, nr);
+	for (i = 0; i < nr; i++) {
+		ranges[i].it = it;
+		ranges[i].fn = fn;
+		ranges[i].begin = (long) n * i / nr;
+		ranges[i].end = (long) n * (i + 1) / nr;
+		pool_add_group(it->pool, &group, sd_run_range, &ranges[i]);
+	}
+	/* Only this phase: the pool may hold other meshes' work too */
+	pool_wait_group(it->pool, &group);
+	buf_free(ranges);
+}
 
-	/* Create face vertices */
-	buf_foreach(f, sd->faces) {
-		vector p;
+static void sd_face_points(struct sd_iter *it, int begin, int end)
+{
+	struct sd_mesh *sd = it->sd;
+	int i, *vi;
 
-		vec_zero(p);
+	for (i = begin; i < end; i++) {
+		struct sd_face *f = &sd_f(i);
+		struct sd_vert *fv = &sd_v(it->V + i);
+
+		vec_zero(fv->p);
 		buf_foreach(vi, f->vs)
-			vec_add(p, p, sd_v(*vi).p);
-		vec_mul(p, 1.0f / buf_len(f->vs), p);
-		f->fvert = sd_add_vert(sd, p);
+			vec_add(fv->p, fv->p, sd_v(*vi).p);
+		vec_mul(fv->p, 1.0f / buf_len(f->vs), fv->p);
+		fv->es = NULL;
+		fv->fs = NULL;
+		f->fvert = it->V + i;
+
+		if (sd->vwidth) {
+			float *d = sd_vv(it->V + i);
+
+			vals_zero(d, sd->vwidth);
+			buf_foreach(vi, f->vs)
+				vals_add(d, sd_vv(*vi), sd->vwidth);
+			vals_mul(d, 1.0f / buf_len(f->vs), sd->vwidth);
+		}
 	}
+}
 
-	/* Create edge vertices */
-	buf_foreach(e, sd->edges) {
-		vector p;
+static void sd_edge_points(struct sd_iter *it, int begin, int end)
+{
+	struct sd_mesh *sd = it->sd;
+	int i;
+
+	for (i = begin; i < end; i++) {
+		struct sd_edge *e = &sd_e(i);
+		struct sd_vert *ev = &sd_v(it->V + it->F + i);
 
 		assert(e->f1 != -1);
-		vec_zero(p);
-		vec_add(p, p, sd_v(e->v0).p);
-		vec_add(p, p, sd_v(e->v1).p);
-		vec_add(p, p, sd_v(sd_f(e->f0).fvert).p);
-		vec_add(p, p, sd_v(sd_f(e->f1).fvert).p);
-		vec_mul(p, 0.25f, p);
-		e->evert = sd_add_vert(sd, p);
+		vec_zero(ev->p);
+		vec_add(ev->p, ev->p, sd_v(e->v0).p);
+		vec_add(ev->p, ev->p, sd_v(e->v1).p);
+		vec_add(ev->p, ev->p, sd_v(sd_f(e->f0).fvert).p);
+		vec_add(ev->p, ev->p, sd_v(sd_f(e->f1).fvert).p);
+		vec_mul(ev->p, 0.25f, ev->p);
+		ev->es = NULL;
+		ev->fs = NULL;
+		e->evert = it->V + it->F + i;
+
+		if (sd->vwidth) {
+			float *d = sd_vv(e->evert);
+
+			vals_zero(d, sd->vwidth);
+			vals_add(d, sd_vv(e->v0), sd->vwidth);
+			vals_add(d, sd_vv(e->v1), sd->vwidth);
+			vals_add(d, sd_vv(sd_f(e->f0).fvert), sd->vwidth);
+			vals_add(d, sd_vv(sd_f(e->f1).fvert), sd->vwidth);
+			vals_mul(d, 0.25f, sd->vwidth);
+		}
 	}
+}
 
-	/* Move old vertices */
-	buf_foreach(v, sd->verts) {
-		int n;
-		vector p;
+/* The vertex rule of sd_vertex_point() on the vertex varying values */
+static void sd_vertex_values(struct sd_iter *it, struct sd_vert *v, float *p)
+{
+	struct sd_mesh *sd = it->sd;
+	int *fi, *ei, w = sd->vwidth, n = buf_len(v->fs);
+	float *d = it->vvnew + (size_t) sd_vi(v) * w;
 
-		if (sd_vi(v) >= V)
-			break;
+	memcpy(d, sd_vv(sd_vi(v)), w * sizeof(*d));
+	vals_mul(d, (float) (n - 2) / n, w);
 
-		assert(buf_len(v->fs) == buf_len(v->es));
-		n = buf_len(v->fs);
+	vals_zero(p, w);
+	buf_foreach(fi, v->fs)
+		vals_add(p, sd_vv(sd_f(*fi).fvert), w);
+	vals_mad(d, 1.0f / (n * n), p, w);
 
-		vec_copy(v->newp, v->p);
-		vec_mul(v->newp, (float) (n - 2) / n, v->newp);
+	vals_zero(p, w);
+	buf_foreach(ei, v->es)
+		vals_add(p, sd_vv(sd_vi(sd_edge_other(sd, &sd_e(*ei), v))), w);
+	vals_mad(d, 1.0f / (n * n), p, w);
+}
 
-		vec_zero(p);
-		buf_foreach(fi, v->fs)
-			vec_add(p, p, sd_v(sd_f(*fi).fvert).p);
-		vec_mad(v->newp, 1.0f / (n * n), p);
+/*
+ * The vertex rule, newp = p (n - 2) / n + (sum of face points + sum of
+ * edge neighbours) / n^2, on positions.  With a constant n and weights
+ * it unrolls into straight line code with no divisions; the sums are
+ * taken in the same order either way, so the kernels sd_vertex_points()
+ * picks for the common valences give the same bits as the generic path.
+ */
+static inline void sd_vertex_point(struct sd_mesh *sd, struct sd_vert *v,
+				   int n, float wp, float wq)
+{
+	int j;
+	vector p;
 
-		vec_zero(p);
-		buf_foreach(ei, v->es)
-			vec_add(p, p, sd_edge_other(sd, &sd_e(*ei), v)->p);
-		vec_mad(v->newp, 1.0f / (n * n), p);
-	}
+	vec_mul(v->newp, wp, v->p);
 
-	buf_foreach(v, sd->verts) {
-		if (sd_vi(v) >= V)
+	vec_zero(p);
+	for (j = 0; j < n; j++)
+		vec_add(p, p, sd_v(sd_f(v->fs[j]).fvert).p);
+	vec_mad(v->newp, wq, p);
+
+	vec_zero(p);
+	for (j = 0; j < n; j++)
+		vec_add(p, p, sd_edge_other(sd, &sd_e(v->es[j]), v)->p);
+	vec_mad(v->newp, wq, p);
+}
+
+static void sd_vertex_generic(struct sd_mesh *sd, struct sd_vert *v)
+{
+	int n = buf_len(v->fs);
+
+	assert(n == buf_len(v->es));
+	sd_vertex_point(sd, v, n, (float) (n - 2) / n, 1.0f / (n * n));
+}
+
+static void sd_vertex_points(struct sd_iter *it, int begin, int end)
+{
+	struct sd_mesh *sd = it->sd;
+	int i;
+	float *tmp = NULL;
+
+	for (i = begin; i < end; i++) {
+		struct sd_vert *v = &sd_v(i);
+
+		if (!sd->opt.valence_kernels) {
+			sd_vertex_generic(sd, v);
+			continue;
+		}
+		assert(buf_len(v->fs) == buf_len(v->es));
+		switch (buf_len(v->fs)) {
+		case 3:
+			sd_vertex_point(sd, v, 3, 1.0f / 3, 1.0f / 9);
+			break;
+		case 4:
+			sd_vertex_point(sd, v, 4, 2.0f / 4, 1.0f / 16);
+			break;
+		case 5:
+			sd_vertex_point(sd, v, 5, 3.0f / 5, 1.0f / 25);
 			break;
-		vec_copy(v->p, v->newp);
+		case 6:
+			sd_vertex_point(sd, v, 6, 4.0f / 6, 1.0f / 36);
+			break;
+		default:
+			sd_vertex_generic(sd, v);
+		}
 	}
 
-	/* 2. Create new faces */
-	buf_reserve(faces, Fn);
-	buf_foreach(f, sd->faces) {
-		int j;
+	if (sd->vwidth) {
+		buf_resize(tmp, sd->vwidth);
+		for (i = begin; i < end; i++)
+			sd_vertex_values(it, &sd_v(i), tmp);
+		buf_free(tmp);
+	}
+}
+
+static void sd_move_vertices(struct sd_iter *it, int begin, int end)
+{
+	struct sd_mesh *sd = it->sd;
+	int i;
+
+	for (i = begin; i < end; i++)
+		vec_copy(sd_v(i).p, sd_v(i).newp);
+	if (sd->vwidth)
+		memcpy(sd_vv(begin), it->vvnew + (size_t) begin * sd->vwidth,
+		       (size_t) (end - begin) * sd->vwidth * sizeof(float));
+}
+
+/*
+ * Face varying values of the children of face i: the corner's own value,
+ * the midpoints towards its neighbours and the face's centroid, which is
+ * bilinear interpolation on quads.
+ */
+static void sd_face_values(struct sd_iter *it, int i, float *c)
+{
+	struct sd_mesh *sd = it->sd;
+	int j, w = sd->fwidth, n = buf_len(sd_f(i).vs);
+	size_t first = it->first ? it->first[i] : 4 * i;
+	const float *old = sd->fv + first * w;
+	float *q = it->fv + 4 * first * w;
+
+	vals_zero(c, w);
+	for (j = 0; j < n; j++)
+		vals_add(c, old + j * w, w);
+	vals_mul(c, 1.0f / n, w);
+
+	for (j = 0; j < n; j++, q += 4 * w) {
+		const float *a = old + ((j - 1 + n) % n) * w;
+		const float *b = old + j * w;
+		const float *d = old + ((j + 1) % n) * w;
+
+		vals_zero(q, w);
+		vals_add(q, a, w);
+		vals_add(q, b, w);
+		vals_mul(q, 0.5f, w);
+		memcpy(q + w, b, w * sizeof(*q));
+		vals_zero(q + 2 * w, w);
+		vals_add(q + 2 * w, b, w);
+		vals_add(q + 2 * w, d, w);
+		vals_mul(q + 2 * w, 0.5f, w);
+		memcpy(q + 3 * w, c, w * sizeof(*q));
+	}
+}
+
+static void sd_new_faces(struct sd_iter *it, int begin, int end)
+{
+	struct sd_mesh *sd = it->sd;
+	float *tmp = NULL;
+	int i, j;
+
+	buf_resize(tmp, sd->fwidth);
+	for (i = begin; i < end; i++) {
+		struct sd_face *f = &sd_f(i);
+		struct sd_face *nf = &it->faces[it->first ? it->first[i] : 4 * i];
+
 		for (j = 0; j < buf_len(f->vs); j++) {
 			int v0, v, v1;
 			struct sd_edge *e0, *e1;
-			struct sd_face new_face;
+			int vs[4];
 
 			v0 = f->vs[(j - 1 + buf_len(f->vs)) % buf_len(f->vs)];
 			v  = f->vs[j];
@@ -280,72 +645,713 @@ static void sd_do_iteration(struct sd_mesh *sd, int first_iteration, int last_it
 			e0 = &sd_e(sd_find_edge(sd, v0, v));
 			e1 = &sd_e(sd_find_edge(sd, v, v1));
 
-			new_face.vs = NULL;
-			buf_reserve(new_face.vs, 4);
-			buf_push(new_face.vs, e0->evert);
-			buf_push(new_face.vs, v);
-			buf_push(new_face.vs, e1->evert);
-			buf_push(new_face.vs, f->fvert);
-			new_face.fvert = -1;
+			vs[0] = e0->evert;
+			vs[1] = v;
+			vs[2] = e1->evert;
+			vs[3] = f->fvert;
+			nf[j].vs = NULL;
+			buf_append(nf[j].vs, vs, 4);
+			nf[j].fvert = -1;
+		}
+		if (sd->fwidth)
+			sd_face_values(it, i, tmp);
+	}
+	buf_free(tmp);
+}
 
-			buf_push(faces, new_face);
+/*
+ * Renumbers the vertices by first use in the new faces.  Those are in
+ * parent face order, so the corners of every child quad, and the faces
+ * and edges around a vertex once the links are rebuilt, end up close
+ * together in sd->verts instead of in the three ranges of old, face and
+ * edge points.
+ */
+static void sd_reorder(struct sd_mesh *sd)
+{
+	struct sd_vert *verts = NULL;
+	struct sd_face *f;
+	float *vv = NULL;
+	int i, n = 0, *map = NULL, *vi;
+
+	buf_resize(map, buf_len(sd->verts));
+	memset(map, -1, buf_len(map) * sizeof(*map));
+	buf_resize(verts, buf_len(sd->verts));
+	buf_foreach(f, sd->faces) {
+		buf_foreach(vi, f->vs) {
+			if (map[*vi] < 0) {
+				map[*vi] = n;
+				verts[n++] = sd_v(*vi);
+			}
+			*vi = map[*vi];
+		}
+	}
+	/* Vertices on no face keep their relative order at the end */
+	for (i = 0; i < buf_len(map); i++) {
+		if (map[i] < 0) {
+			map[i] = n;
+			verts[n++] = sd_v(i);
 		}
 	}
-	SWAP(struct sd_face *, sd->faces, faces);
-	buf_free(faces);
+
+	if (sd->vwidth) {
+		buf_resize(vv, buf_len(sd->vv));
+		for (i = 0; i < buf_len(map); i++)
+			memcpy(vv + (size_t) map[i] * sd->vwidth, sd_vv(i),
+			       sd->vwidth * sizeof(*vv));
+		SWAP(float *, sd->vv, vv);
+		buf_free(vv);
+	}
+	SWAP(struct sd_vert *, sd->verts, verts);
+	buf_free(verts);
+	buf_free(map);
+}
+
+static int sd_iterate(struct sd_mesh *sd, int first_iteration,
+		      int last_iteration, struct pool *pool)
+{
+	int V, F, E, Vn, Fn, En;
+	struct sd_iter it;
+	struct sd_face *f;
+	mem_enter(MEM_SD);
+	stats_timer(t);
+
+	stats_level(++sd->level);
+
+	/* V' = V + F + E
+	 * F' = Sum_i=0^F(f_i), (F' = 4F, when quad-mesh)
+	 * E' = 2E + F'
+	 */
+	V = buf_len(sd->verts);
+	F = buf_len(sd->faces);
+	E = buf_len(sd->edges);
+	Vn = V + F + E;
+
+	it.sd = sd;
+	it.pool = pool;
+	it.mem = mem_account_();
+	it.tag = mem_tag_();
+	it.stats = sd_stats_account_();
+	it.V = V;
+	it.F = F;
+	it.faces = NULL;
+	it.first = NULL;
+	it.vvnew = NULL;
+	it.fv = NULL;
+	if (first_iteration) {
+		Fn = 0;
+		buf_foreach(f, sd->faces)
+			Fn += buf_len(f->vs);
+	} else {
+		/* After the first iteration all faces are quads */
+		Fn = 4 * F;
+	}
+	En = 2 * E + Fn;
+
+	/* Everything sized by the level up front, so running out leaves sd be */
+	if ((first_iteration && buf_try_reserve(it.first, F)) ||
+	    buf_try_reserve(sd->verts, Vn) || buf_try_reserve(it.faces, Fn) ||
+	    (sd->vwidth &&
+	     (buf_try_reserve(sd->vv, (size_t) Vn * sd->vwidth) ||
+	      buf_try_reserve(it.vvnew, (size_t) V * sd->vwidth))) ||
+	    (sd->fwidth &&
+	     buf_try_reserve(it.fv, (size_t) 4 * Fn * sd->fwidth)) ||
+	    (!last_iteration && buf_try_reserve(sd->edges, En))) {
+		buf_free(it.first);
+		buf_free(it.faces);
+		buf_free(it.vvnew);
+		buf_free(it.fv);
+		sd->level--;
+		mem_leave();
+		return -1;
+	}
+	if (first_iteration) {
+		buf_resize(it.first, F);
+		Fn = 0;
+		buf_foreach(f, sd->faces) {
+			it.first[sd_fi(f)] = Fn;
+			Fn += buf_len(f->vs);
+		}
+	}
+
+	/* 1. Update vertices */
+	buf_resize(sd->verts, Vn);
+	if (sd->vwidth) {
+		buf_resize(sd->vv, (size_t) Vn * sd->vwidth);
+		buf_resize(it.vvnew, (size_t) V * sd->vwidth);
+	}
+
+	sd_split(&it, F, sd_face_points);
+	stats_lap(t, face_points);
+
+	sd_split(&it, E, sd_edge_points);
+	stats_lap(t, edge_points);
+
+	/* Old vertices move only once every new position is known */
+	sd_split(&it, V, sd_vertex_points);
+	sd_split(&it, V, sd_move_vertices);
+	buf_free(it.vvnew);
+	stats_lap(t, vertex_points);
+
+	/* 2. Create new faces */
+	buf_resize(it.faces, Fn);
+	if (sd->fwidth)
+		buf_resize(it.fv, (size_t) 4 * Fn * sd->fwidth);
+	sd_split(&it, F, sd_new_faces);
+	SWAP(struct sd_face *, sd->faces, it.faces);
+	SWAP(float *, sd->fv, it.fv);
+	buf_free(it.fv);
+	buf_foreach(f, it.faces)
+		buf_free(f->vs);
+	buf_free(it.faces);
+	buf_free(it.first);
+	/* Only pays off for the passes of a next iteration */
+	if (sd->opt.local_order && !last_iteration)
+		sd_reorder(sd);
+	stats_lap(t, faces);
 
 	/* 3. Update edges */
-	if (!last_iteration) {	/* Skip on last iteration */
-		buf_reserve(sd->edges, En);
+	if (!last_iteration)	/* Skip on last iteration */
 		sd_update_links(sd);
-	}
+	stats_lap(t, links);
+	stats_set(nr_verts, Vn);
+	stats_set(nr_faces, Fn);
+	stats_set(nr_edges, last_iteration ? 0 : buf_len(sd->edges));
+	stats_set(face_span, sd_face_span(sd));
+	stats_set(sd_bytes, sd_bytes(sd));
+	mem_leave();
+	return 0;
 }
 
-static struct mesh *sd_convert(struct sd_mesh *sd)
+int sd_do_iteration(struct sd_mesh *sd, int first_iteration, int last_iteration)
+{
+	return sd_iterate(sd, first_iteration, last_iteration, NULL);
+}
+
+struct mesh *sd_convert(struct sd_mesh *sd)
 {
 	struct mesh *mesh;
 	struct sd_vert *v;
 	struct sd_face *f;
-	int *vi;
+	struct sd_channel *c;
+	int i, k = 0, *vi;
+	mem_enter(MEM_SD);
+	stats_timer(t);
 
-	mesh = mesh_create();
+	stats_level(sd->level);
+	mesh = mesh_create_shared();
+	buf_foreach(c, sd->channels)
+		mesh_add_channel(mesh, c->kind, c->width);
+	buf_foreach(f, sd->faces)
+		k += buf_len(f->vs);
+	if (mesh_reserve(mesh, buf_len(sd->verts), buf_len(sd->faces), k)) {
+		mesh_free(mesh);
+		mem_leave();
+		return NULL;
+	}
+	k = 0;
 	buf_foreach(v, sd->verts)
 		mesh_add_vertex(mesh, v->p);
+
+	/* Face varying values are stored per corner, in corner order */
+	buf_foreach(c, sd->channels) {
+		int ch = c - sd->channels;
+
+		if (c->kind == MESH_VERTEX_VARYING) {
+			for (i = 0; i < buf_len(sd->verts); i++)
+				mesh_add_channel_value(mesh, ch, sd_vv(i) + c->offset);
+		} else {
+			for (i = 0; i < buf_len(sd->fv) / sd->fwidth; i++)
+				mesh_add_channel_value(mesh, ch, sd->fv +
+						       i * sd->fwidth + c->offset);
+		}
+	}
+
 	buf_foreach(f, sd->faces) {
 		mesh_begin_face(mesh);
-		buf_foreach(vi, f->vs)
+		buf_foreach(vi, f->vs) {
 			mesh_add_index(mesh, *vi, -1);
+			buf_foreach(c, sd->channels)
+				if (c->kind == MESH_FACE_VARYING)
+					mesh_add_channel_index(mesh, c - sd->channels, k);
+			k++;
+		}
 		mesh_end_face(mesh);
 	}
-	mesh_compute_normals(mesh);
+	stats_lap(t, convert);
+	mem_leave();
 	return mesh;
 }
 
-struct mesh *subdivide(const struct mesh *mesh, int iterations)
+void sd_export_counts(const struct sd_mesh *sd, struct sd_counts *counts)
+{
+	struct sd_face *f;
+
+	counts->verts = buf_len(sd->verts);
+	counts->faces = buf_len(sd->faces);
+	counts->tris = 0;
+	counts->lines = 0;
+	buf_foreach(f, sd->faces) {
+		counts->tris += buf_len(f->vs) - 2;
+		counts->lines += buf_len(f->vs);
+	}
+}
+
+/* Corners per vec_*_n() call, as in mesh_compute_normals() */
+#define NORMAL_BATCH	256
+
+static void sd_add_corner_normals(float *normals, float *u, const float *v,
+				  const int *vi, int n)
+{
+	int i;
+
+	vec_cross_n(u, u, v, n);
+	vec_normalize_n(u, u, n);
+	for (i = 0; i < n; i++)
+		vec_add(normals + 3 * vi[i], normals + 3 * vi[i], u + 3 * i);
+}
+
+/* Same operations in the same order as mesh_compute_normals() */
+static void sd_compute_normals(const struct sd_mesh *sd, float *normals)
+{
+	float u[3 * NORMAL_BATCH], v[3 * NORMAL_BATCH];
+	int vi[NORMAL_BATCH], j, k = 0;
+	struct sd_face *f;
+
+	memset(normals, 0, 3 * buf_len(sd->verts) * sizeof(*normals));
+	buf_foreach(f, sd->faces) {
+		int n = buf_len(f->vs);
+
+		for (j = 0; j < n; j++) {
+			const float *v0 = sd_v(f->vs[j]).p;
+
+			vec_sub(u + 3 * k, sd_v(f->vs[(j + 1) % n]).p, v0);
+			vec_sub(v + 3 * k, sd_v(f->vs[(j + n - 1) % n]).p, v0);
+			vi[k] = f->vs[j];
+			if (++k == NORMAL_BATCH) {
+				sd_add_corner_normals(normals, u, v, vi, k);
+				k = 0;
+			}
+		}
+	}
+	if (k)
+		sd_add_corner_normals(normals, u, v, vi, k);
+	vec_normalize_n(normals, normals, buf_len(sd->verts));
+}
+
+static inline void sd_put_index(void *buf, int size, int i, int idx)
+{
+	if (size == 2)
+		((unsigned short *) buf)[i] = idx;
+	else
+		((unsigned int *) buf)[i] = idx;
+}
+
+int sd_export(const struct sd_mesh *sd, const struct sd_layout *layout,
+	      void *verts, void *tris, void *lines)
+{
+	int i, j, nt = 0, nl = 0, size = layout->index_size;
+	int nr_verts = buf_len(sd->verts);
+	struct sd_face *f;
+	char *dst = verts;
+	float *normals = NULL;
+	stats_timer(t);
+
+	stats_level(sd->level);
+	if ((size != 2 && size != 4) || (size == 2 && nr_verts > 0x10000) ||
+	    layout->position < 0 ||
+	    layout->position + 3 * (int) sizeof(float) > layout->stride ||
+	    layout->normal + 3 * (int) sizeof(float) > layout->stride)
+		return -1;
+
+	if (layout->normal >= 0) {
+		mem_enter(MEM_SD);
+
+		buf_init_simd(normals);
+		buf_resize(normals, 3 * nr_verts);
+		mem_leave();
+		sd_compute_normals(sd, normals);
+		stats_lap(t, normals);
+	}
+	for (i = 0; i < nr_verts; i++, dst += layout->stride) {
+		memcpy(dst + layout->position, sd_v(i).p, sizeof(vector));
+		if (normals)
+			memcpy(dst + layout->normal, normals + 3 * i, sizeof(vector));
+	}
+	buf_free(normals);
+
+	buf_foreach(f, sd->faces) {
+		int n = buf_len(f->vs);
+
+		for (j = 1; tris && j + 1 < n; j++) {
+			sd_put_index(tris, size, nt++, f->vs[0]);
+			sd_put_index(tris, size, nt++, f->vs[j]);
+			sd_put_index(tris, size, nt++, f->vs[j + 1]);
+		}
+		for (j = 0; lines && j < n; j++) {
+			sd_put_index(lines, size, nl++, f->vs[j]);
+			sd_put_index(lines, size, nl++, f->vs[(j + 1) % n]);
+		}
+	}
+	stats_lap(t, convert);
+	return 0;
+}
+
+static struct mesh *sd_subdivide(const struct mesh *mesh, int iterations,
+				 const struct sd_options *opt, struct pool *pool)
 {
 	int i;
 	struct sd_mesh *sd;
 	struct mesh *ret;
+	uint64_t key = 0;
+
+	if (opt && opt->cache_dir) {
+		key = sd_cache_key(mesh_hash(mesh), iterations, opt, 0);
+		if ((ret = sd_cache_load(opt, key, mesh)))
+			return ret;
+	}
 
-	sd = sd_init(mesh);
+	if (!(sd = sd_init_opts(mesh, opt)))
+		return NULL;
 	for (i = 0; i < iterations; i++) {
-		sd_do_iteration(sd, i == 0, i + 1 == iterations);
+		if (sd_iterate(sd, i == 0, i + 1 == iterations, pool)) {
+			sd_free(sd);
+			return NULL;
+		}
 	}
 	ret = sd_convert(sd);
 	sd_free(sd);
+	if (!ret)
+		return NULL;
+	mesh_compute_normals(ret);
+
+	if (opt && opt->cache_dir)
+		sd_cache_store(opt, key, mesh, ret);
 	return ret;
 }
 
+struct mesh *subdivide(const struct mesh *mesh, int iterations)
+{
+	return sd_subdivide(mesh, iterations, NULL, NULL);
+}
+
+struct mesh *subdivide_opts(const struct mesh *mesh, int iterations,
+			    const struct sd_options *opt)
+{
+	return sd_subdivide(mesh, iterations, opt, NULL);
+}
+
+/*
+ * Batch jobs: meshes below SD_BATCH_PACK refined faces are packed together
+ * into one pool task, those above SD_BATCH_SPLIT are refined one at a time
+ * with every iteration split over the pool.
+ */
+#define SD_BATCH_PACK		(1 << 14)
+#define SD_BATCH_SPLIT		(1 << 16)
+
+struct sd_batch {
+	const struct mesh **meshes;
+	const int *levels;
+	struct mesh **results;
+	const struct sd_options *opt;
+	int begin, end;
+	struct mem_stats *mem;
+	int tag;
+};
+
+static void sd_batch_run(void *arg)
+{
+	struct sd_batch *b = arg;
+	struct mem_stats *mem = mem_stats_attach(b->mem);
+	int i, tag = mem_set_tag_(b->tag);
+
+	for (i = b->begin; i < b->end; i++)
+		b->results[i] = subdivide_opts(b->meshes[i], b->levels[i],
+					       b->opt);
+	mem_set_tag_(tag);
+	mem_stats_attach(mem);
+}
+
+/* Refined face count, as a double since it may not fit an int */
+static double sd_batch_cost(const struct mesh *mesh, int level)
+{
+	double cost = 0.0;
+	int i, nr_faces;
+
+	nr_faces = mesh_face_count(mesh);
+	if (!level)
+		return nr_faces;
+	for (i = 0; i < nr_faces; i++)
+		cost += mesh_face_vertex_count(mesh, i);
+	for (i = 1; i < level; i++)
+		cost *= 4.0;
+	return cost;
+}
+
+void subdivide_batch(const struct mesh **meshes, const int *levels,
+		     struct mesh **results, int nr_meshes,
+		     const struct sd_options *opt, struct pool *pool)
+{
+	struct pool_group group = { 0 };
+	struct sd_batch *jobs = NULL, job;
+	int *split = NULL, *i;
+	double cost = 0.0;
+	int j;
+	mem_enter(MEM_SD);
+
+	if (!pool) {
+		for (j = 0; j < nr_meshes; j++)
+			results[j] = subdivide_opts(meshes[j], levels[j], opt);
+		mem_leave();
+		return;
+	}
+
+	job.meshes = meshes;
+	job.levels = levels;
+	job.results = results;
+	job.opt = opt;
+	job.begin = 0;
+	job.mem = mem_account_();
+	job.tag = mem_tag_();
+	for (j = 0; j < nr_meshes; j++) {
+		double c = sd_batch_cost(meshes[j], levels[j]);
+
+		/* Packed jobs are contiguous runs of small meshes */
+		if (c >= SD_BATCH_SPLIT && pool_size(pool) > 1) {
+			if (job.begin < j) {
+				job.end = j;
+				buf_push(jobs, job);
+			}
+			buf_push(split, j);
+			job.begin = j + 1;
+			cost = 0.0;
+			continue;
+		}
+		cost += c;
+		if (cost >= SD_BATCH_PACK) {
+			job.end = j + 1;
+			buf_push(jobs, job);
+			job.begin = j + 1;
+			cost = 0.0;
+		}
+	}
+	if (job.begin < nr_meshes) {
+		job.end = nr_meshes;
+		buf_push(jobs, job);
+	}
+	/* Nothing to overlap with a lone packed job, so no hand-off either */
+	if (buf_len(jobs) == 1 && !split) {
+		sd_batch_run(&jobs[0]);
+		buf_free(jobs);
+		mem_leave();
+		return;
+	}
+
+	/*
+	 * Queue the packed jobs first so the workers have something to do
+	 * while this thread runs the serial parts of the split meshes.  Each
+	 * split phase waits for its own ranges only, running those still
+	 * queued itself, so it does not stall behind the packed jobs.
+	 */
+	for (j = 0; j < buf_len(jobs); j++)
+		pool_add_group(pool, &group, sd_batch_run, &jobs[j]);
+	buf_foreach(i, split)
+		results[*i] = sd_subdivide(meshes[*i], levels[*i], opt, pool);
+	pool_wait_group(pool, &group);
+
+	buf_free(jobs);
+	buf_free(split);
+	mem_leave();
+}
+
+void subdivide_levels_opts(const struct mesh *mesh, struct mesh **levels,
+			   int nr_levels, const struct sd_options *opt)
+{
+	int i, cached = opt && opt->cache_dir;
+	uint64_t hash = cached ? mesh_hash(mesh) : 0;
+	struct sd_mesh *sd;
+
+	/* All levels or none, a miss refines from the base anyway */
+	for (i = 0; cached && i < nr_levels; i++) {
+		uint64_t key = sd_cache_key(hash, i + 1, opt, i + 1 < nr_levels);
+
+		if (!(levels[i] = sd_cache_load(opt, key, mesh)))
+			break;
+	}
+	if (cached && i == nr_levels)
+		return;
+	while (cached && i--)
+		mesh_free(levels[i]);
+
+	sd = sd_init_opts(mesh, opt);
+	for (i = 0; i < nr_levels; i++) {
+		if (!sd || sd_do_iteration(sd, i == 0, i + 1 == nr_levels) ||
+		    !(levels[i] = sd_convert(sd))) {
+			/* The caller gets every level or none */
+			while (i--)
+				mesh_free(levels[i]);
+			for (i = 0; i < nr_levels; i++)
+				levels[i] = NULL;
+			break;
+		}
+		mesh_compute_normals(levels[i]);
+		if (cached)
+			sd_cache_store(opt, sd_cache_key(hash, i + 1, opt,
+							 i + 1 < nr_levels),
+				       mesh, levels[i]);
+	}
+	if (sd)
+		sd_free(sd);
+}
+
 void subdivide_levels(const struct mesh *mesh,
 		      struct mesh **levels, int nr_levels)
 {
-	int i;
+	subdivide_levels_opts(mesh, levels, nr_levels, NULL);
+}
+
+/*
+ * A level's record, see topo.c: counts, face list and, unless it is the
+ * last, the edges and the faces and edge neighbours of every vertex in
+ * v->fs and v->es order.
+ */
+static void sd_topo_record(struct sd_mesh *sd, int **img, int links)
+{
+	int *p, k, *ei;
+	struct sd_vert *v;
+	struct sd_face *f;
+	struct sd_edge *e;
+
+	p = buf_push_n(*img, 4);
+	p[0] = buf_len(sd->verts);
+	p[1] = buf_len(sd->faces);
+	p[2] = links ? buf_len(sd->edges) : 0;
+	p[3] = 0;
+	buf_foreach(f, sd->faces)
+		p[3] += buf_len(f->vs);
+
+	p = buf_push_n(*img, buf_len(sd->faces) + 1);
+	k = *p++ = 0;
+	buf_foreach(f, sd->faces)
+		*p++ = k += buf_len(f->vs);
+	buf_foreach(f, sd->faces)
+		buf_append(*img, f->vs, buf_len(f->vs));
+	if (!links)
+		return;
+
+	buf_foreach(e, sd->edges) {
+		p = buf_push_n(*img, 4);
+		p[0] = e->v0;
+		p[1] = e->v1;
+		p[2] = e->f0;
+		p[3] = e->f1;
+	}
+
+	p = buf_push_n(*img, buf_len(sd->verts) + 1);
+	k = *p++ = 0;
+	buf_foreach(v, sd->verts)
+		*p++ = k += buf_len(v->fs);
+	buf_foreach(v, sd->verts)
+		buf_append(*img, v->fs, buf_len(v->fs));
+	buf_foreach(v, sd->verts)
+		buf_foreach(ei, v->es)
+			buf_push(*img, sd_vi(sd_edge_other(sd, &sd_e(*ei), v)));
+}
+
+void sd_topo_levels_(const struct mesh *base, int nr_levels,
+		     int **img, int *offsets)
+{
 	struct sd_mesh *sd;
+	int i;
+	mem_enter(MEM_SD);
 
-	sd = sd_init(mesh);
-	for (i = 0; i < nr_levels; i++) {
-		sd_do_iteration(sd, i == 0, i + 1 == nr_levels);
-		levels[i] = sd_convert(sd);
+	sd = sd_init(base);
+	for (i = 0; i <= nr_levels; i++) {
+		offsets[i] = buf_len(*img);
+		sd_topo_record(sd, img, i < nr_levels);
+		if (i < nr_levels)
+			sd_do_iteration(sd, i == 0, i + 1 == nr_levels);
 	}
 	sd_free(sd);
+	mem_leave();
+}
+
+void subdivide_patch_faces(const struct mesh *base, int level, int *first_face)
+{
+	int i, nr_faces, scale;
+
+	/* The first iteration splits n-gons into n quads, later ones by four */
+	scale = 1;
+	for (i = 1; i < level; i++)
+		scale *= 4;
+
+	nr_faces = mesh_face_count(base);
+	first_face[0] = 0;
+	for (i = 0; i < nr_faces; i++) {
+		int n = level ? scale * mesh_face_vertex_count(base, i) : 1;
+		first_face[i + 1] = first_face[i] + n;
+	}
+}
+
+void subdivide_patch_bounds(const struct mesh *base, float *bounds)
+{
+	int i, j, k, l, nr_verts, nr_faces;
+	int *first = NULL, *vfaces = NULL, *fill = NULL;
+	const float *vbuf;
+	mem_enter(MEM_SD);
+
+	nr_verts = mesh_vertex_buffer(base, &vbuf);
+	nr_faces = mesh_face_count(base);
+
+	/* Faces around each vertex */
+	buf_resize(first, nr_verts + 1);
+	memset(first, 0, (nr_verts + 1) * sizeof(*first));
+	for (i = 0; i < nr_faces; i++) {
+		for (j = 0; j < mesh_face_vertex_count(base, i); j++) {
+			int vi, ni;
+
+			mesh_face_vertex_index(base, i, j, &vi, &ni);
+			first[vi + 1]++;
+		}
+	}
+	for (i = 0; i < nr_verts; i++)
+		first[i + 1] += first[i];
+	buf_resize(vfaces, first[nr_verts]);
+	buf_resize(fill, nr_verts);
+	memcpy(fill, first, nr_verts * sizeof(*fill));
+	for (i = 0; i < nr_faces; i++) {
+		for (j = 0; j < mesh_face_vertex_count(base, i); j++) {
+			int vi, ni;
+
+			mesh_face_vertex_index(base, i, j, &vi, &ni);
+			vfaces[fill[vi]++] = i;
+		}
+	}
+
+	/* Box of all vertices of the faces touching each face */
+	for (i = 0; i < nr_faces; i++) {
+		float *min = bounds + 6 * i, *max = min + 3;
+
+		vec_set(min, INFINITY, INFINITY, INFINITY);
+		vec_neg(max, min);
+		for (j = 0; j < mesh_face_vertex_count(base, i); j++) {
+			int vi, ni;
+
+			mesh_face_vertex_index(base, i, j, &vi, &ni);
+			for (k = first[vi]; k < first[vi + 1]; k++) {
+				int g = vfaces[k];
+
+				for (l = 0; l < mesh_face_vertex_count(base, g); l++) {
+					const float *p = mesh_get_vertex(base, g, l);
+
+					vec_min(min, min, p);
+					vec_max(max, max, p);
+				}
+			}
+		}
+	}
+
+	buf_free(first);
+	buf_free(vfaces);
+	buf_free(fill);
+	mem_leave();
 }
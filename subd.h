@@ -1,8 +1,128 @@
 #ifndef SUBD_H
 #define SUBD_H
 
+#include <stddef.h>
+
+/*
+ * Refinement options, sd_defaults() fills in the ones the plain calls use.
+ *
+ * local_order	renumbers the vertices by first use in face order after
+ *		every iteration but the last, so the corners of a face sit
+ *		close together in memory and the next iteration gathers
+ *		from nearby vertices.  The geometry is the same, only the
+ *		vertex order of the result changes.
+ *
+ * valence_kernels	moves the old vertices of valence 3 to 6 with kernels
+ *		unrolled for their valence and precomputed weights.  0 runs
+ *		every vertex through the generic rule instead; the results
+ *		are the same to the bit, only the speed differs.
+ *
+ * cache_dir	when set, subdivide_opts(), subdivide_levels_opts() and
+ *		subdivide_batch() first look for the result in this
+ *		directory, keyed by mesh_hash() of the input, the level and
+ *		the options, and save what they compute there.  Hits are
+ *		mapped and copied out without any parsing.
+ * cache_size	caps the bytes the directory's entries may take; the least
+ *		recently used ones go first.  0 means no cap.
+ */
+struct sd_options {
+	int local_order;
+	int valence_kernels;
+	const char *cache_dir;
+	size_t cache_size;
+};
+
+void sd_defaults(struct sd_options *opt);
+
+/*
+ * Mesh channels (see mesh.h) are refined in the same pass as positions:
+ * vertex varying ones with the same Catmull-Clark weights, face varying
+ * ones linearly within each face, so seams stay where they are.  In the
+ * result every face corner has its own face varying value.
+ *
+ * The arrays that grow with the level are allocated up front, and when
+ * they cannot be subdivide*() return NULL (every level NULL for
+ * subdivide_levels*(), results[i] NULL in subdivide_batch()) instead of
+ * calling the buffers' out of memory handler.
+ */
 struct mesh *subdivide(const struct mesh *mesh, int iterations);
 void subdivide_levels(const struct mesh *mesh,
 		      struct mesh **levels, int nr_levels);
+struct mesh *subdivide_opts(const struct mesh *mesh, int iterations,
+			    const struct sd_options *opt);
+void subdivide_levels_opts(const struct mesh *mesh, struct mesh **levels,
+			   int nr_levels, const struct sd_options *opt);
+
+/*
+ * Subdivides meshes[i] levels[i] times into results[i], as subdivide()
+ * would, using the pool's workers.  Small meshes are packed several to a
+ * task and large ones have each iteration split across the pool, so a
+ * long lived pool serves any mix of sizes.  It waits for its own tasks
+ * only, whatever else the pool runs, but still must not run as one of the
+ * pool's own tasks.  With a NULL pool the meshes are refined in turn on
+ * the calling thread, as is a batch small enough for a single task, so
+ * the stats of a lone mesh are the calling thread's.  opt may be NULL.
+ */
+struct pool;
+void subdivide_batch(const struct mesh **meshes, const int *levels,
+		     struct mesh **results, int nr_meshes,
+		     const struct sd_options *opt, struct pool *pool);
+
+/*
+ * Refined faces stay grouped by the base face they descend from: at the
+ * given level the faces of base face i are first_face[i]..first_face[i+1]-1
+ * (first_face holds face count + 1 entries).  Since the scheme has positive
+ * weights and one ring support, every such patch lies inside the convex
+ * hull of the base vertices around its face; bounds receives that hull's
+ * box as min xyz, max xyz per base face.
+ */
+void subdivide_patch_faces(const struct mesh *base, int level, int *first_face);
+void subdivide_patch_bounds(const struct mesh *base, float *bounds);
+
+/*
+ * Step-wise refinement, subdivide() and subdivide_levels() are built on
+ * these.  sd_convert() does not compute normals.  sd_init() uses the
+ * default options.  sd_init*() and sd_convert() return NULL and
+ * sd_do_iteration() returns -1, leaving sd at its level, when memory
+ * runs out.
+ */
+struct sd_mesh *sd_init(const struct mesh *mesh);
+struct sd_mesh *sd_init_opts(const struct mesh *mesh,
+			     const struct sd_options *opt);
+void sd_free(struct sd_mesh *sd);
+int sd_do_iteration(struct sd_mesh *sd, int first_iteration, int last_iteration);
+struct mesh *sd_convert(struct sd_mesh *sd);
+
+/*
+ * Interleaved export straight from the refined sd_mesh, with no struct
+ * mesh in between.  Each vertex takes stride bytes with its position (and
+ * normal unless the offset is -1) as three floats at the given byte
+ * offsets.  Faces are fan triangulated into tris, and lines receives the
+ * two ends of every face edge, face by face, for wireframes.  Indices are
+ * index_size (2 or 4) bytes wide.
+ *
+ * sd_export_counts() gives the array sizes to allocate; verts takes
+ * verts * stride bytes, tris 3 * tris and lines 2 * lines indices.  Either
+ * index array may be NULL.  sd_export() returns -1 when the layout is
+ * invalid or the indices do not fit index_size.  Normals are the same as
+ * mesh_compute_normals() gives.  Channels are not exported.
+ */
+struct sd_layout {
+	int stride;
+	int position;
+	int normal;
+	int index_size;
+};
+
+struct sd_counts {
+	int verts;
+	int faces;
+	int tris;
+	int lines;
+};
+
+void sd_export_counts(const struct sd_mesh *sd, struct sd_counts *counts);
+int sd_export(const struct sd_mesh *sd, const struct sd_layout *layout,
+	      void *verts, void *tris, void *lines);
 
 #endif
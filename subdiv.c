@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "buf.h"
+#include "memstats.h"
+#include "mesh.h"
+#include "obj.h"
+#include "subd.h"
+#include "pool.h"
+#include "shm.h"
+#include "stats.h"
+#include "sys.h"
+#include "topo.h"
+#include "util.h"
+
+/*
+ * Why an input failed.  The first two leave no refined mesh, the others
+ * still report one.
+ */
+enum {
+	JOB_OK,
+	JOB_READ,
+	JOB_NOMEM,
+	JOB_WRITE,
+	JOB_PUBLISH,
+	JOB_NR_ERRORS
+};
+
+/* Each takes the file or name the step was working on */
+static const char *job_errors[JOB_NR_ERRORS] = {
+	NULL,
+	"cannot read %s",
+	"out of memory subdividing %s",
+	"cannot write %s",
+	"cannot publish %s",
+};
+
+struct job {
+	const char *in;
+	char out[1024];
+	int level;
+	const struct sd_options *opt;
+	const char *topo_dir;
+	const char *shm_name;
+	int error;
+	int nr_faces;
+	struct mesh *mesh, *res;
+	double t_read, t_subd, t_write;
+	struct sd_stats stats;	/* enabled == 0 when not known per input */
+};
+
+/* The whole run's library heap use, whichever thread allocates */
+static struct mem_stats run_mem;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: subdiv [-l level] [-j threads] [-r] [-T dir] [-C dir] [-S name]\n"
+		"              [-o output] input.obj...\n"
+		"\n"
+		"  -l level     number of subdivision iterations (default 2)\n"
+		"  -j threads   number of worker threads (default: all cpus)\n"
+		"  -r           renumber vertices for locality after each level\n"
+		"  -T dir       reuse refined topologies saved in dir, saving new ones\n"
+		"  -C dir       reuse refined meshes cached in dir, caching new ones\n"
+		"  -S name      publish the refined mesh to shared memory name\n"
+		"  -o output    output file, or directory when given several inputs\n");
+	exit(1);
+}
+
+static void output_path(struct job *job, const char *out, int dir)
+{
+	const char *base, *dot;
+
+	if (!out) {
+		job->out[0] = '\0';
+		return;
+	}
+	if (!dir) {
+		snprintf(job->out, sizeof(job->out), "%s", out);
+		return;
+	}
+
+	base = strrchr(job->in, '/');
+	base = base ? base + 1 : job->in;
+	dot = strrchr(base, '.');
+	snprintf(job->out, sizeof(job->out), "%s/%.*s.%d.obj", out,
+		 (int) (dot ? dot - base : strlen(base)), base, job->level);
+}
+
+static void print_stats(const struct sd_stats *st)
+{
+	int i;
+
+	for (i = 0; i < st->nr_levels; i++) {
+		const struct sd_level_stats *l = &st->level[i];
+
+		printf("  level %d: %d verts %d faces %d edges, "
+		       "%.1f KiB sd, %.1f KiB mesh, face span %.0f\n", i,
+		       l->nr_verts, l->nr_faces, l->nr_edges,
+		       l->sd_bytes / 1024.0, l->mesh_bytes / 1024.0,
+		       l->face_span);
+		printf("    face %.3fms edge %.3fms vertex %.3fms faces %.3fms "
+		       "links %.3fms convert %.3fms normals %.3fms\n",
+		       l->face_points * 1e3, l->edge_points * 1e3,
+		       l->vertex_points * 1e3, l->faces * 1e3, l->links * 1e3,
+		       l->convert * 1e3, l->normals * 1e3);
+		printf("    %ld edge lookups, %.2f probes/lookup\n",
+		       l->edge_lookups, l->edge_lookups ?
+		       (double) l->edge_probes / l->edge_lookups : 0.0);
+	}
+}
+
+static void print_mem(const struct mem_stats *mem)
+{
+	int i;
+
+	printf("  memory: peak %.1f KiB,", mem->total.peak / 1024.0);
+	for (i = 0; i < MEM_NR_TAGS; i++)
+		if (mem->tag[i].allocs)
+			printf(" %s %.1f KiB", mem_tag_name(i),
+			       mem->tag[i].peak / 1024.0);
+	printf(", %ld allocs, %ld reallocs copying up to %.1f KiB\n",
+	       mem->total.allocs, mem->total.reallocs,
+	       mem->total.copied / 1024.0);
+}
+
+static void run_read(void *arg)
+{
+	struct job *job = arg;
+	struct mem_stats *mem = mem_stats_attach(&run_mem);
+	double t = sys_time();
+
+	if (!(job->mesh = obj_read(job->in)))
+		job->error = JOB_READ;
+	job->t_read = sys_time() - t;
+	mem_stats_attach(mem);
+}
+
+/*
+ * Falls back to subdivide_opts() for meshes it cannot build a topology
+ * for.  Topologies are per input, so these run one input per task.
+ */
+static void run_topo(void *arg)
+{
+	struct job *job = arg;
+	struct mem_stats *mem = mem_stats_attach(&run_mem);
+	struct sd_topo *topo;
+	double t = sys_time();
+
+	if ((topo = sd_topo_get(job->topo_dir, job->mesh, job->level)))
+		job->res = sd_topo_subdivide(topo, job->mesh, job->level);
+	sd_topo_free(topo);
+	if (!job->res)
+		job->res = subdivide_opts(job->mesh, job->level, job->opt);
+	job->t_subd = sys_time() - t;
+	job->stats = *sd_stats_get();
+	mem_stats_attach(mem);
+}
+
+/*
+ * Every input in one subdivide_batch(), which packs small meshes into
+ * tasks and splits the iterations of large ones across the pool, so a
+ * single big input still uses every thread.  Its time is that of the
+ * whole batch, and its stats are known only when it is alone.
+ */
+static void subdivide_jobs(struct job *jobs, int nr_jobs, struct pool *pool)
+{
+	const struct mesh **meshes = NULL;
+	struct mesh **res = NULL;
+	int *levels = NULL, *idx = NULL, i;
+	struct mem_stats *mem;
+	double t;
+
+	for (i = 0; i < nr_jobs; i++) {
+		if (!jobs[i].mesh)
+			continue;
+		buf_push(meshes, jobs[i].mesh);
+		buf_push(levels, jobs[i].level);
+		buf_push(idx, i);
+	}
+	buf_resize(res, buf_len(meshes));
+
+	mem = mem_stats_attach(&run_mem);
+	sd_stats_reset();
+	t = sys_time();
+	subdivide_batch(meshes, levels, res, buf_len(meshes), jobs[0].opt, pool);
+	t = sys_time() - t;
+	mem_stats_attach(mem);
+
+	for (i = 0; i < buf_len(idx); i++) {
+		struct job *job = &jobs[idx[i]];
+
+		job->res = res[i];
+		job->t_subd = t;
+		if (nr_jobs == 1)
+			job->stats = *sd_stats_get();
+	}
+	buf_free(meshes);
+	buf_free(levels);
+	buf_free(idx);
+	buf_free(res);
+}
+
+static void print_error(const struct job *job)
+{
+	const char *name = job->error == JOB_WRITE ? job->out :
+			   job->error == JOB_PUBLISH ? job->shm_name : job->in;
+
+	fprintf(stderr, "subdiv: ");
+	fprintf(stderr, job_errors[job->error], name);
+	fputc('\n', stderr);
+}
+
+static void run_write(void *arg)
+{
+	struct job *job = arg;
+	struct mem_stats *mem = mem_stats_attach(&run_mem);
+	double t;
+
+	if (!job->res) {
+		mem_stats_attach(mem);
+		return;
+	}
+	job->nr_faces = mesh_face_count(job->res);
+	if (job->out[0]) {
+		t = sys_time();
+		if (obj_write(job->out, job->res))
+			job->error = JOB_WRITE;
+		job->t_write = sys_time() - t;
+	}
+	if (job->shm_name) {
+		struct mesh_shm *shm = mesh_shm_create(job->shm_name);
+
+		if (!shm || mesh_shm_publish(shm, job->res))
+			job->error = JOB_PUBLISH;
+		mesh_shm_close(shm);
+	}
+	mem_stats_attach(mem);
+}
+
+int main(int argc, char **argv)
+{
+	int i, c, nr_jobs, level = 2, nr_threads = 0, ret = 0;
+	const char *out = NULL, *topo_dir = NULL, *shm_name = NULL;
+	struct sd_options opt;
+	struct job *jobs;
+	struct pool *pool;
+	double t;
+
+	sd_defaults(&opt);
+	while ((c = getopt(argc, argv, "l:j:rT:C:S:o:h")) != -1) {
+		switch (c) {
+		case 'l':
+			level = atoi(optarg);
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		case 'r':
+			opt.local_order = 1;
+			break;
+		case 'T':
+			topo_dir = optarg;
+			break;
+		case 'C':
+			opt.cache_dir = optarg;
+			break;
+		case 'S':
+			shm_name = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	nr_jobs = argc - optind;
+	if (nr_jobs <= 0 || level < 0 || (topo_dir && (opt.local_order || opt.cache_dir)) ||
+	    (shm_name && nr_jobs > 1))
+		usage();
+
+	jobs = calloc(nr_jobs, sizeof(*jobs));
+	for (i = 0; i < nr_jobs; i++) {
+		jobs[i].in = argv[optind + i];
+		jobs[i].level = level;
+		jobs[i].opt = &opt;
+		jobs[i].topo_dir = topo_dir;
+		jobs[i].shm_name = shm_name;
+		output_path(&jobs[i], out, nr_jobs > 1);
+	}
+
+	if (nr_threads <= 0)
+		nr_threads = sys_nr_cpus();
+
+	t = sys_time();
+	pool = pool_create(nr_threads);
+	for (i = 0; i < nr_jobs; i++)
+		pool_add(pool, run_read, &jobs[i]);
+	pool_wait(pool);
+	if (topo_dir) {
+		for (i = 0; i < nr_jobs; i++)
+			if (jobs[i].mesh)
+				pool_add(pool, run_topo, &jobs[i]);
+		pool_wait(pool);
+	} else {
+		subdivide_jobs(jobs, nr_jobs, pool);
+	}
+	for (i = 0; i < nr_jobs; i++) {
+		mesh_free(jobs[i].mesh);
+		jobs[i].mesh = NULL;
+		if (!jobs[i].error && !jobs[i].res)
+			jobs[i].error = JOB_NOMEM;
+		pool_add(pool, run_write, &jobs[i]);
+	}
+	pool_wait(pool);
+	pool_free(pool);
+	t = sys_time() - t;
+
+	for (i = 0; i < nr_jobs; i++) {
+		struct job *job = &jobs[i];
+
+		if (job->error) {
+			print_error(job);
+			ret = 1;
+		}
+		if (job->error == JOB_READ || job->error == JOB_NOMEM)
+			continue;
+		printf("%s@%d: %d faces, read %.3fs, subdivide %.3fs, write %.3fs\n",
+		       job->in, job->level, job->nr_faces,
+		       job->t_read, job->t_subd, job->t_write);
+		if (job->stats.enabled)
+			print_stats(&job->stats);
+		mesh_free(job->res);
+	}
+	if (run_mem.total.allocs)
+		print_mem(&run_mem);
+	printf("total %.3fs, peak memory %.1f MiB\n",
+	       t, sys_peak_rss() / (1024.0 * 1024.0));
+
+	free(jobs);
+	return ret;
+}
@@ -0,0 +1,116 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "sys.h"
+
+double sys_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double sys_cpu_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+size_t sys_cur_rss(void)
+{
+	FILE *f;
+	long pages = 0;
+
+	if (!(f = fopen("/proc/self/statm", "r")))
+		return 0;
+	if (fscanf(f, "%*d %ld", &pages) != 1)
+		pages = 0;
+	fclose(f);
+	return (size_t) pages * sysconf(_SC_PAGESIZE);
+}
+
+size_t sys_peak_rss(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+#ifdef __APPLE__
+	return ru.ru_maxrss;
+#else
+	return (size_t) ru.ru_maxrss * 1024;
+#endif
+}
+
+int sys_nr_cpus(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+void *sys_map_file(const char *file, size_t *size)
+{
+	struct stat st;
+	void *addr;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return NULL;
+	*size = st.st_size;
+	return addr;
+}
+
+void sys_unmap_file(void *addr, size_t size)
+{
+	munmap(addr, size);
+}
+
+int sys_write_file(const char *file, const void *data, size_t size)
+{
+	char tmp[4096];
+	const char *p = data;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >= sizeof(tmp))
+		return -1;
+	if ((fd = mkstemp(tmp)) < 0)
+		return -1;
+	while (size) {
+		ssize_t n = write(fd, p, size);
+
+		if (n <= 0) {
+			close(fd);
+			unlink(tmp);
+			return -1;
+		}
+		p += n;
+		size -= n;
+	}
+	if (close(fd) || rename(tmp, file)) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+int sys_touch_file(const char *file)
+{
+	return utimensat(AT_FDCWD, file, NULL, 0);
+}
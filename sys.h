@@ -0,0 +1,29 @@
+#ifndef SYS_H
+#define SYS_H
+
+#include <stddef.h>
+
+/* Wall clock time in seconds from an arbitrary monotonic origin */
+double sys_time(void);
+
+/* CPU time consumed by the calling thread in seconds */
+double sys_cpu_time(void);
+
+/* Resident set size of the process in bytes */
+size_t sys_cur_rss(void);
+size_t sys_peak_rss(void);
+
+int sys_nr_cpus(void);
+
+/*
+ * sys_map_file() maps a whole file read only and returns NULL when it
+ * cannot.  sys_write_file() writes through a temporary file and rename(),
+ * so readers see either the old file or all of the new one.
+ * sys_touch_file() sets a file's modification time to now.
+ */
+void *sys_map_file(const char *file, size_t *size);
+void sys_unmap_file(void *addr, size_t size);
+int sys_write_file(const char *file, const void *data, size_t size);
+int sys_touch_file(const char *file);
+
+#endif
@@ -0,0 +1,525 @@
+#include <stdio.h>
+#include <string.h>
+#include "buf.h"
+#include "mathx.h"
+#include "memstats.h"
+#include "mesh.h"
+#include "sys.h"
+#include "topo.h"
+
+/*
+ * The image is an array of ints, the same in memory and on disk: a header,
+ * the offset of every level's record, then the records.  Level l has
+ *
+ *	V F E C				counts, C face corners
+ *	face_first[F + 1]		face i is face_verts[face_first[i]..]
+ *	face_verts[C]
+ *
+ * and, for every level but the last,
+ *
+ *	edges[4 * E]			v0 v1 f0 f1
+ *	vert_first[V + 1]		n faces and n edges around vertex i
+ *	vert_faces[]			at vert_first[i], as in sd_vert.fs
+ *	vert_others[]			other ends of the edges, as in sd_vert.es
+ *
+ * New points are numbered as subdivide() numbers them, the face point of
+ * face i is V + i and the edge point of edge i V + F + i.
+ */
+#define TOPO_MAGIC		0x50544453	/* "SDTP" */
+#define TOPO_VERSION		1
+
+enum {
+	TOPO_HDR_MAGIC,
+	TOPO_HDR_VERSION,
+	TOPO_HDR_HASH_LO,
+	TOPO_HDR_HASH_HI,
+	TOPO_HDR_LEVELS,
+	TOPO_HDR_SIZE,		/* In ints */
+	TOPO_HDR_OFFSETS,
+};
+
+struct sd_topo {
+	const int *img;
+	size_t size;		/* In ints */
+	int *buf;		/* The image when built, NULL when mapped */
+	uint64_t hash;
+	int nr_levels;
+};
+
+struct topo_level {
+	int V, F, E, C;
+	const int *face_first, *face_verts;
+	const int *edges;
+	const int *vert_first, *vert_faces, *vert_others;
+};
+
+/* FNV-1a */
+static uint64_t topo_hash_int(uint64_t h, unsigned int x)
+{
+	int i;
+
+	for (i = 0; i < 4; i++, x >>= 8) {
+		h ^= x & 0xff;
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+uint64_t sd_topo_hash(const struct mesh *mesh)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	int i, j, nr_faces;
+
+	h = topo_hash_int(h, mesh_vertex_buffer(mesh, NULL));
+	nr_faces = mesh_face_count(mesh);
+	h = topo_hash_int(h, nr_faces);
+	for (i = 0; i < nr_faces; i++) {
+		int n = mesh_face_vertex_count(mesh, i);
+
+		h = topo_hash_int(h, n);
+		for (j = 0; j < n; j++) {
+			int vi, ni;
+
+			mesh_face_vertex_index(mesh, i, j, &vi, &ni);
+			h = topo_hash_int(h, vi);
+		}
+	}
+	return h;
+}
+
+static void topo_level(const struct sd_topo *topo, int l, struct topo_level *lv)
+{
+	const int *p = topo->img + topo->img[TOPO_HDR_OFFSETS + l];
+
+	lv->V = p[0];
+	lv->F = p[1];
+	lv->E = p[2];
+	lv->C = p[3];
+	p += 4;
+	lv->face_first = p;
+	p += lv->F + 1;
+	lv->face_verts = p;
+	p += lv->C;
+	if (l == topo->nr_levels)
+		return;
+	lv->edges = p;
+	p += 4 * lv->E;
+	lv->vert_first = p;
+	p += lv->V + 1;
+	lv->vert_faces = p;
+	lv->vert_others = p + lv->vert_first[lv->V];
+}
+
+/* Every index in [0, n) */
+static int topo_check_range(const int *p, long nr, long n)
+{
+	long i;
+
+	for (i = 0; i < nr; i++)
+		if (p[i] < 0 || p[i] >= n)
+			return -1;
+	return 0;
+}
+
+/* CSR offsets from 0 to nr_items, each run at least min long */
+static int topo_check_first(const int *first, long n, long nr_items, int min)
+{
+	long i;
+
+	if (first[0] != 0 || first[n] != nr_items)
+		return -1;
+	for (i = 0; i < n; i++)
+		if (first[i + 1] - (long) first[i] < min)
+			return -1;
+	return 0;
+}
+
+/*
+ * Walks the whole image, so that evaluation can trust every count and
+ * index in it.  Each level's counts must also follow from the previous.
+ */
+static int topo_check(const int *img, size_t size)
+{
+	long V = 0, F = 0, E = 0, C = 0, l, nr_levels, n;
+	const int *p, *end = img + size;
+
+	if (size < TOPO_HDR_OFFSETS || img[TOPO_HDR_MAGIC] != TOPO_MAGIC ||
+	    img[TOPO_HDR_VERSION] != TOPO_VERSION ||
+	    img[TOPO_HDR_SIZE] != (long) size)
+		return -1;
+	nr_levels = img[TOPO_HDR_LEVELS];
+	if (nr_levels < 0 || nr_levels >= (long) size - TOPO_HDR_OFFSETS)
+		return -1;
+
+	for (l = 0; l <= nr_levels; l++) {
+		long off = img[TOPO_HDR_OFFSETS + l];
+
+		if (off < TOPO_HDR_OFFSETS + nr_levels + 1 || off > (long) size - 4)
+			return -1;
+		p = img + off;
+		if (l && (p[0] != V + F + E || p[1] != C || p[3] != 4L * C))
+			return -1;
+		V = p[0];
+		F = p[1];
+		E = p[2];
+		C = p[3];
+		p += 4;
+		if (V < 0 || F < 0 || E < 0 || C < 0 || end - p < F + 1 + C ||
+		    topo_check_first(p, F, C, 1) ||
+		    topo_check_range(p + F + 1, C, V))
+			return -1;
+		p += F + 1 + C;
+		if (l == nr_levels)
+			break;
+
+		if (end - p < 4 * E + V + 1)
+			return -1;
+		for (n = 0; n < E; n++, p += 4)
+			if (topo_check_range(p, 2, V) ||
+			    topo_check_range(p + 2, 2, F))
+				return -1;
+		n = p[V];
+		if (n < 0 || topo_check_first(p, V, n, 0) ||
+		    end - (p + V + 1) < 2 * n ||
+		    topo_check_range(p + V + 1, n, F) ||
+		    topo_check_range(p + V + 1 + n, n, V))
+			return -1;
+	}
+	return 0;
+}
+
+static struct sd_topo *topo_create(const int *img, size_t size, int *buf)
+{
+	struct sd_topo *topo;
+
+	if (topo_check(img, size))
+		return NULL;
+	topo = mem_alloc(sizeof(*topo));
+	topo->img = img;
+	topo->size = size;
+	topo->buf = buf;
+	topo->hash = (uint32_t) img[TOPO_HDR_HASH_LO] |
+		     (uint64_t) (uint32_t) img[TOPO_HDR_HASH_HI] << 32;
+	topo->nr_levels = img[TOPO_HDR_LEVELS];
+	return topo;
+}
+
+struct sd_topo *sd_topo_build(const struct mesh *base, int nr_levels)
+{
+	struct sd_topo *topo;
+	int *img = NULL, *offsets = NULL;
+	uint64_t hash;
+	mem_enter(MEM_SD);
+
+	hash = sd_topo_hash(base);
+	buf_resize(img, TOPO_HDR_OFFSETS + nr_levels + 1);
+	buf_resize(offsets, nr_levels + 1);
+	sd_topo_levels_(base, nr_levels, &img, offsets);
+
+	img[TOPO_HDR_MAGIC] = TOPO_MAGIC;
+	img[TOPO_HDR_VERSION] = TOPO_VERSION;
+	img[TOPO_HDR_HASH_LO] = (uint32_t) hash;
+	img[TOPO_HDR_HASH_HI] = (uint32_t) (hash >> 32);
+	img[TOPO_HDR_LEVELS] = nr_levels;
+	img[TOPO_HDR_SIZE] = buf_len(img);
+	memcpy(img + TOPO_HDR_OFFSETS, offsets, (nr_levels + 1) * sizeof(*img));
+	buf_free(offsets);
+
+	/* Held to the same checks as a loaded image */
+	if (!(topo = topo_create(img, buf_len(img), img)))
+		buf_free(img);
+	mem_leave();
+	return topo;
+}
+
+int sd_topo_save(const struct sd_topo *topo, const char *file)
+{
+	return sys_write_file(file, topo->img, topo->size * sizeof(int));
+}
+
+struct sd_topo *sd_topo_load(const char *file)
+{
+	struct sd_topo *topo = NULL;
+	size_t size;
+	void *img;
+	mem_enter(MEM_SD);
+
+	if ((img = sys_map_file(file, &size))) {
+		if (size % sizeof(int) ||
+		    !(topo = topo_create(img, size / sizeof(int), NULL)))
+			sys_unmap_file(img, size);
+	}
+	mem_leave();
+	return topo;
+}
+
+struct sd_topo *sd_topo_get(const char *dir, const struct mesh *base,
+			    int nr_levels)
+{
+	struct sd_topo *topo;
+	uint64_t hash = sd_topo_hash(base);
+	char file[4096];
+
+	snprintf(file, sizeof(file), "%s/%016llx.sdtopo", dir,
+		 (unsigned long long) hash);
+	topo = sd_topo_load(file);
+	if (topo && (topo->hash != hash || topo->nr_levels < nr_levels)) {
+		sd_topo_free(topo);
+		topo = NULL;
+	}
+	if (!topo && (topo = sd_topo_build(base, nr_levels)))
+		sd_topo_save(topo, file);
+	return topo;
+}
+
+void sd_topo_free(struct sd_topo *topo)
+{
+	if (!topo)
+		return;
+	if (topo->buf)
+		buf_free(topo->buf);
+	else
+		sys_unmap_file((void *) topo->img, topo->size * sizeof(int));
+	mem_free(topo);
+}
+
+int sd_topo_levels(const struct sd_topo *topo)
+{
+	return topo->nr_levels;
+}
+
+/*
+ * One iteration on pts, positions and vertex varying values packed
+ * stride floats per vertex, and fv, fw face varying floats per corner,
+ * with the operations of sd_do_iteration() in the same order.
+ */
+static void topo_refine(const struct topo_level *lv, float **pts, int stride,
+			float **fv, int fw)
+{
+	int i, j, V = lv->V, F = lv->F, E = lv->E;
+	float *p, *tmp = NULL, *s, *nfv = NULL, *c = NULL;
+
+#define P(vi)	(p + (size_t) (vi) * stride)
+
+	buf_resize(*pts, (size_t) (V + F + E) * stride);
+	p = *pts;
+
+	for (i = 0; i < F; i++) {
+		const int *vs = lv->face_verts + lv->face_first[i];
+		int n = lv->face_first[i + 1] - lv->face_first[i];
+		float *d = P(V + i);
+
+		vals_zero(d, stride);
+		for (j = 0; j < n; j++)
+			vals_add(d, P(vs[j]), stride);
+		vals_mul(d, 1.0f / n, stride);
+	}
+
+	for (i = 0; i < E; i++) {
+		const int *e = lv->edges + 4 * i;
+		float *d = P(V + F + i);
+
+		vals_zero(d, stride);
+		vals_add(d, P(e[0]), stride);
+		vals_add(d, P(e[1]), stride);
+		vals_add(d, P(V + e[2]), stride);
+		vals_add(d, P(V + e[3]), stride);
+		vals_mul(d, 0.25f, stride);
+	}
+
+	/* Old vertices move only once every new position is known */
+	buf_resize(tmp, (size_t) (V + 1) * stride);
+	s = tmp + (size_t) V * stride;
+	for (i = 0; i < V; i++) {
+		int first = lv->vert_first[i], n = lv->vert_first[i + 1] - first;
+		float *d = tmp + (size_t) i * stride;
+
+		memcpy(d, P(i), stride * sizeof(*d));
+		vals_mul(d, (float) (n - 2) / n, stride);
+
+		vals_zero(s, stride);
+		for (j = 0; j < n; j++)
+			vals_add(s, P(V + lv->vert_faces[first + j]), stride);
+		vals_mad(d, 1.0f / (n * n), s, stride);
+
+		vals_zero(s, stride);
+		for (j = 0; j < n; j++)
+			vals_add(s, P(lv->vert_others[first + j]), stride);
+		vals_mad(d, 1.0f / (n * n), s, stride);
+	}
+	memcpy(p, tmp, (size_t) V * stride * sizeof(*p));
+	buf_free(tmp);
+
+#undef P
+
+	if (!fw)
+		return;
+
+	/* Corner k's children are corners 4k to 4k + 3, see sd_face_values() */
+	buf_resize(nfv, (size_t) 4 * lv->C * fw);
+	buf_resize(c, fw);
+	for (i = 0; i < F; i++) {
+		int first = lv->face_first[i], n = lv->face_first[i + 1] - first;
+		const float *old = *fv + (size_t) first * fw;
+		float *q = nfv + (size_t) 4 * first * fw;
+
+		vals_zero(c, fw);
+		for (j = 0; j < n; j++)
+			vals_add(c, old + j * fw, fw);
+		vals_mul(c, 1.0f / n, fw);
+
+		for (j = 0; j < n; j++, q += 4 * fw) {
+			const float *a = old + ((j - 1 + n) % n) * fw;
+			const float *b = old + j * fw;
+			const float *d = old + ((j + 1) % n) * fw;
+
+			vals_zero(q, fw);
+			vals_add(q, a, fw);
+			vals_add(q, b, fw);
+			vals_mul(q, 0.5f, fw);
+			memcpy(q + fw, b, fw * sizeof(*q));
+			vals_zero(q + 2 * fw, fw);
+			vals_add(q + 2 * fw, b, fw);
+			vals_add(q + 2 * fw, d, fw);
+			vals_mul(q + 2 * fw, 0.5f, fw);
+			memcpy(q + 3 * fw, c, fw * sizeof(*q));
+		}
+	}
+	buf_free(c);
+	buf_free(*fv);
+	*fv = nfv;
+}
+
+/* The hash only picks the topology, the faces decide, so no collision fits */
+static int topo_same_faces(const struct topo_level *lv, const struct mesh *base)
+{
+	int i, j, vi, ni;
+
+	if (mesh_face_count(base) != lv->F)
+		return 0;
+	for (i = 0; i < lv->F; i++) {
+		int first = lv->face_first[i], n = lv->face_first[i + 1] - first;
+
+		if (mesh_face_vertex_count(base, i) != n)
+			return 0;
+		for (j = 0; j < n; j++) {
+			mesh_face_vertex_index(base, i, j, &vi, &ni);
+			if (vi != lv->face_verts[first + j])
+				return 0;
+		}
+	}
+	return 1;
+}
+
+struct mesh *sd_topo_subdivide(const struct sd_topo *topo,
+			       const struct mesh *base, int level)
+{
+	int i, j, k, nr_ch, nr_verts, stride = 3, fw = 0, *offset = NULL;
+	float *pts = NULL, *fv = NULL;
+	struct topo_level lv;
+	struct mesh *mesh;
+	const float *vbuf;
+	mem_enter(MEM_SD);
+
+	topo_level(topo, 0, &lv);
+	nr_verts = mesh_vertex_buffer(base, &vbuf);
+	if (level < 0 || level > topo->nr_levels || nr_verts != lv.V ||
+	    !topo_same_faces(&lv, base)) {
+		mem_leave();
+		return NULL;
+	}
+
+	/* Vertex varying values follow the position, face varying per corner */
+	nr_ch = mesh_channel_count(base);
+	buf_resize(offset, nr_ch);
+	for (i = 0; i < nr_ch; i++) {
+		int *w = mesh_channel_kind(base, i) == MESH_VERTEX_VARYING ?
+			 &stride : &fw;
+
+		offset[i] = *w;
+		*w += mesh_channel_width(base, i);
+	}
+
+	buf_resize(pts, (size_t) nr_verts * stride);
+	for (i = 0; i < nr_verts; i++)
+		memcpy(pts + (size_t) i * stride, vbuf + 3 * i, sizeof(vector));
+	for (i = 0; i < nr_ch; i++) {
+		int w = mesh_channel_width(base, i), n;
+		const float *vals;
+
+		if (mesh_channel_kind(base, i) != MESH_VERTEX_VARYING)
+			continue;
+		n = mesh_channel_buffer(base, i, &vals);
+		for (j = 0; j < nr_verts; j++) {
+			float *dst = pts + (size_t) j * stride + offset[i];
+
+			if (j < n)
+				memcpy(dst, vals + j * w, w * sizeof(*dst));
+			else
+				vals_zero(dst, w);
+		}
+	}
+	if (fw) {
+		buf_resize(fv, (size_t) lv.C * fw);
+		for (i = 0; i < lv.F; i++) {
+			for (j = 0; j < lv.face_first[i + 1] - lv.face_first[i]; j++) {
+				float *dst = fv + (size_t) (lv.face_first[i] + j) * fw;
+
+				for (k = 0; k < nr_ch; k++) {
+					int w = mesh_channel_width(base, k), l;
+					const float *val;
+
+					if (mesh_channel_kind(base, k) != MESH_FACE_VARYING)
+						continue;
+					val = mesh_get_channel(base, k, i, j);
+					for (l = 0; l < w; l++)
+						dst[offset[k] + l] = val ? val[l] : 0.0f;
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < level; i++) {
+		topo_level(topo, i, &lv);
+		topo_refine(&lv, &pts, stride, &fv, fw);
+	}
+	topo_level(topo, level, &lv);
+
+	/* As sd_convert() and subdivide() build it */
+	mesh = mesh_create_shared();
+	for (i = 0; i < lv.V; i++)
+		mesh_add_vertex(mesh, pts + (size_t) i * stride);
+	for (i = 0; i < nr_ch; i++) {
+		int ch = mesh_add_channel(mesh, mesh_channel_kind(base, i),
+					  mesh_channel_width(base, i));
+
+		if (mesh_channel_kind(base, i) == MESH_VERTEX_VARYING) {
+			for (j = 0; j < lv.V; j++)
+				mesh_add_channel_value(mesh, ch, pts +
+						       (size_t) j * stride + offset[i]);
+		} else {
+			for (j = 0; j < lv.C; j++)
+				mesh_add_channel_value(mesh, ch, fv +
+						       (size_t) j * fw + offset[i]);
+		}
+	}
+	for (i = 0, k = 0; i < lv.F; i++) {
+		mesh_begin_face(mesh);
+		for (j = lv.face_first[i]; j < lv.face_first[i + 1]; j++, k++) {
+			int ch;
+
+			mesh_add_index(mesh, lv.face_verts[j], -1);
+			for (ch = 0; ch < nr_ch; ch++)
+				if (mesh_channel_kind(base, ch) == MESH_FACE_VARYING)
+					mesh_add_channel_index(mesh, ch, k);
+		}
+		mesh_end_face(mesh);
+	}
+	mesh_compute_normals(mesh);
+
+	buf_free(offset);
+	buf_free(pts);
+	buf_free(fv);
+	mem_leave();
+	return mesh;
+}
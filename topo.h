@@ -0,0 +1,45 @@
+#ifndef TOPO_H
+#define TOPO_H
+
+#include <stdint.h>
+
+/*
+ * Refinement topology saved across processes.  A topology holds, for
+ * every level up to the ones it was built for, the face lists, the edge
+ * table and the faces and edge neighbours around each vertex, which is
+ * all subdivide() works out before it can move a single point.  It only
+ * depends on the base mesh's faces and vertex count, so it is keyed by
+ * sd_topo_hash() of those and any cage with the same connectivity reuses
+ * it, whatever its positions and channel values.
+ *
+ * sd_topo_subdivide() gives the same mesh as subdivide() with the default
+ * options, or NULL when the topology is not the base mesh's or has fewer
+ * levels.  sd_topo_load() maps the file and checks that every index is in
+ * range, so a bad file fails to load instead of being read out of bounds.
+ * sd_topo_get() loads dir/<hash>.sdtopo, or builds it and saves it there
+ * when it is missing or has too few levels; failing to save is not an
+ * error.
+ */
+struct mesh;
+struct sd_topo;
+
+uint64_t sd_topo_hash(const struct mesh *mesh);
+struct sd_topo *sd_topo_build(const struct mesh *base, int nr_levels);
+struct sd_topo *sd_topo_load(const char *file);
+struct sd_topo *sd_topo_get(const char *dir, const struct mesh *base,
+			    int nr_levels);
+int sd_topo_save(const struct sd_topo *topo, const char *file);
+void sd_topo_free(struct sd_topo *topo);
+int sd_topo_levels(const struct sd_topo *topo);
+
+struct mesh *sd_topo_subdivide(const struct sd_topo *topo,
+			       const struct mesh *base, int level);
+
+/*
+ * Private: subd.c appends the record of every level of base, 0 to
+ * nr_levels, to the int buffer img and their positions in it to offsets.
+ */
+void sd_topo_levels_(const struct mesh *base, int nr_levels,
+		     int **img, int *offsets);
+
+#endif